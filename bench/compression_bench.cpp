@@ -0,0 +1,250 @@
+// Standalone benchmark for the image compressors in src/png.cpp and
+// src/jpeg.cpp. Does not depend on CEF; build and run using 'make bench'.
+//
+// Compresses each frame of the corpus (see bench/make_corpus.py) repeatedly
+// using PNGCompressor with 1..N threads and compressJPEG with several
+// qualities, and prints one JSON object per line for each (codec, setting,
+// frame) combination.
+
+#include "jpeg.hpp"
+#include "png.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <zlib.h>
+
+using std::cerr;
+using std::cout;
+using std::string;
+using std::vector;
+using std::chrono::steady_clock;
+
+namespace {
+
+struct Frame {
+    string name;
+    size_t width;
+    size_t height;
+    vector<uint8_t> data;
+};
+
+struct Options {
+    string corpusDir = "bench/corpus";
+    int iterations = 20;
+    int maxThreads = 0;
+    vector<int> jpegQualities = {20, 50, 80, 95};
+    string frameFilter;
+};
+
+[[noreturn]] void fail(const string& msg) {
+    cerr << "compression_bench: " << msg << "\n";
+    exit(1);
+}
+
+vector<uint8_t> readGzipFile(const string& path) {
+    gzFile fp = gzopen(path.c_str(), "rb");
+    if(fp == nullptr) {
+        fail("could not open '" + path + "'");
+    }
+    vector<uint8_t> data;
+    uint8_t buf[65536];
+    while(true) {
+        int count = gzread(fp, buf, sizeof(buf));
+        if(count < 0) {
+            gzclose(fp);
+            fail("could not read '" + path + "'");
+        }
+        if(count == 0) {
+            break;
+        }
+        data.insert(data.end(), buf, buf + count);
+    }
+    gzclose(fp);
+    return data;
+}
+
+vector<Frame> readCorpus(const Options& options) {
+    string indexPath = options.corpusDir + "/index.txt";
+    std::ifstream index(indexPath);
+    if(!index) {
+        fail("could not open '" + indexPath + "'");
+    }
+
+    vector<Frame> frames;
+    string line;
+    while(std::getline(index, line)) {
+        line = line.substr(0, line.find('#'));
+        std::stringstream ss(line);
+        Frame frame;
+        string filename;
+        if(!(ss >> frame.name >> filename >> frame.width >> frame.height)) {
+            continue;
+        }
+        if(!options.frameFilter.empty() && frame.name != options.frameFilter) {
+            continue;
+        }
+        frame.data = readGzipFile(options.corpusDir + "/" + filename);
+        if(frame.data.size() != 4 * frame.width * frame.height) {
+            fail("frame '" + frame.name + "' has invalid size");
+        }
+        frames.push_back(std::move(frame));
+    }
+    if(frames.empty()) {
+        fail("no frames in corpus");
+    }
+    return frames;
+}
+
+// Returns the value at given percentile (0..100) of the sorted samples
+double percentile(const vector<double>& sorted, double p) {
+    size_t idx = (size_t)(p / 100.0 * (double)(sorted.size() - 1) + 0.5);
+    return sorted[std::min(idx, sorted.size() - 1)];
+}
+
+// Runs compress (returning the compressed size) for the frame
+// options.iterations times after one warmup run and prints the results
+template <typename F>
+void runCase(
+    const Options& options,
+    const string& codec,
+    const string& settingName,
+    int settingValue,
+    const Frame& frame,
+    F compress
+) {
+    size_t compressedSize = compress();
+
+    vector<double> samplesMs;
+    for(int i = 0; i < options.iterations; ++i) {
+        steady_clock::time_point start = steady_clock::now();
+        compressedSize = compress();
+        samplesMs.push_back(
+            std::chrono::duration<double, std::milli>(steady_clock::now() - start).count()
+        );
+    }
+
+    double totalMs = 0.0;
+    for(double sample : samplesMs) {
+        totalMs += sample;
+    }
+    double meanMs = totalMs / (double)samplesMs.size();
+    std::sort(samplesMs.begin(), samplesMs.end());
+
+    double pixels = (double)(frame.width * frame.height);
+    size_t rawSize = 3 * frame.width * frame.height;
+
+    cout << "{\"codec\":\"" << codec << "\"";
+    cout << ",\"" << settingName << "\":" << settingValue;
+    cout << ",\"frame\":\"" << frame.name << "\"";
+    cout << ",\"width\":" << frame.width << ",\"height\":" << frame.height;
+    cout << ",\"iterations\":" << options.iterations;
+    cout << ",\"mean_ms\":" << meanMs;
+    cout << ",\"p50_ms\":" << percentile(samplesMs, 50.0);
+    cout << ",\"p90_ms\":" << percentile(samplesMs, 90.0);
+    cout << ",\"p99_ms\":" << percentile(samplesMs, 99.0);
+    cout << ",\"max_ms\":" << samplesMs.back();
+    cout << ",\"mpixels_per_s\":" << pixels / 1e6 / (meanMs / 1000.0);
+    cout << ",\"raw_rgb_bytes\":" << rawSize;
+    cout << ",\"compressed_bytes\":" << compressedSize;
+    cout << ",\"ratio\":" << (double)rawSize / (double)compressedSize;
+    cout << "}" << std::endl;
+}
+
+vector<int> parseIntList(const string& str) {
+    vector<int> ret;
+    std::stringstream ss(str);
+    string item;
+    while(std::getline(ss, item, ',')) {
+        ret.push_back(atoi(item.c_str()));
+    }
+    return ret;
+}
+
+Options parseOptions(int argc, char* argv[]) {
+    Options options;
+    for(int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        auto value = [&]() -> string {
+            if(i + 1 >= argc) {
+                fail("missing value for " + arg);
+            }
+            return argv[++i];
+        };
+        if(arg == "--corpus") {
+            options.corpusDir = value();
+        } else if(arg == "--iterations") {
+            options.iterations = atoi(value().c_str());
+        } else if(arg == "--max-threads") {
+            options.maxThreads = atoi(value().c_str());
+        } else if(arg == "--jpeg-qualities") {
+            options.jpegQualities = parseIntList(value());
+        } else if(arg == "--frame") {
+            options.frameFilter = value();
+        } else {
+            cerr << "Usage: " << argv[0] << " [--corpus DIR] [--iterations N]";
+            cerr << " [--max-threads N] [--jpeg-qualities Q1,Q2,...] [--frame NAME]\n";
+            exit(arg == "--help" ? 0 : 1);
+        }
+    }
+
+    if(options.iterations < 1) {
+        fail("invalid iteration count");
+    }
+    if(options.maxThreads <= 0) {
+        // Same cap as used by ImageCompressor
+        options.maxThreads = std::min(
+            std::max((int)std::thread::hardware_concurrency(), 1), 4
+        );
+    }
+    for(int quality : options.jpegQualities) {
+        if(quality < 1 || quality > 100) {
+            fail("invalid JPEG quality");
+        }
+    }
+    return options;
+}
+
+}
+
+int main(int argc, char* argv[]) {
+    Options options = parseOptions(argc, argv);
+    vector<Frame> frames = readCorpus(options);
+
+    for(int threadCount = 1; threadCount <= options.maxThreads; ++threadCount) {
+        PNGCompressor compressor(threadCount);
+        for(const Frame& frame : frames) {
+            runCase(options, "png", "threads", threadCount, frame, [&]() {
+                vector<vector<uint8_t>> png = compressor.compress(
+                    frame.data.data(), frame.width, frame.height, frame.width
+                );
+                size_t size = 0;
+                for(const vector<uint8_t>& chunk : png) {
+                    size += chunk.size();
+                }
+                return size;
+            });
+        }
+    }
+
+    for(int quality : options.jpegQualities) {
+        for(const Frame& frame : frames) {
+            runCase(options, "jpeg", "quality", quality, frame, [&]() {
+                return compressJPEG(
+                    frame.data.data(), frame.width, frame.height, frame.width,
+                    quality
+                ).length;
+            });
+        }
+    }
+
+    return 0;
+}
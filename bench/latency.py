@@ -0,0 +1,294 @@
+#!/usr/bin/env python3
+
+# Measures the latency from input events to the display of their effect, i.e.
+# the time from sending an event in an image request to receiving the first
+# frame that reflects it. The Browservice instance must show test/latency.html
+# (for example using --start-page), which increments a counter on each key
+# press and mouse button press and renders it as a machine-readable marker.
+#
+# The harness emulates the image loading loop of html/main.html in a single
+# session: an event is sent in an immediate image request (like a restarted
+# request in main.html), after which long-poll requests are made until the
+# marker in the returned frame shows the new counter value. With
+# --event-requests, the event is instead sent in a separate event request (like
+# main.html does when the server is run with --event-requests=yes) before the
+# long-poll requests. Event requests are disabled by default, so the server
+# must then be started with --event-requests=yes; otherwise the event request
+# fails with status 400. Optionally, other sessions are loaded at the same time
+# using the clients of bench/loadgen.py.
+# Compare quality settings by running the harness against instances started
+# with different --default-quality values.
+#
+# Requires Pillow for decoding the frames. Typical usage (see README.md):
+#
+#     cd test && python3 -m http.server &
+#     browservice --start-page=http://localhost:8000/latency.html &
+#     bench/latency.py --samples 200 --load 4
+
+import argparse
+import io
+import json
+import random
+import sys
+import threading
+import time
+
+from PIL import Image
+
+import loadgen
+
+# Marker geometry in test/latency.html
+MARKER_CELL = 24
+MARKER_BITS = 16
+
+# Point clicked in the page for mouse events
+CLICK_X = 300
+CLICK_Y = 200
+
+class Harness:
+    def __init__(self, args, rng):
+        self.args = args
+        self.rng = rng
+        self.client = loadgen.Client(0, args, rng)
+        self.img_req_idx = 0
+        self.event_idx = 0
+        self.content_type = None
+
+    def image_request(self, immediate, events):
+        self.img_req_idx += 1
+        path = "/{}/image/{}/{}/{}/{}/{}/{}/".format(
+            self.client.session_id, self.client.main_idx, self.img_req_idx,
+            immediate, self.args.width, self.args.height, self.event_idx
+        )
+        for event in events:
+            path += event + "/"
+        status, body = self.client.get(path)
+        if status != 200:
+            raise RuntimeError("image request failed with status {}".format(status))
+        self.event_idx += len(events)
+        if self.content_type is None:
+            self.content_type = "png" if body[:4] == b"\x89PNG" else "jpeg"
+        return body
+
+    def wait_for_marker(self):
+        deadline = time.monotonic() + 30.0
+        while time.monotonic() < deadline:
+            value = decode_marker(self.image_request(1, []))
+            if value is not None:
+                return value
+            time.sleep(0.1)
+        raise RuntimeError("latency marker not found; is the session showing test/latency.html?")
+
+    def event_request(self, events):
+        self.img_req_idx += 1
+        path = "/{}/event/{}/{}/{}/{}/{}/".format(
+            self.client.session_id, self.client.main_idx, self.img_req_idx,
+            self.args.width, self.args.height, self.event_idx
+        )
+        for event in events:
+            path += event + "/"
+        status, body = self.client.get(path)
+        if status != 200:
+            raise RuntimeError("event request failed with status {}".format(status))
+        self.event_idx += len(events)
+
+    def measure(self, events, expected):
+        start = time.monotonic()
+        if self.args.event_requests:
+            self.event_request(events)
+            value = decode_marker(self.image_request(0, []))
+        else:
+            value = decode_marker(self.image_request(1, events))
+        first_response = time.monotonic() - start
+        frames = 1
+        while value != expected:
+            if time.monotonic() - start > self.args.timeout:
+                return None, first_response, frames, value
+            value = decode_marker(self.image_request(0, []))
+            frames += 1
+        return time.monotonic() - start, first_response, frames, value
+
+def decode_marker(body):
+    """Returns the counter value shown by the marker in the frame, or None if
+    the marker is not found."""
+    img = Image.open(io.BytesIO(body)).convert("RGB")
+    width, height = img.size
+    pixels = img.load()
+
+    x = MARKER_CELL // 2
+    if x >= width:
+        return None
+
+    # Find the sentinel cell from the column through its center
+    sentinel_start = None
+    for y in range(min(height, 400)):
+        r, g, b = pixels[x, y]
+        is_sentinel = r > 160 and b > 160 and g < 100
+        if is_sentinel and sentinel_start is None:
+            sentinel_start = y
+        elif not is_sentinel and sentinel_start is not None:
+            break
+    else:
+        y = min(height, 400)
+    if sentinel_start is None or y - sentinel_start < MARKER_CELL // 2:
+        return None
+    center_y = (sentinel_start + y) // 2
+
+    value = 0
+    for i in range(MARKER_BITS):
+        cell_x = MARKER_CELL * (i + 1) + MARKER_CELL // 2
+        if cell_x >= width:
+            return None
+        r, g, b = pixels[cell_x, center_y]
+        if r + g + b < 3 * 128:
+            value |= 1 << i
+    return value
+
+def main():
+    parser = argparse.ArgumentParser(
+        description="Measure input-to-display latency using test/latency.html."
+    )
+    parser.add_argument("--url", default="http://127.0.0.1:8080/",
+        help="base URL of the Browservice instance (default: %(default)s)")
+    parser.add_argument("--samples", type=int, default=100,
+        help="number of latency samples (default: %(default)s)")
+    parser.add_argument("--events", choices=("key", "click", "both"), default="both",
+        help="type of input events to send (default: %(default)s)")
+    parser.add_argument("--event-requests", action="store_true",
+        help="send the events in separate event requests instead of image requests "
+            "(requires --event-requests=yes on the server)")
+    parser.add_argument("--interval", type=float, default=0.3,
+        help="mean idle time between samples in seconds (default: %(default)s)")
+    parser.add_argument("--timeout", type=float, default=5.0,
+        help="time after which a sample is counted as lost (default: %(default)s)")
+    parser.add_argument("--load", type=int, default=0,
+        help="number of concurrent bench/loadgen.py clients (default: %(default)s)")
+    parser.add_argument("--load-event-rate", type=float, default=10.0,
+        help="events per second per load client (default: %(default)s)")
+    parser.add_argument("--width", type=int, default=1024,
+        help="client viewport width (default: %(default)s)")
+    parser.add_argument("--height", type=int, default=768,
+        help="client viewport height (default: %(default)s)")
+    parser.add_argument("--user-agent",
+        default="Mozilla/5.0 (Windows NT 5.1; rv:52.0) Gecko/20100101 Firefox/52.0",
+        help="User-Agent sent by the clients; determines PNG support")
+    parser.add_argument("--http-auth", default="",
+        help="USER:PASSWORD for HTTP basic authentication")
+    parser.add_argument("--label", default="",
+        help="label included in the output, e.g. the quality setting")
+    parser.add_argument("--verbose", action="store_true",
+        help="print each sample")
+    parser.add_argument("--seed", type=int, default=None,
+        help="random seed")
+    args = parser.parse_args()
+
+    if args.samples < 1:
+        parser.error("invalid sample count")
+
+    rng = random.Random(args.seed)
+
+    # Background load
+    load_args = argparse.Namespace(**vars(args))
+    load_args.event_rate = args.load_event_rate
+    load_args.compact_events = False
+    load_clients = [
+        loadgen.Client(i + 1, load_args, random.Random(rng.getrandbits(64)))
+        for i in range(args.load)
+    ]
+    load_threads = []
+    for client in load_clients:
+        thread = threading.Thread(
+            target=client.run, args=(float("inf"),), daemon=True
+        )
+        thread.start()
+        load_threads.append(thread)
+
+    harness_args = argparse.Namespace(**vars(args))
+    harness_args.event_rate = 0.0
+    harness = Harness(harness_args, rng)
+    harness.client.open_session()
+
+    latencies = []
+    first_responses = []
+    frame_counts = []
+    lost = 0
+    try:
+        # Focus the page by clicking it before taking samples
+        counter = harness.wait_for_marker()
+        harness.image_request(1, [
+            "MDN_{}_{}_0".format(CLICK_X, CLICK_Y),
+            "MUP_{}_{}_0".format(CLICK_X, CLICK_Y),
+        ])
+        time.sleep(1.0)
+        counter = harness.wait_for_marker()
+
+        for i in range(args.samples):
+            time.sleep(rng.uniform(0.5, 1.5) * args.interval)
+
+            kind = args.events
+            if kind == "both":
+                kind = "key" if i % 2 == 0 else "click"
+            if kind == "key":
+                events = ["KPR_{}".format(rng.randrange(ord("a"), ord("z") + 1))]
+            else:
+                events = [
+                    "MDN_{}_{}_0".format(CLICK_X, CLICK_Y),
+                    "MUP_{}_{}_0".format(CLICK_X, CLICK_Y),
+                ]
+
+            expected = (counter + 1) % (1 << MARKER_BITS)
+            latency, first_response, frames, value = harness.measure(events, expected)
+            if value is not None:
+                counter = value
+            first_responses.append(first_response)
+            if latency is None:
+                lost += 1
+            else:
+                latencies.append(latency)
+                frame_counts.append(frames)
+
+            if args.verbose:
+                print(json.dumps({
+                    "sample": i,
+                    "event": kind,
+                    "latency_ms": None if latency is None else round(1000.0 * latency, 2),
+                    "first_response_ms": round(1000.0 * first_response, 2),
+                    "frames": frames,
+                }))
+    finally:
+        harness.client.close_session()
+        for client in load_clients:
+            client.shutdown = True
+            client.wake()
+        for thread in load_threads:
+            thread.join()
+
+    result = {
+        "summary": True,
+        "label": args.label,
+        "codec": harness.content_type,
+        "events": args.events,
+        "event_requests": args.event_requests,
+        "load_sessions": args.load,
+        "samples": args.samples,
+        "lost": lost,
+        "mean_frames_per_sample": (
+            round(sum(frame_counts) / len(frame_counts), 2) if frame_counts else None
+        ),
+    }
+    result.update(loadgen.latency_stats("latency", latencies))
+    result.update(loadgen.latency_stats("first_response", first_responses))
+    load_fps = [
+        c.frames / (c.end_time - c.start_time)
+        for c in load_clients
+        if c.start_time is not None and c.end_time is not None and c.end_time > c.start_time
+    ]
+    if load_fps:
+        result["load_mean_fps"] = round(sum(load_fps) / len(load_fps), 2)
+    print(json.dumps(result))
+
+    if lost == args.samples:
+        sys.exit(1)
+
+if __name__ == "__main__":
+    main()
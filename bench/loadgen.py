@@ -0,0 +1,639 @@
+#!/usr/bin/env python3
+
+# Synthetic load generator that emulates a number of clients running
+# html/main.html against a Browservice instance. Each emulated client creates a
+# session through "/", walks through the same prev/pre_main/next/main page flow
+# as a browser would, and then runs the image loading loop of main.html: image
+# requests are long polls that carry the queued input events, and new events
+# restart the pending request after a short delay. The events (mouse moves,
+# wheel scrolls and key presses) are generated randomly and encoded exactly as
+# main.html encodes them, in the plain or (with --compact-events) the compact
+# encoding. Like main.html, the clients accept the unchanged frame signal in
+# response to long polls.
+#
+# For each session, the number of frames, the frame rate, the number of bytes
+# received, the length of the image request paths and the frame latencies are
+# recorded and printed as JSON objects, one per line, followed by a summary of
+# all sessions.
+#
+# Only the Python standard library is required. Typical usage (see README.md):
+#
+#     cd test && python3 -m http.server &
+#     browservice --start-page=http://localhost:8000/page1.html &
+#     bench/loadgen.py --sessions 8 --duration 60
+
+import argparse
+import base64
+import http.client
+import json
+import random
+import re
+import socket
+import struct
+import sys
+import threading
+import time
+import urllib.parse
+
+# Constants matching main.html
+IMG_LOAD_RETRY_INTERVAL = 3.0
+LONG_POLL_RETRY_INTERVAL = 19.0
+IMG_LOAD_MAX_RETRIES = 10
+MIN_IFRAME_LOAD_INTERVAL = 2.0
+EVENT_DELAY = 0.01
+
+# Time resolution of the client loop
+TICK = 0.005
+
+# Key codes of typable characters sent as KPR events (as keypress would)
+TYPED_KEYS = list(range(ord("a"), ord("z") + 1)) + [ord(" ")] * 4
+
+# Opcodes of the compact event encoding (see src/event.cpp)
+COMPACT_EVENT_OPCODES = {
+    "MMO": "V", "MDN": "D", "MUP": "U", "MDBL": "B", "MWH": "W", "MOUT": "O",
+    "KDN": "H", "KUP": "R", "KPR": "P", "FOUT": "L",
+}
+
+def base36(value):
+    digits = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+    if value < 0:
+        return "-" + base36(-value)
+    ret = digits[value % 36]
+    while value >= 36:
+        value //= 36
+        ret = digits[value % 36] + ret
+    return ret
+
+def percentile(sorted_samples, p):
+    if not sorted_samples:
+        return None
+    idx = int(p / 100.0 * (len(sorted_samples) - 1) + 0.5)
+    return sorted_samples[min(idx, len(sorted_samples) - 1)]
+
+def latency_stats(prefix, samples):
+    samples = sorted(samples)
+    ret = {}
+    for name, p in (("p50", 50.0), ("p90", 90.0), ("p99", 99.0), ("max", 100.0)):
+        value = percentile(samples, p)
+        ret[prefix + "_" + name + "_ms"] = (
+            None if value is None else round(1000.0 * value, 2)
+        )
+    return ret
+
+def image_width(data):
+    """Returns the width of a PNG or JPEG image, or None if not recognized."""
+    if data[:8] == b"\x89PNG\r\n\x1a\n" and len(data) >= 24:
+        return struct.unpack(">I", data[16:20])[0]
+    if data[:2] == b"\xff\xd8":
+        pos = 2
+        while pos + 4 <= len(data):
+            if data[pos] != 0xFF:
+                return None
+            marker = data[pos + 1]
+            length = struct.unpack(">H", data[pos + 2:pos + 4])[0]
+            if 0xC0 <= marker <= 0xCF and marker not in (0xC4, 0xC8, 0xCC):
+                if pos + 9 > len(data):
+                    return None
+                return struct.unpack(">H", data[pos + 7:pos + 9])[0]
+            pos += 2 + length
+    return None
+
+def is_unchanged_signal(data):
+    """Returns true if the image is the 1x1 GIF sent by the server in response
+    to a long poll if the frame has not changed."""
+    return data[:3] == b"GIF" and data[6:10] == b"\x01\x00\x01\x00"
+
+class EventSource:
+    """Random input events at given rate, as the JS event handlers would
+    produce them for a user moving the mouse, scrolling and typing."""
+
+    def __init__(self, rng, rate, width, height):
+        self.rng = rng
+        self.rate = rate
+        self.width = width
+        self.height = height
+        self.mouse_x = width // 2
+        self.mouse_y = height // 2
+        self.next_time = None
+
+    def poll(self, now, client):
+        if self.rate <= 0.0:
+            return
+        if self.next_time is None:
+            self.next_time = now + self.rng.expovariate(self.rate)
+        while now >= self.next_time:
+            self.next_time += self.rng.expovariate(self.rate)
+            kind = self.rng.random()
+            if kind < 0.7:
+                # Mouse movement is only sent as the latest position (MMO) in
+                # the next image request, like document.onmousemove does
+                self.mouse_x = max(0, min(
+                    self.width - 1, self.mouse_x + self.rng.randint(-40, 40)
+                ))
+                self.mouse_y = max(0, min(
+                    self.height - 1, self.mouse_y + self.rng.randint(-40, 40)
+                ))
+                client.mouse_moved(self.mouse_x, self.mouse_y)
+            elif kind < 0.85:
+                delta = self.rng.choice((-120, 120))
+                client.put_event(
+                    client.mouse_event("MWH", self.mouse_x, self.mouse_y, delta)
+                )
+            else:
+                client.put_event(
+                    client.key_event("KPR", self.rng.choice(TYPED_KEYS))
+                )
+
+class Request:
+    """A single GET request running in its own thread."""
+
+    def __init__(self, client, path):
+        self.client = client
+        self.path = path
+        self.start_time = time.monotonic()
+        self.done = False
+        self.abandoned = False
+        self.status = None
+        self.body = None
+        self.error = None
+        self.conn = None
+        self.thread = threading.Thread(target=self._run, daemon=True)
+        self.thread.start()
+
+    def _run(self):
+        try:
+            self.conn = self.client.take_connection()
+            self.conn.request("GET", self.path, headers=self.client.headers)
+            resp = self.conn.getresponse()
+            body = resp.read()
+            with self.client.conn_lock:
+                reuse = not resp.will_close and not self.abandoned
+            if reuse:
+                self.client.return_connection(self.conn)
+            else:
+                self.conn.close()
+            self.status = resp.status
+            self.body = body
+        except (OSError, http.client.HTTPException) as e:
+            self.error = str(e)
+            if self.conn is not None:
+                self.conn.close()
+        self.done = True
+        self.client.wake()
+
+    def abandon(self):
+        # Like changing the src of an img element, drop the connection without
+        # waiting for the response
+        with self.client.conn_lock:
+            self.abandoned = True
+            conn = self.conn
+            if conn is not None and conn.sock is not None and not self.done:
+                try:
+                    conn.sock.shutdown(socket.SHUT_RDWR)
+                except OSError:
+                    pass
+
+class Client:
+    def __init__(self, idx, args, rng):
+        self.idx = idx
+        self.args = args
+        self.rng = rng
+
+        url = urllib.parse.urlsplit(args.url)
+        self.host = url.hostname
+        self.port = url.port or 80
+        self.headers = {"User-Agent": args.user_agent, "Connection": "keep-alive"}
+        if args.http_auth:
+            self.headers["Authorization"] = "Basic " + base64.b64encode(
+                args.http_auth.encode("UTF-8")
+            ).decode("ASCII")
+
+        self.idle_conns = []
+        self.conn_lock = threading.Lock()
+        self.cond = threading.Condition()
+
+        self.session_id = None
+        self.main_idx = None
+
+        # Image loop state mirroring main.html
+        self.event_queue = []
+        self.event_queue_start_idx = 0
+        self.event_times = []
+        self.pending_mouse = None
+        self.img_req_idx = 0
+        self.first_img_req_sent = False
+        self.img_load_attempts = 0
+        self.img_load_event_increment = 0
+        self.allow_new_event_notify = False
+        self.reload_time = None
+        self.request = None
+        self.request_immediate = 0
+        self.request_events_time = None
+        self.iframe_wanted = False
+        self.next_allowed_iframe_time = 0.0
+        self.iframe_request = None
+        self.shutdown = False
+
+        # Statistics
+        self.frames = 0
+        self.bytes = 0
+        self.upload_bytes = 0
+        self.errors = 0
+        self.restarted_requests = 0
+        self.unchanged_responses = 0
+        self.events = 0
+        self.frame_intervals = []
+        self.request_latencies = []
+        self.event_latencies = []
+        self.start_time = None
+        self.end_time = None
+        self.last_frame_time = None
+        self.failure = None
+
+    # Connection pool shared by the requests of the client
+
+    def take_connection(self):
+        with self.conn_lock:
+            if self.idle_conns:
+                return self.idle_conns.pop()
+        return http.client.HTTPConnection(self.host, self.port, timeout=30)
+
+    def return_connection(self, conn):
+        with self.conn_lock:
+            self.idle_conns.append(conn)
+
+    def wake(self):
+        with self.cond:
+            self.cond.notify()
+
+    def get(self, path):
+        conn = self.take_connection()
+        try:
+            conn.request("GET", path, headers=self.headers)
+            resp = conn.getresponse()
+            body = resp.read()
+        except (OSError, http.client.HTTPException):
+            conn.close()
+            raise
+        if resp.will_close:
+            conn.close()
+        else:
+            self.return_connection(conn)
+        self.bytes += len(body)
+        return resp.status, body
+
+    # Page flow: / -> prev/ -> / (pre_main) -> next/ -> / (main)
+
+    def open_session(self):
+        status, body = self.get("/")
+        if status != 200:
+            raise RuntimeError(
+                "creating session failed: {} {}".format(status, body[:100])
+            )
+        match = re.search(rb'"/([0-9]+)/prev/"', body)
+        if match is None:
+            raise RuntimeError("unexpected new session page")
+        self.session_id = int(match.group(1))
+
+        sid = self.session_id
+        for path in ("/{}/prev/", "/{}/", "/{}/next/", "/{}/"):
+            status, body = self.get(path.format(sid))
+            if status != 200:
+                raise RuntimeError("GET {} failed: {}".format(path.format(sid), status))
+
+        match = re.search(rb'"/[0-9]+/image/" \+\s*"([0-9]+)/"', body)
+        if match is None:
+            raise RuntimeError("unexpected main page")
+        self.main_idx = int(match.group(1))
+
+    def close_session(self):
+        if self.session_id is None or self.main_idx is None:
+            return
+        try:
+            self.get("/{}/close/{}/".format(self.session_id, self.main_idx))
+        except (OSError, http.client.HTTPException):
+            pass
+
+    # Event encoding, as mouseEvent, keyEvent and eventQueuePath in main.html;
+    # compact mouse events are queued as tuples and encoded relative to the
+    # previous mouse event in the same path
+
+    def mouse_event(self, name, x, y, extra_arg=None):
+        if self.args.compact_events:
+            suffix = ""
+            if extra_arg is not None:
+                suffix = "_" + base36(extra_arg)
+            return (COMPACT_EVENT_OPCODES[name], x, y, suffix)
+        event = "{}_{}_{}".format(name, x, y)
+        if extra_arg is not None:
+            event += "_{}".format(extra_arg)
+        return event
+
+    def event_queue_path(self):
+        path = ""
+        base_x = 0
+        base_y = 0
+        for event in self.event_queue:
+            if isinstance(event, str):
+                path += event + "/"
+            else:
+                opcode, x, y, suffix = event
+                path += "{}{}_{}{}/".format(
+                    opcode, base36(x - base_x), base36(y - base_y), suffix
+                )
+                base_x = x
+                base_y = y
+        return path
+
+    def key_event(self, name, key):
+        if self.args.compact_events:
+            return COMPACT_EVENT_OPCODES[name] + base36(key)
+        return "{}_{}".format(name, key)
+
+    # Event queue, as putEvent and document.onmousemove in main.html
+
+    def put_event(self, event):
+        self.event_queue.append(event)
+        self.event_times.append(time.monotonic())
+        self.events += 1
+        self.new_event_notify()
+
+    def mouse_moved(self, x, y):
+        if self.pending_mouse is None:
+            self.pending_mouse = (x, y, time.monotonic())
+            self.events += 1
+            self.new_event_notify()
+        else:
+            self.pending_mouse = (x, y, self.pending_mouse[2])
+
+    def new_event_notify(self):
+        if not self.allow_new_event_notify:
+            return
+        self.allow_new_event_notify = False
+        self.img_load_attempts = max(self.img_load_attempts - 1, 0)
+        self.reload_time = time.monotonic() + EVENT_DELAY
+
+    # Image loop, as startImgLoad, sendImgReq and imgLoadHandler in main.html
+
+    def start_img_load(self):
+        self.img_load_event_increment = len(self.event_queue)
+        self.first_img_req_sent = False
+        self.img_load_attempts = 0
+        self.allow_new_event_notify = True
+        self.send_img_req()
+
+    def send_img_req(self):
+        if self.img_load_attempts > IMG_LOAD_MAX_RETRIES:
+            self.failure = "connection lost"
+            self.shutdown = True
+            return
+        self.img_load_attempts += 1
+
+        if self.pending_mouse is not None:
+            x, y, t = self.pending_mouse
+            self.event_queue.append(self.mouse_event("MMO", x, y))
+            self.event_times.append(t)
+            self.pending_mouse = None
+
+        immediate = 1 if (self.first_img_req_sent or self.img_req_idx == 0) else 0
+        self.first_img_req_sent = True
+        self.img_req_idx += 1
+
+        path = "/{}/image/{}/{}/{}/{}/{}/{}/".format(
+            self.session_id, self.main_idx, self.img_req_idx, 1 if immediate else 2,
+            self.args.width, self.args.height, self.event_queue_start_idx
+        )
+        path += self.event_queue_path()
+        self.upload_bytes += len(path)
+
+        if self.request is not None:
+            self.request.abandon()
+            self.restarted_requests += 1
+        self.request = Request(self, path)
+        self.request_immediate = immediate
+        self.request_events_time = min(self.event_times) if self.event_times else None
+        self.reload_time = time.monotonic() + (
+            IMG_LOAD_RETRY_INTERVAL if immediate else LONG_POLL_RETRY_INTERVAL
+        )
+
+    def img_loaded(self, request):
+        now = time.monotonic()
+        self.request = None
+        self.reload_time = None
+        self.allow_new_event_notify = False
+
+        self.bytes += len(request.body)
+        inc = self.img_load_event_increment
+        self.event_queue_start_idx += inc
+        self.event_queue = self.event_queue[inc:]
+        self.event_times = self.event_times[inc:]
+
+        if not self.request_immediate and is_unchanged_signal(request.body):
+            self.unchanged_responses += 1
+            self.start_img_load()
+            return
+
+        self.frames += 1
+        if self.last_frame_time is not None:
+            self.frame_intervals.append(now - self.last_frame_time)
+        self.last_frame_time = now
+        if self.request_immediate:
+            self.request_latencies.append(now - request.start_time)
+        if self.request_events_time is not None:
+            self.event_latencies.append(now - self.request_events_time)
+
+        # Width signal: even width means that there is an iframe to load
+        if self.frames >= 3:
+            width = image_width(request.body)
+            if width is not None:
+                self.iframe_wanted = width % 2 == 0
+
+        self.start_img_load()
+
+    def poll_iframe(self, now):
+        if self.iframe_request is not None:
+            if self.iframe_request.done:
+                if self.iframe_request.body is not None:
+                    self.bytes += len(self.iframe_request.body)
+                self.iframe_request = None
+        elif self.iframe_wanted and now >= self.next_allowed_iframe_time:
+            self.iframe_wanted = False
+            self.next_allowed_iframe_time = now + MIN_IFRAME_LOAD_INTERVAL
+            self.iframe_request = Request(self, "/{}/iframe/{}/{}/".format(
+                self.session_id, self.main_idx, self.rng.randrange(1000000000)
+            ))
+
+    def run(self, deadline):
+        try:
+            self.open_session()
+        except (OSError, http.client.HTTPException, RuntimeError) as e:
+            self.failure = str(e)
+            return
+
+        self.start_time = time.monotonic()
+        events = EventSource(
+            self.rng, self.args.event_rate, self.args.width, self.args.height
+        )
+        self.start_img_load()
+
+        while not self.shutdown:
+            now = time.monotonic()
+            if now >= deadline:
+                break
+
+            events.poll(now, self)
+            self.poll_iframe(now)
+
+            request = self.request
+            if request is not None and request.done:
+                if request.status == 200 and request.body:
+                    self.img_loaded(request)
+                else:
+                    # Failed requests are retried after the retry interval,
+                    # as the img element would not fire onload
+                    self.errors += 1
+                    self.request = None
+            if self.reload_time is not None and now >= self.reload_time:
+                self.reload_time = None
+                self.send_img_req()
+
+            with self.cond:
+                self.cond.wait(TICK)
+
+        self.end_time = time.monotonic()
+        if self.request is not None:
+            self.request.abandon()
+        self.close_session()
+
+    def result(self):
+        ret = {
+            "client": self.idx,
+            "session": self.session_id,
+        }
+        if self.failure is not None:
+            ret["failure"] = self.failure
+        if self.start_time is None:
+            return ret
+        duration = self.end_time - self.start_time
+        ret.update({
+            "duration_s": round(duration, 3),
+            "frames": self.frames,
+            "fps": round(self.frames / duration, 2) if duration > 0 else None,
+            "bytes": self.bytes,
+            "kbytes_per_s": round(self.bytes / 1024.0 / duration, 2) if duration > 0 else None,
+            "upload_bytes": self.upload_bytes,
+            "upload_bytes_per_frame": (
+                round(self.upload_bytes / self.frames, 1) if self.frames > 0 else None
+            ),
+            "events": self.events,
+            "errors": self.errors,
+            "restarted_requests": self.restarted_requests,
+            "unchanged_responses": self.unchanged_responses,
+        })
+        ret.update(latency_stats("frame_interval", self.frame_intervals))
+        ret.update(latency_stats("request", self.request_latencies))
+        ret.update(latency_stats("event_to_frame", self.event_latencies))
+        return ret
+
+def summarize(clients):
+    ok = [c for c in clients if c.start_time is not None]
+    ret = {
+        "summary": True,
+        "sessions": len(clients),
+        "failed_sessions": sum(1 for c in clients if c.failure is not None),
+    }
+    if ok:
+        duration = max(c.end_time for c in ok) - min(c.start_time for c in ok)
+        frames = sum(c.frames for c in ok)
+        total_bytes = sum(c.bytes for c in ok)
+        ret.update({
+            "frames": frames,
+            "total_fps": round(frames / duration, 2) if duration > 0 else None,
+            "mean_session_fps": round(
+                sum(c.frames / (c.end_time - c.start_time) for c in ok) / len(ok), 2
+            ),
+            "bytes": total_bytes,
+            "kbytes_per_s": round(total_bytes / 1024.0 / duration, 2) if duration > 0 else None,
+            "upload_bytes_per_frame": (
+                round(sum(c.upload_bytes for c in ok) / frames, 1) if frames > 0 else None
+            ),
+            "errors": sum(c.errors for c in ok),
+            "unchanged_responses": sum(c.unchanged_responses for c in ok),
+        })
+        ret.update(latency_stats(
+            "frame_interval", [x for c in ok for x in c.frame_intervals]
+        ))
+        ret.update(latency_stats(
+            "request", [x for c in ok for x in c.request_latencies]
+        ))
+        ret.update(latency_stats(
+            "event_to_frame", [x for c in ok for x in c.event_latencies]
+        ))
+    return ret
+
+def main():
+    parser = argparse.ArgumentParser(
+        description="Emulate browser clients running the Browservice image loop."
+    )
+    parser.add_argument("--url", default="http://127.0.0.1:8080/",
+        help="base URL of the Browservice instance (default: %(default)s)")
+    parser.add_argument("--sessions", type=int, default=4,
+        help="number of emulated clients (default: %(default)s)")
+    parser.add_argument("--duration", type=float, default=30.0,
+        help="duration of the run in seconds (default: %(default)s)")
+    parser.add_argument("--ramp-up", type=float, default=5.0,
+        help="time over which the clients are started (default: %(default)s)")
+    parser.add_argument("--width", type=int, default=1024,
+        help="client viewport width (default: %(default)s)")
+    parser.add_argument("--height", type=int, default=768,
+        help="client viewport height (default: %(default)s)")
+    parser.add_argument("--event-rate", type=float, default=10.0,
+        help="input events per second per client, 0 for none (default: %(default)s)")
+    parser.add_argument("--compact-events", action="store_true",
+        help="encode the events in the compact encoding")
+    parser.add_argument("--user-agent",
+        default="Mozilla/5.0 (Windows NT 5.1; rv:52.0) Gecko/20100101 Firefox/52.0",
+        help="User-Agent sent by the clients; determines PNG support")
+    parser.add_argument("--http-auth", default="",
+        help="USER:PASSWORD for HTTP basic authentication")
+    parser.add_argument("--seed", type=int, default=None,
+        help="random seed for the event streams")
+    args = parser.parse_args()
+
+    if args.sessions < 1 or args.duration <= 0.0:
+        parser.error("invalid session count or duration")
+    if not args.url.startswith("http://"):
+        parser.error("only http:// URLs are supported")
+
+    master_rng = random.Random(args.seed)
+    clients = [
+        Client(i, args, random.Random(master_rng.getrandbits(64)))
+        for i in range(args.sessions)
+    ]
+
+    start = time.monotonic()
+    threads = []
+    for i, client in enumerate(clients):
+        start_time = start + args.ramp_up * i / len(clients)
+        deadline = start_time + args.duration
+
+        def run(client=client, start_time=start_time, deadline=deadline):
+            time.sleep(max(start_time - time.monotonic(), 0.0))
+            client.run(deadline)
+
+        thread = threading.Thread(target=run, daemon=True)
+        thread.start()
+        threads.append(thread)
+
+    for thread in threads:
+        thread.join()
+
+    for client in clients:
+        print(json.dumps(client.result()))
+    print(json.dumps(summarize(clients)))
+
+    if all(client.failure is not None for client in clients):
+        sys.exit(1)
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,52 @@
+#!/usr/bin/env python3
+
+# Regenerates the compression benchmark corpus in bench/corpus from the
+# screenshots in fig. Each frame is stored as gzip-compressed raw BGRA pixel
+# data (alpha always 255, pitch equal to width), the same layout as the frames
+# rendered by the browser that are passed to the image compressors. The frame
+# list with dimensions is written to bench/corpus/index.txt.
+#
+# Requires Pillow. Run from the repository root.
+
+import gzip
+import os
+
+from PIL import Image
+
+# (name, source screenshot, description)
+FRAMES = [
+    ("text", "fig/os2_firefox2_wikipedia.png", "text-heavy article page"),
+    ("photo", "fig/nt4_ie6_instagram.png", "page with photographs"),
+    ("video", "fig/w98_ie5_legend.png", "video player showing a video frame"),
+    ("chrome", "fig/w311_ie4_cloud.png", "web application UI chrome"),
+]
+
+def main():
+    os.makedirs("bench/corpus", exist_ok=True)
+
+    index = []
+    for name, src, desc in FRAMES:
+        img = Image.open(src).convert("RGB")
+        width, height = img.size
+
+        r, g, b = img.split()
+        a = Image.new("L", img.size, 255)
+        bgra = Image.merge("RGBA", (b, g, r, a)).tobytes()
+
+        filename = name + ".bgra.gz"
+        with open("bench/corpus/" + filename, "wb") as fp:
+            # Fixed mtime to make the output reproducible
+            with gzip.GzipFile(filename=filename, mode="wb", fileobj=fp, mtime=0) as gz:
+                gz.write(bgra)
+
+        index.append("{} {} {} {} # {} ({})".format(
+            name, filename, width, height, desc, os.path.basename(src)
+        ))
+
+    with open("bench/corpus/index.txt", "w") as fp:
+        fp.write("# NAME FILE WIDTH HEIGHT # DESCRIPTION (SOURCE)\n")
+        for line in index:
+            fp.write(line + "\n")
+
+if __name__ == "__main__":
+    main()
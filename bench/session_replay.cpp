@@ -0,0 +1,354 @@
+// Replays a session recording written by Browservice with the --record-dir
+// option through the image compressors in src/png.cpp and src/jpeg.cpp. Does
+// not depend on CEF; build using 'make replay'.
+//
+// The frames are reconstructed from the recorded dirty rects and compressed
+// either as fast as possible (--speed max, the default) or following the
+// recorded timestamps (--speed original). In the latter case, like in the
+// server, a frame that has been superseded by a newer one while the compressor
+// was busy is skipped. One JSON object is printed per compressed frame (and per
+// event with --events), followed by a summary.
+
+#include "jpeg.hpp"
+#include "png.hpp"
+#include "recording_format.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using std::cerr;
+using std::cout;
+using std::string;
+using std::vector;
+using std::chrono::steady_clock;
+
+namespace {
+
+struct Options {
+    string path;
+    string codec = "jpeg";
+    int quality = 80;
+    int threads = 0;
+    bool originalSpeed = false;
+    bool printEvents = false;
+};
+
+[[noreturn]] void fail(const string& msg) {
+    cerr << "session_replay: " << msg << "\n";
+    exit(1);
+}
+
+// Read-only memory mapping of the whole recording
+struct MappedFile {
+    const uint8_t* data = nullptr;
+    size_t size = 0;
+};
+
+MappedFile mapFile(const string& path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if(fd < 0) {
+        fail("could not open '" + path + "'");
+    }
+    struct stat st;
+    if(fstat(fd, &st) != 0) {
+        fail("could not stat '" + path + "'");
+    }
+    MappedFile file;
+    file.size = (size_t)st.st_size;
+    if(file.size > 0) {
+        void* ptr = mmap(nullptr, file.size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(ptr == MAP_FAILED) {
+            fail("could not map '" + path + "'");
+        }
+        madvise(ptr, file.size, MADV_SEQUENTIAL);
+        file.data = (const uint8_t*)ptr;
+    }
+    close(fd);
+    return file;
+}
+
+struct Record {
+    const recording::RecordHeader* header;
+    const uint8_t* payload;
+};
+
+// Returns the records of the file in order. A truncated last record (in a
+// recording that was still being written) is ignored.
+vector<Record> readRecords(const MappedFile& file, uint64_t& sessionID) {
+    if(
+        file.size < sizeof(recording::FileHeader) ||
+        memcmp(file.data, recording::Magic, sizeof(recording::Magic))
+    ) {
+        fail("not a session recording");
+    }
+    const recording::FileHeader* fileHeader = (const recording::FileHeader*)file.data;
+    sessionID = fileHeader->sessionID;
+
+    vector<Record> records;
+    size_t pos = sizeof(recording::FileHeader);
+    while(pos + sizeof(recording::RecordHeader) <= file.size) {
+        Record record;
+        record.header = (const recording::RecordHeader*)(file.data + pos);
+        record.payload = file.data + pos + sizeof(recording::RecordHeader);
+        size_t end =
+            pos + sizeof(recording::RecordHeader) +
+            recording::paddedSize(record.header->payloadSize);
+        if(end > file.size) {
+            break;
+        }
+        records.push_back(record);
+        pos = end;
+    }
+    return records;
+}
+
+double percentile(const vector<double>& sorted, double p) {
+    if(sorted.empty()) {
+        return 0.0;
+    }
+    size_t idx = (size_t)(p / 100.0 * (double)(sorted.size() - 1) + 0.5);
+    return sorted[std::min(idx, sorted.size() - 1)];
+}
+
+double msSince(steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(steady_clock::now() - start).count();
+}
+
+string jsonEscape(const uint8_t* data, size_t size) {
+    string ret;
+    for(size_t i = 0; i < size; ++i) {
+        char c = (char)data[i];
+        if(c == '"' || c == '\\') {
+            ret.push_back('\\');
+        }
+        if((unsigned char)c >= 0x20) {
+            ret.push_back(c);
+        }
+    }
+    return ret;
+}
+
+Options parseOptions(int argc, char* argv[]) {
+    Options options;
+    for(int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        auto value = [&]() -> string {
+            if(i + 1 >= argc) {
+                fail("missing value for " + arg);
+            }
+            return argv[++i];
+        };
+        if(arg == "--codec") {
+            options.codec = value();
+        } else if(arg == "--quality") {
+            options.quality = atoi(value().c_str());
+        } else if(arg == "--threads") {
+            options.threads = atoi(value().c_str());
+        } else if(arg == "--speed") {
+            string speed = value();
+            if(speed != "original" && speed != "max") {
+                fail("invalid speed '" + speed + "'");
+            }
+            options.originalSpeed = speed == "original";
+        } else if(arg == "--events") {
+            options.printEvents = true;
+        } else if(!arg.empty() && arg[0] != '-' && options.path.empty()) {
+            options.path = arg;
+        } else {
+            cerr << "Usage: " << argv[0] << " [--codec png|jpeg] [--quality Q]";
+            cerr << " [--threads N] [--speed original|max] [--events] RECORDING\n";
+            exit(arg == "--help" ? 0 : 1);
+        }
+    }
+
+    if(options.path.empty()) {
+        fail("no recording given");
+    }
+    if(options.codec != "png" && options.codec != "jpeg") {
+        fail("invalid codec '" + options.codec + "'");
+    }
+    if(options.quality < 1 || options.quality > 100) {
+        fail("invalid JPEG quality");
+    }
+    if(options.threads <= 0) {
+        // Same as used by ImageCompressor
+        options.threads = std::min(
+            std::max((int)std::thread::hardware_concurrency(), 1), 4
+        );
+    }
+    return options;
+}
+
+}
+
+int main(int argc, char* argv[]) {
+    Options options = parseOptions(argc, argv);
+
+    MappedFile file = mapFile(options.path);
+    uint64_t sessionID;
+    vector<Record> records = readRecords(file, sessionID);
+
+    PNGCompressor pngCompressor((size_t)options.threads);
+
+    vector<uint8_t> frame;
+    size_t width = 0;
+    size_t height = 0;
+
+    uint64_t frameCount = 0;
+    uint64_t eventCount = 0;
+    uint64_t skippedCount = 0;
+    uint64_t totalBytes = 0;
+    vector<double> encodeTimes;
+
+    steady_clock::time_point start = steady_clock::now();
+
+    for(size_t recordIdx = 0; recordIdx < records.size(); ++recordIdx) {
+        const Record& record = records[recordIdx];
+        double timeMs = (double)record.header->time / 1000.0;
+
+        if(record.header->type == recording::EventRecord) {
+            ++eventCount;
+            if(options.printEvents) {
+                cout << "{\"event\":\"" << jsonEscape(record.payload, record.header->payloadSize);
+                cout << "\",\"time_ms\":" << timeMs << "}\n";
+            }
+            continue;
+        }
+        if(record.header->type != recording::FrameRecord) {
+            continue;
+        }
+
+        // Apply the dirty rects of the frame
+        const recording::FramePayload* payload =
+            (const recording::FramePayload*)record.payload;
+        uint64_t expectedSize = sizeof(recording::FramePayload);
+        if(record.header->payloadSize >= expectedSize) {
+            expectedSize += payload->rectCount * sizeof(recording::Rect);
+        }
+        if(record.header->payloadSize < expectedSize) {
+            fail("truncated frame " + std::to_string(frameCount));
+        }
+        if(payload->width != width || payload->height != height) {
+            width = payload->width;
+            height = payload->height;
+            frame.assign(4 * width * height, 255);
+        }
+        const recording::Rect* rects = (const recording::Rect*)(payload + 1);
+        const uint8_t* pixels = (const uint8_t*)(rects + payload->rectCount);
+        uint64_t dirtyPixels = 0;
+        for(uint32_t i = 0; i < payload->rectCount; ++i) {
+            const recording::Rect& rect = rects[i];
+            if(
+                rect.x < 0 || rect.y < 0 || rect.width <= 0 || rect.height <= 0 ||
+                (size_t)(rect.x + rect.width) > width ||
+                (size_t)(rect.y + rect.height) > height
+            ) {
+                fail("invalid rect in frame " + std::to_string(frameCount));
+            }
+            expectedSize += 4 * (uint64_t)rect.width * (uint64_t)rect.height;
+            if(record.header->payloadSize < expectedSize) {
+                fail("truncated frame " + std::to_string(frameCount));
+            }
+            size_t rowBytes = 4 * (size_t)rect.width;
+            for(int32_t y = 0; y < rect.height; ++y) {
+                memcpy(
+                    &frame[4 * ((size_t)(rect.y + y) * width + (size_t)rect.x)],
+                    pixels,
+                    rowBytes
+                );
+                pixels += rowBytes;
+            }
+            dirtyPixels += (uint64_t)rect.width * (uint64_t)rect.height;
+        }
+        uint64_t frameIdx = frameCount++;
+
+        if(options.originalSpeed) {
+            // Skip the frame if a newer frame is already available, as the
+            // server would only compress the latest frame
+            bool superseded = false;
+            for(size_t i = recordIdx + 1; i < records.size(); ++i) {
+                if(records[i].header->type == recording::FrameRecord) {
+                    superseded =
+                        (double)records[i].header->time / 1000.0 <= msSince(start);
+                    break;
+                }
+            }
+            if(superseded) {
+                ++skippedCount;
+                continue;
+            }
+            double waitMs = timeMs - msSince(start);
+            if(waitMs > 0.0) {
+                std::this_thread::sleep_for(
+                    std::chrono::duration<double, std::milli>(waitMs)
+                );
+            }
+        }
+
+        steady_clock::time_point encodeStart = steady_clock::now();
+        size_t size = 0;
+        if(options.codec == "png") {
+            vector<vector<uint8_t>> png =
+                pngCompressor.compress(frame.data(), width, height, width);
+            for(const vector<uint8_t>& chunk : png) {
+                size += chunk.size();
+            }
+        } else {
+            size = compressJPEG(
+                frame.data(), width, height, width, options.quality
+            ).length;
+        }
+        double encodeMs = msSince(encodeStart);
+        encodeTimes.push_back(encodeMs);
+        totalBytes += size;
+
+        cout << "{\"frame\":" << frameIdx << ",\"time_ms\":" << timeMs;
+        cout << ",\"width\":" << width << ",\"height\":" << height;
+        cout << ",\"dirty_pixels\":" << dirtyPixels;
+        cout << ",\"encode_ms\":" << encodeMs << ",\"bytes\":" << size << "}\n";
+    }
+
+    double totalMs = msSince(start);
+    double encodeSum = 0.0;
+    for(double sample : encodeTimes) {
+        encodeSum += sample;
+    }
+    std::sort(encodeTimes.begin(), encodeTimes.end());
+    size_t encodedCount = encodeTimes.size();
+
+    cout << "{\"summary\":true,\"session\":" << sessionID;
+    cout << ",\"codec\":\"" << options.codec << "\"";
+    if(options.codec == "png") {
+        cout << ",\"threads\":" << options.threads;
+    } else {
+        cout << ",\"quality\":" << options.quality;
+    }
+    cout << ",\"speed\":\"" << (options.originalSpeed ? "original" : "max") << "\"";
+    cout << ",\"frames\":" << frameCount << ",\"encoded\":" << encodedCount;
+    cout << ",\"skipped\":" << skippedCount << ",\"events\":" << eventCount;
+    cout << ",\"duration_ms\":" << totalMs;
+    cout << ",\"encode_mean_ms\":" << (encodedCount ? encodeSum / (double)encodedCount : 0.0);
+    cout << ",\"encode_p50_ms\":" << percentile(encodeTimes, 50.0);
+    cout << ",\"encode_p90_ms\":" << percentile(encodeTimes, 90.0);
+    cout << ",\"encode_p99_ms\":" << percentile(encodeTimes, 99.0);
+    cout << ",\"encode_max_ms\":" << percentile(encodeTimes, 100.0);
+    cout << ",\"total_bytes\":" << totalBytes;
+    cout << ",\"mean_bytes\":" << (encodedCount ? totalBytes / encodedCount : 0);
+    cout << "}" << std::endl;
+
+    if(file.data != nullptr) {
+        munmap((void*)file.data, file.size);
+    }
+    return 0;
+}
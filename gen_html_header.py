@@ -1,22 +1,258 @@
 #!/usr/bin/env python3
 
+# Generates gen/html.cpp, which contains for each html/NAME.html a function
+# writeNameHTML that writes the page, replacing each %-field-% by data.field.
+#
+# The client page html/main.html is additionally specialized at build time for
+# the browser families in MAIN_VARIANTS: the browser quirk flags detected by
+# detectUserAgentQuirks are replaced by constants and the code depending on
+# them is folded away, so that slow clients do not need to evaluate it on every
+# frame. The variant is selected using the flags detected from the User-Agent
+# by src/client_quirks.cpp; clients that match no variant (or whose client
+# profile disables the specialized pages) get the generic page that detects the
+# flags at runtime. All the variants are minified.
+
 import os
 import re
 
+QUIRK_FLAGS = [
+    "useOnDOMMouseScroll",
+    "useOnMouseWheel",
+    "fixMousePosition",
+    "leftMouseButtonIs1",
+    "bodyOverflowHiddenNotSupported",
+    "useBackspaceCaptureHack",
+    "serverPushBrowser",
+    "stringTimeoutCallbacks",
+]
+
+# (description, flags that are set)
+MAIN_VARIANTS = [
+    ("MSIE 4", [
+        "useOnMouseWheel", "fixMousePosition", "leftMouseButtonIs1",
+        "bodyOverflowHiddenNotSupported", "useBackspaceCaptureHack",
+        "stringTimeoutCallbacks",
+    ]),
+    ("MSIE 5 on 16-bit Windows", [
+        "useOnMouseWheel", "fixMousePosition", "leftMouseButtonIs1",
+        "bodyOverflowHiddenNotSupported", "useBackspaceCaptureHack",
+    ]),
+    ("MSIE 5-8", ["useOnMouseWheel", "fixMousePosition", "leftMouseButtonIs1"]),
+    ("MSIE 9+ and Chrome", ["useOnMouseWheel"]),
+    ("Firefox", ["useOnDOMMouseScroll", "serverPushBrowser"]),
+    ("Opera and Netscape", ["serverPushBrowser"]),
+    ("other browsers", []),
+]
+
+IF_RE = re.compile(r'^(\s*)if\((.*)\) \{$')
+SINGLE_IF_RE = re.compile(r'^(\s*)if\((.*)\) ([^{].*;)$')
+LITERAL_RE = re.compile(r'\b(true|false)\b')
+
+def split_top_level(expr, op):
+    parts = []
+    depth = 0
+    start = 0
+    i = 0
+    while i < len(expr):
+        c = expr[i]
+        if c in "([":
+            depth += 1
+        elif c in ")]":
+            depth -= 1
+        elif c in "\"'":
+            i += 1
+            while expr[i] != c:
+                i += 2 if expr[i] == "\\" else 1
+        elif depth == 0 and expr.startswith(op, i):
+            parts.append(expr[start:i].strip())
+            i += len(op)
+            start = i
+            continue
+        i += 1
+    parts.append(expr[start:].strip())
+    return parts
+
+def is_parenthesized(expr):
+    if not (expr.startswith("(") and expr.endswith(")")):
+        return False
+    return split_top_level(expr[1:-1], ")") == [expr[1:-1].strip()]
+
+def simplify_condition(expr):
+    """Returns True or False if the value of the condition is known, and
+    otherwise the condition as a string. Terms that may have side effects (that
+    is, contain parentheses) are never dropped."""
+    expr = expr.strip()
+    if expr == "true":
+        return True
+    if expr == "false":
+        return False
+    if expr.startswith("!"):
+        value = simplify_condition(expr[1:])
+        if isinstance(value, bool):
+            return not value
+        return expr
+    if is_parenthesized(expr):
+        value = simplify_condition(expr[1:-1])
+        if isinstance(value, bool):
+            return value
+        return "(" + value + ")"
+
+    for op, absorbing in (("||", True), ("&&", False)):
+        parts = split_top_level(expr, op)
+        if len(parts) == 1:
+            continue
+        values = [simplify_condition(part) for part in parts]
+        if absorbing in values:
+            if any("(" in part for part in parts):
+                return expr
+            return absorbing
+        terms = [value for value in values if not isinstance(value, bool)]
+        if not terms:
+            return not absorbing
+        return " {} ".format(op).join(terms)
+    return expr
+
+def dedent(lines):
+    return [line[4:] if line.startswith("    ") else line for line in lines]
+
+def fold_chain(indent, branches):
+    kept = []
+    for cond, body in branches:
+        value = simplify_condition(cond) if LITERAL_RE.search(cond) else cond
+        if value is False:
+            continue
+        kept.append((value, fold(body)))
+        if value is True:
+            break
+
+    if not kept:
+        return []
+    if kept[0][0] is True:
+        return dedent(kept[0][1])
+
+    out = []
+    for i, (value, body) in enumerate(kept):
+        if value is True:
+            out.append(indent + "} else {")
+        elif i == 0:
+            out.append(indent + "if(" + value + ") {")
+        else:
+            out.append(indent + "} else if(" + value + ") {")
+        out.extend(body)
+    out.append(indent + "}")
+    return out
+
+def fold(lines):
+    """Removes the branches of if statements with constant conditions; the
+    statements must be formatted as in the rest of the code."""
+    out = []
+    i = 0
+    while i < len(lines):
+        line = lines[i]
+
+        m = IF_RE.match(line)
+        if m:
+            indent = m.group(1)
+            else_if_re = re.compile(re.escape(indent) + r'\} else if\((.*)\) \{$')
+            branches = []
+            cond = m.group(2)
+            body = []
+            i += 1
+            while True:
+                line = lines[i]
+                i += 1
+                if line == indent + "}":
+                    branches.append((cond, body))
+                    break
+                m = else_if_re.match(line)
+                if m:
+                    branches.append((cond, body))
+                    cond = m.group(1)
+                    body = []
+                elif line == indent + "} else {":
+                    branches.append((cond, body))
+                    cond = "true"
+                    body = []
+                else:
+                    body.append(line)
+            out.extend(fold_chain(indent, branches))
+            continue
+
+        m = SINGLE_IF_RE.match(line)
+        if m and LITERAL_RE.search(m.group(2)):
+            value = simplify_condition(m.group(2))
+            if value is True:
+                out.append(m.group(1) + m.group(3))
+            elif value is not False:
+                out.append(m.group(1) + "if(" + value + ") " + m.group(3))
+            i += 1
+            continue
+
+        out.append(line)
+        i += 1
+    return out
+
+def specialize_main(code, flags):
+    lines = code.split("\n")
+
+    # Remove the runtime detection of the flags and the variables
+    start = lines.index("function detectUserAgentQuirks() {")
+    end = lines.index("}", start)
+    del lines[start:end + 1]
+    lines.remove("    detectUserAgentQuirks();")
+    for flag in QUIRK_FLAGS:
+        lines.remove("var {} = false;".format(flag))
+
+    code = "\n".join(lines)
+    for flag in QUIRK_FLAGS:
+        code = re.sub(r'\b' + flag + r'\b', "true" if flag in flags else "false", code)
+    if re.search(r'\b(true|false)\s*=[^=]', code):
+        raise RuntimeError("quirk flag assigned outside detectUserAgentQuirks")
+
+    return "\n".join(fold(code.split("\n")))
+
+def minify(code):
+    """Removes indentation, empty lines and full-line comments"""
+    out = []
+    for line in code.split("\n"):
+        line = line.strip()
+        if line and not line.startswith("//"):
+            out.append(line)
+    return "\n".join(out) + "\n"
+
+def write_code(code, indent):
+    code = re.sub(r'%-([a-zA-Z0-9]+)-%', r')DELIM" << data.\1 << R"DELIM(', code)
+    print(indent + 'out << R"DELIM(' + code + ')DELIM";')
+
 print('#include "html.hpp"')
 
 for filename in os.listdir("html"):
     if not filename.endswith(".html"):
         continue
-    
+
     name = "".join(x.capitalize() for x in filename[:-5].split("_"))
 
     with open("html/" + filename) as fp:
         code = fp.read()
 
-    code = re.sub(r'%-([a-zA-Z0-9]+)-%', r')DELIM" << data.\1 << R"DELIM(', code)
-
     print()
     print('void write{}HTML(ostream& out, const {}HTMLData& data) {{'.format(name, name))
-    print('    out << R"DELIM(' + code + ')DELIM";')
+    if filename == "main.html":
+        print('    const ClientQuirks& quirks = data.quirks;')
+        for desc, flags in MAIN_VARIANTS:
+            cond = " &&\n        ".join(["data.specialized"] + [
+                ("" if flag in flags else "!") + "quirks." + flag
+                for flag in QUIRK_FLAGS
+            ])
+            print('    if(')
+            print('        ' + cond)
+            print('    ) {')
+            print('        // ' + desc)
+            write_code(minify(specialize_main(code, flags)), "        ")
+            print('        return;')
+            print('    }')
+        print('    // Generic variant')
+        write_code(minify(code), "    ")
+    else:
+        write_code(code, "    ")
     print('}')
@@ -0,0 +1,111 @@
+#include "bandwidth_limiter.hpp"
+
+namespace {
+
+// Upper limit for a single sleep in BandwidthLimiter::throttle, so that the
+// limiters are checked again soon if another thread changes their levels
+constexpr int64_t MaxThrottleSleepMs = 100;
+
+constexpr int64_t MaxRefillIntervalUs = (int64_t)100 * 1000000;
+
+}
+
+BandwidthLimiter::BandwidthLimiter(CKey, uint64_t bytesPerSecond) {
+    bytesPerSecond_ = bytesPerSecond;
+
+    tokens_ = (int64_t)bytesPerSecond;
+    refillTime_ = steady_clock::now();
+
+    usageIntervalStart_ = refillTime_;
+    usageIntervalBytes_ = 0;
+    usage_ = 0;
+}
+
+uint64_t BandwidthLimiter::limit() {
+    return bytesPerSecond_;
+}
+
+int64_t BandwidthLimiter::delayMs() {
+    lock_guard<mutex> lock(mutex_);
+    update_(steady_clock::now());
+
+    if(bytesPerSecond_ == 0 || tokens_ >= 0) {
+        return 0;
+    }
+    return
+        ((uint64_t)-tokens_ * 1000 + bytesPerSecond_ - 1) / bytesPerSecond_;
+}
+
+void BandwidthLimiter::consume(uint64_t bytes) {
+    lock_guard<mutex> lock(mutex_);
+    update_(steady_clock::now());
+
+    if(bytesPerSecond_ != 0) {
+        tokens_ -= (int64_t)bytes;
+    }
+    usageIntervalBytes_ += bytes;
+}
+
+uint64_t BandwidthLimiter::usage() {
+    lock_guard<mutex> lock(mutex_);
+    update_(steady_clock::now());
+    return usage_;
+}
+
+void BandwidthLimiter::throttle(
+    const vector<shared_ptr<BandwidthLimiter>>& limiters,
+    uint64_t bytes
+) {
+    while(true) {
+        int64_t sleepMs = 0;
+        for(const shared_ptr<BandwidthLimiter>& limiter : limiters) {
+            sleepMs = max(sleepMs, limiter->delayMs());
+        }
+        if(sleepMs == 0) {
+            break;
+        }
+        std::this_thread::sleep_for(
+            milliseconds(min(sleepMs, MaxThrottleSleepMs))
+        );
+    }
+
+    for(const shared_ptr<BandwidthLimiter>& limiter : limiters) {
+        limiter->consume(bytes);
+    }
+}
+
+void BandwidthLimiter::update_(steady_clock::time_point now) {
+    if(bytesPerSecond_ != 0) {
+        int64_t elapsedUs =
+            duration_cast<microseconds>(now - refillTime_).count();
+
+        // Limit the elapsed time to avoid overflow; if the bucket is still in
+        // debt, the rest is added in the next update
+        elapsedUs = min(elapsedUs, MaxRefillIntervalUs);
+
+        int64_t refill = (int64_t)(
+            (uint64_t)max(elapsedUs, (int64_t)0) * bytesPerSecond_ / 1000000
+        );
+        if(refill > 0) {
+            tokens_ += refill;
+            if(tokens_ >= (int64_t)bytesPerSecond_) {
+                tokens_ = (int64_t)bytesPerSecond_;
+                refillTime_ = now;
+            } else {
+                // Only advance by the time corresponding to the whole bytes
+                // added, so that the fractions are not lost
+                refillTime_ += microseconds(
+                    (int64_t)((uint64_t)refill * 1000000 / bytesPerSecond_)
+                );
+            }
+        }
+    }
+
+    int64_t usageElapsedMs =
+        duration_cast<milliseconds>(now - usageIntervalStart_).count();
+    if(usageElapsedMs >= 1000) {
+        usage_ = usageIntervalBytes_ * 1000 / (uint64_t)usageElapsedMs;
+        usageIntervalStart_ = now;
+        usageIntervalBytes_ = 0;
+    }
+}
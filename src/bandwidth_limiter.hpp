@@ -0,0 +1,54 @@
+#pragma once
+
+#include "common.hpp"
+
+// Token bucket limiting the rate at which response data is sent to clients;
+// the global instance is in globals->bandwidthLimiter, and each session has
+// its own. The bucket fills at the rate limit up to one second worth of
+// bytes. Sending is allowed whenever the bucket is not in debt, and the sent
+// bytes are then deducted even if the bucket goes into debt, so that the data
+// never needs to be split to fit the bucket. The member functions may be
+// called from any thread.
+class BandwidthLimiter {
+SHARED_ONLY_CLASS(BandwidthLimiter);
+public:
+    // If bytesPerSecond is zero, the bandwidth is not limited, but the usage
+    // is still measured
+    BandwidthLimiter(CKey, uint64_t bytesPerSecond);
+
+    // The limit in bytes per second, or 0 if unlimited
+    uint64_t limit();
+
+    // The number of milliseconds until sending is allowed, or 0 if it is
+    // allowed now
+    int64_t delayMs();
+
+    // Deduct given number of sent bytes from the bucket
+    void consume(uint64_t bytes);
+
+    // The average number of bytes sent per second, measured over intervals of
+    // about one second
+    uint64_t usage();
+
+    // Blocks until all the given limiters allow sending, then deducts given
+    // number of bytes from each of them. Must not be called from the UI thread.
+    static void throttle(
+        const vector<shared_ptr<BandwidthLimiter>>& limiters,
+        uint64_t bytes
+    );
+
+private:
+    void update_(steady_clock::time_point now);
+
+    mutex mutex_;
+
+    uint64_t bytesPerSecond_;
+
+    // Current bucket level in bytes; negative if in debt
+    int64_t tokens_;
+    steady_clock::time_point refillTime_;
+
+    steady_clock::time_point usageIntervalStart_;
+    uint64_t usageIntervalBytes_;
+    uint64_t usage_;
+};
@@ -1,7 +1,9 @@
 #include "browser_area.hpp"
 
 #include "key.hpp"
+#include "session_recorder.hpp"
 #include "text.hpp"
+#include "trace.hpp"
 
 #include "include/cef_render_handler.h"
 
@@ -89,17 +91,17 @@ uint32_t getKeyModifierFlag(int key) {
 
 class BrowserArea::RenderHandler : public CefRenderHandler {
 public:
-    RenderHandler(shared_ptr<BrowserArea> browserArea) {
+    RenderHandler(shared_ptr<BrowserArea> browserArea, uint64_t traceSessionID) {
         browserArea_ = browserArea;
+        traceSessionID_ = traceSessionID;
     }
 
     // CefRenderHandler:
     virtual void GetViewRect(CefRefPtr<CefBrowser>, CefRect& rect) override {
         REQUIRE_UI_THREAD();
 
-        ImageSlice viewport = browserArea_->getViewport();
-        int width = max(min(viewport.width(), 4096), 64);
-        int height = max(min(viewport.height(), 4096), 64);
+        int width, height;
+        tie(width, height) = browserArea_->viewSize_();
 
         rect.Set(0, 0, width, height);
     }
@@ -155,8 +157,27 @@ public:
     ) override {
         REQUIRE_UI_THREAD();
 
+        TraceSessionScope traceSessionScope(traceSessionID_);
+        TRACE_SCOPE("BrowserArea::RenderHandler::OnPaint");
+
+        if(type == PET_VIEW && browserArea_->recorder_) {
+            vector<Rect> rects;
+            for(const CefRect& dirtyRect : dirtyRects) {
+                rects.push_back(Rect(
+                    dirtyRect.x,
+                    dirtyRect.x + dirtyRect.width,
+                    dirtyRect.y,
+                    dirtyRect.y + dirtyRect.height
+                ));
+            }
+            browserArea_->recorder_->recordFrame(
+                (const uint8_t*)buffer, bufWidth, bufHeight, rects
+            );
+        }
+
         ImageSlice viewport = browserArea_->getViewport();
         bool updated = false;
+        Rect damage;
 
         if(browserArea_->errorActive_) {
             viewport.fill(0, viewport.width(), 0, viewport.height(), 255);
@@ -164,6 +185,7 @@ public:
                 viewport.splitY(20).first, 7, 0, 96, 0, 0
             );
             updated = true;
+            damage = Rect(0, viewport.width(), 0, viewport.height());
         } else {
             int offsetX = 0;
             int offsetY = 0;
@@ -214,6 +236,9 @@ public:
                 rect = Rect::intersection(rect, bounds);
 
                 if(!rect.isEmpty()) {
+                    damage = Rect::boundingBox(
+                        damage, Rect::translate(rect, offsetX, offsetY)
+                    );
                     for(int y = rect.startY; y < rect.endY; ++y) {
                         if(y >= cutout.startY && y < cutout.endY) {
                             copyRange(y, rect.startX, min(rect.endX, cutout.startX));
@@ -229,13 +254,15 @@ public:
         if(updated) {
             postTask(
                 browserArea_->eventHandler_,
-                &BrowserAreaEventHandler::onBrowserAreaViewDirty
+                &BrowserAreaEventHandler::onBrowserAreaViewDirty,
+                Rect::translate(damage, viewport.globalX(), viewport.globalY())
             );
         }
     }
 
 private:
     shared_ptr<BrowserArea> browserArea_;
+    uint64_t traceSessionID_;
 
     IMPLEMENT_REFCOUNTING(RenderHandler);
 };
@@ -256,8 +283,10 @@ BrowserArea::BrowserArea(CKey,
 
 BrowserArea::~BrowserArea() {}
 
-CefRefPtr<CefRenderHandler> BrowserArea::createCefRenderHandler() {
-    return new RenderHandler(shared_from_this());
+CefRefPtr<CefRenderHandler> BrowserArea::createCefRenderHandler(
+    uint64_t traceSessionID
+) {
+    return new RenderHandler(shared_from_this(), traceSessionID);
 }
 
 void BrowserArea::setBrowser(CefRefPtr<CefBrowser> browser) {
@@ -266,6 +295,7 @@ void BrowserArea::setBrowser(CefRefPtr<CefBrowser> browser) {
     browser_ = browser;
 
     if(browser_) {
+        browserViewSize_ = viewSize_();
         browser_->GetHost()->WasResized();
     }
 }
@@ -311,13 +341,33 @@ void BrowserArea::setCursor(int cursor) {
     setCursor_(cursor);
 }
 
+void BrowserArea::setRecorder(shared_ptr<SessionRecorder> recorder) {
+    REQUIRE_UI_THREAD();
+    recorder_ = recorder;
+}
+
+pair<int, int> BrowserArea::viewSize_() {
+    ImageSlice viewport = getViewport();
+    int width = max(min(viewport.width(), 4096), 64);
+    int height = max(min(viewport.height(), 4096), 64);
+    return {width, height};
+}
+
 void BrowserArea::widgetViewportUpdated_() {
     REQUIRE_UI_THREAD();
 
     if(browser_) {
-        browser_->GetHost()->WasResized();
-        browser_->GetHost()->Invalidate(PET_VIEW);
-        browser_->GetHost()->Invalidate(PET_POPUP);
+        pair<int, int> size = viewSize_();
+        if(size != browserViewSize_) {
+            // The browser repaints the whole view after the resize, so there
+            // is no need to invalidate it; until then, the viewport shows the
+            // previous frame cropped to the new size
+            browserViewSize_ = size;
+            browser_->GetHost()->WasResized();
+        } else {
+            browser_->GetHost()->Invalidate(PET_VIEW);
+            browser_->GetHost()->Invalidate(PET_POPUP);
+        }
     }
 }
 
@@ -5,9 +5,12 @@
 
 class BrowserAreaEventHandler {
 public:
-    virtual void onBrowserAreaViewDirty() = 0;
+    // The damage rectangle is the bounding box of the updated area in global
+    // coordinates
+    virtual void onBrowserAreaViewDirty(Rect damage) = 0;
 };
 
+class SessionRecorder;
 class TextLayout;
 
 class CefBrowser;
@@ -31,8 +34,9 @@ public:
     ~BrowserArea();
 
     // Creates a new CefRenderHandler than retains a pointer to this BrowserArea
-    // and paints the browser contents to the viewport
-    CefRefPtr<CefRenderHandler> createCefRenderHandler();
+    // and paints the browser contents to the viewport. The paint trace events
+    // are attributed to given session (see trace.hpp).
+    CefRefPtr<CefRenderHandler> createCefRenderHandler(uint64_t traceSessionID);
 
     // Sets the browser that will be kept up to date about size changes of
     // this widget. The browser can be unset by passing a null pointer.
@@ -50,9 +54,16 @@ public:
     // Notify the browser area that the browser has changed the cursor type.
     void setCursor(int cursor);
 
+    // Sets the recorder to which the frames painted by the browser are passed.
+    // The recorder can be unset by passing an empty pointer.
+    void setRecorder(shared_ptr<SessionRecorder> recorder);
+
 private:
     class RenderHandler;
 
+    // The size of the view reported to the browser, derived from the viewport
+    pair<int, int> viewSize_();
+
     virtual void widgetViewportUpdated_() override;
 
     virtual void widgetMouseDownEvent_(int x, int y, int button) override;
@@ -70,6 +81,9 @@ private:
     weak_ptr<BrowserAreaEventHandler> eventHandler_;
     CefRefPtr<CefBrowser> browser_;
 
+    // The view size last reported to browser_
+    pair<int, int> browserViewSize_;
+
     bool popupOpen_;
     Rect popupRect_;
 
@@ -77,4 +91,6 @@ private:
 
     bool errorActive_;
     shared_ptr<TextLayout> errorLayout_;
+
+    shared_ptr<SessionRecorder> recorder_;
 };
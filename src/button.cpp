@@ -70,6 +70,10 @@ void Button::widgetRender_() {
     }
 }
 
+bool Button::widgetIsOpaque_() {
+    return true;
+}
+
 void Button::widgetMouseDownEvent_(int x, int y, int button) {
     REQUIRE_UI_THREAD();
 
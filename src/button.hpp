@@ -21,6 +21,7 @@ public:
 private:
     // Widget:
     virtual void widgetRender_() override;
+    virtual bool widgetIsOpaque_() override;
     virtual void widgetMouseDownEvent_(int x, int y, int button) override;
     virtual void widgetMouseUpEvent_(int x, int y, int button) override;
     virtual void widgetMouseMoveEvent_(int x, int y) override;
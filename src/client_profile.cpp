@@ -0,0 +1,249 @@
+#include "client_profile.hpp"
+
+#include "globals.hpp"
+#include "quality.hpp"
+
+namespace {
+
+// Profile as specified in the file or the built-in table; unset settings are
+// taken from the default profile
+struct ProfileSpec {
+    string name;
+    vector<string> patterns;
+    optional<bool> allowPNG;
+    optional<int> quality;
+    optional<int> maxFPS;
+    optional<uint64_t> frameByteBudget;
+    optional<int64_t> maxLongPollMs;
+    optional<bool> specializedPage;
+};
+
+constexpr int64_t MinLongPollMs = 2000;
+constexpr int64_t MaxLongPollMs = 16000;
+
+vector<ProfileSpec> fileProfiles;
+vector<ProfileSpec> builtinProfiles;
+
+// Indexed by the spec, nullptr for the default profile
+map<const ProfileSpec*, shared_ptr<const ClientProfile>> resolvedProfiles;
+
+string toLower(string str) {
+    for(char& c : str) {
+        c = tolower(c);
+    }
+    return str;
+}
+
+string trim(const string& str) {
+    size_t start = str.find_first_not_of(" \t\r");
+    if(start == string::npos) {
+        return "";
+    }
+    size_t end = str.find_last_not_of(" \t\r");
+    return str.substr(start, end - start + 1);
+}
+
+void initBuiltinProfiles() {
+    if(!builtinProfiles.empty()) {
+        return;
+    }
+
+    // The browsers of 16-bit Windows cannot show our PNG images
+    ProfileSpec win16;
+    win16.name = "win16";
+    win16.patterns = {"windows 3.1", "win16", "windows 16-bit"};
+    win16.allowPNG = false;
+    builtinProfiles.push_back(win16);
+
+    // Opera on the Wii decodes images slowly and has little memory, so we
+    // send smaller JPEG frames at a low rate to keep it responsive
+    ProfileSpec wii;
+    wii.name = "wii";
+    wii.patterns = {"nintendo wii"};
+    wii.allowPNG = false;
+    wii.quality = 40;
+    wii.maxFPS = 4;
+    wii.frameByteBudget = 49152;
+    builtinProfiles.push_back(wii);
+}
+
+// Returns an error message if the value is invalid
+optional<string> setProfileKey(ProfileSpec& spec, string key, string val) {
+    string lowerVal = toLower(val);
+    if(key == "match") {
+        if(val.empty()) {
+            return string("Empty pattern");
+        }
+        spec.patterns.push_back(lowerVal);
+    } else if(key == "quality") {
+        if(lowerVal == "png") {
+            spec.quality = MaxQuality;
+        } else {
+            optional<int> quality = parseString<int>(val);
+            if(!quality || *quality < MinQuality || *quality >= MaxQuality) {
+                return string("Invalid quality '") + val + "'";
+            }
+            spec.quality = *quality;
+        }
+    } else if(key == "png") {
+        if(lowerVal != "yes" && lowerVal != "no") {
+            return string("Invalid value '") + val + "' for png, expected YES or NO";
+        }
+        spec.allowPNG = lowerVal == "yes";
+    } else if(key == "max-fps") {
+        optional<int> maxFPS = parseString<int>(val);
+        if(!maxFPS || *maxFPS < 0 || *maxFPS > 1000) {
+            return string("Invalid max-fps '") + val + "'";
+        }
+        spec.maxFPS = *maxFPS;
+    } else if(key == "frame-bytes") {
+        optional<uint64_t> frameByteBudget = parseString<uint64_t>(val);
+        if(!frameByteBudget) {
+            return string("Invalid frame-bytes '") + val + "'";
+        }
+        spec.frameByteBudget = *frameByteBudget;
+    } else if(key == "long-poll-ms") {
+        optional<int64_t> maxLongPollMs = parseString<int64_t>(val);
+        if(
+            !maxLongPollMs ||
+            *maxLongPollMs < MinLongPollMs ||
+            *maxLongPollMs > MaxLongPollMs
+        ) {
+            return string("Invalid long-poll-ms '") + val + "'";
+        }
+        spec.maxLongPollMs = *maxLongPollMs;
+    } else if(key == "page") {
+        if(lowerVal != "auto" && lowerVal != "generic") {
+            return string("Invalid value '") + val + "' for page, expected AUTO or GENERIC";
+        }
+        spec.specializedPage = lowerVal == "auto";
+    } else {
+        return string("Unknown key '") + key + "'";
+    }
+    return {};
+}
+
+shared_ptr<const ClientProfile> resolveProfile(const ProfileSpec* spec) {
+    auto it = resolvedProfiles.find(spec);
+    if(it != resolvedProfiles.end()) {
+        return it->second;
+    }
+
+    shared_ptr<ClientProfile> profile = make_shared<ClientProfile>();
+    profile->name = spec != nullptr ? spec->name : "default";
+    profile->allowPNG = true;
+    profile->defaultQuality = globals->config->defaultQuality;
+    profile->maxFPS = 0;
+    profile->frameByteBudget = 0;
+    profile->maxLongPollMs = MaxLongPollMs;
+    profile->specializedPage = true;
+
+    if(spec != nullptr) {
+        profile->allowPNG = spec->allowPNG.value_or(profile->allowPNG);
+        profile->defaultQuality = spec->quality.value_or(profile->defaultQuality);
+        profile->maxFPS = spec->maxFPS.value_or(profile->maxFPS);
+        profile->frameByteBudget =
+            spec->frameByteBudget.value_or(profile->frameByteBudget);
+        profile->maxLongPollMs =
+            spec->maxLongPollMs.value_or(profile->maxLongPollMs);
+        profile->specializedPage =
+            spec->specializedPage.value_or(profile->specializedPage);
+    }
+
+    if(!profile->allowPNG && profile->defaultQuality == MaxQuality) {
+        --profile->defaultQuality;
+    }
+    REQUIRE(
+        profile->defaultQuality >= MinQuality &&
+        profile->defaultQuality <= getMaxQuality(profile->allowPNG)
+    );
+
+    resolvedProfiles[spec] = profile;
+    return profile;
+}
+
+}
+
+bool initClientProfiles(string path) {
+    initBuiltinProfiles();
+
+    if(path.empty()) {
+        return true;
+    }
+
+    ifstream fp(path);
+    if(!fp) {
+        ERROR_LOG("Could not open client profile file '", path, "'");
+        return false;
+    }
+
+    auto fail = [&](int lineNum, string msg) {
+        ERROR_LOG("Client profile file '", path, "' line ", lineNum, ": ", msg);
+        return false;
+    };
+
+    string line;
+    int lineNum = 0;
+    while(std::getline(fp, line)) {
+        ++lineNum;
+        line = trim(line.substr(0, line.find('#')));
+        if(line.empty()) {
+            continue;
+        }
+
+        if(line.front() == '[') {
+            if(line.back() != ']' || line.size() < 3) {
+                return fail(lineNum, "Invalid section header");
+            }
+            string name = trim(line.substr(1, line.size() - 2));
+            for(const ProfileSpec& spec : fileProfiles) {
+                if(spec.name == name) {
+                    return fail(lineNum, "Duplicate profile '" + name + "'");
+                }
+            }
+            fileProfiles.emplace_back();
+            fileProfiles.back().name = name;
+            continue;
+        }
+
+        size_t eqPos = line.find('=');
+        if(eqPos == string::npos) {
+            return fail(lineNum, "Expected 'KEY = VALUE'");
+        }
+        if(fileProfiles.empty()) {
+            return fail(lineNum, "Setting outside a profile section");
+        }
+        string key = toLower(trim(line.substr(0, eqPos)));
+        string val = trim(line.substr(eqPos + 1));
+        optional<string> error = setProfileKey(fileProfiles.back(), key, val);
+        if(error) {
+            return fail(lineNum, *error);
+        }
+    }
+
+    for(const ProfileSpec& spec : fileProfiles) {
+        if(spec.patterns.empty()) {
+            ERROR_LOG("Client profile '", spec.name, "' in '", path, "' has no match patterns");
+            return false;
+        }
+    }
+
+    INFO_LOG("Loaded ", fileProfiles.size(), " client profiles from '", path, "'");
+    return true;
+}
+
+shared_ptr<const ClientProfile> getClientProfile(string userAgent) {
+    REQUIRE_UI_THREAD();
+
+    userAgent = toLower(userAgent);
+    for(const vector<ProfileSpec>* specs : {&fileProfiles, &builtinProfiles}) {
+        for(const ProfileSpec& spec : *specs) {
+            for(const string& pattern : spec.patterns) {
+                if(userAgent.find(pattern) != string::npos) {
+                    return resolveProfile(&spec);
+                }
+            }
+        }
+    }
+    return resolveProfile(nullptr);
+}
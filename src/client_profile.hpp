@@ -0,0 +1,55 @@
+#pragma once
+
+#include "common.hpp"
+
+// Settings adapted to the capabilities of a class of clients. The profile of a
+// session is selected from the User-Agent of the client that created it by
+// getClientProfile; popup sessions inherit the profile of their parent.
+struct ClientProfile {
+    // Name of the profile, used in logs
+    string name;
+
+    // If false, MaxQuality (PNG) is not allowed
+    bool allowPNG;
+
+    // The initial image quality, in range [MinQuality, getMaxQuality(allowPNG)]
+    int defaultQuality;
+
+    // The maximum number of frames compressed per second, or 0 for unlimited
+    int maxFPS;
+
+    // If nonzero, JPEG frames larger than this many bytes are encoded again
+    // with a lower quality
+    uint64_t frameByteBudget;
+
+    // The maximum timeout of the long polled image requests (see
+    // ImageCompressor)
+    int64_t maxLongPollMs;
+
+    // If false, the client gets the generic main page that detects the
+    // browser quirks at runtime instead of a variant specialized for its
+    // browser family (see gen_html_header.py)
+    bool specializedPage;
+};
+
+// Reads the client profiles from given file (the value of the
+// --client-profiles option, empty for none). Must be called before
+// getClientProfile; returns false and logs an error on failure.
+//
+// The file consists of sections "[NAME]" followed by "KEY = VALUE" lines; '#'
+// starts a comment. The keys are:
+//   match         case-insensitive substring of the User-Agent (repeatable)
+//   quality       initial quality (10..100 or PNG)
+//   png           YES/NO, whether PNG is allowed
+//   max-fps       maximum frame rate (0 for unlimited)
+//   frame-bytes   JPEG frame size budget in bytes (0 for unlimited)
+//   long-poll-ms  maximum long poll timeout (2000..16000)
+//   page          AUTO/GENERIC, which main page variant the client gets
+// Unspecified settings are taken from the global options.
+bool initClientProfiles(string path);
+
+// Returns the first profile with a matching pattern, checking the profiles
+// read from the file before the built-in profiles (for Windows 3.x and the
+// Nintendo Wii). If none matches, the default profile based on the global
+// options is returned.
+shared_ptr<const ClientProfile> getClientProfile(string userAgent);
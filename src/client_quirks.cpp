@@ -0,0 +1,79 @@
+#include "client_quirks.hpp"
+
+namespace {
+
+// Emulates JavaScript parseInt(str, 10): leading whitespace and sign are
+// allowed and parsing stops at the first non-digit. Returns empty for NaN.
+optional<int> jsParseInt(const string& str) {
+    size_t pos = 0;
+    while(pos < str.size() && isspace((unsigned char)str[pos])) {
+        ++pos;
+    }
+    bool negative = false;
+    if(pos < str.size() && (str[pos] == '-' || str[pos] == '+')) {
+        negative = str[pos] == '-';
+        ++pos;
+    }
+
+    optional<int> ret;
+    int64_t value = 0;
+    while(pos < str.size() && str[pos] >= '0' && str[pos] <= '9') {
+        value = min(10 * value + (str[pos] - '0'), (int64_t)INT_MAX);
+        ret = (int)(negative ? -value : value);
+        ++pos;
+    }
+    return ret;
+}
+
+}
+
+ClientQuirks detectClientQuirks(string userAgent) {
+    for(char& c : userAgent) {
+        c = tolower(c);
+    }
+    auto contains = [&](const char* str) {
+        return userAgent.find(str) != string::npos;
+    };
+
+    ClientQuirks quirks = {};
+
+    if(contains("chrome") || contains("chromium")) {
+        quirks.useOnMouseWheel = true;
+    }
+    if(contains("firefox")) {
+        quirks.useOnDOMMouseScroll = true;
+    }
+    size_t msie = userAgent.find("msie ");
+    if(msie != string::npos && msie > 0) {
+        size_t verStart = msie + 5;
+        size_t verEnd = userAgent.find('.', msie);
+        optional<int> ver;
+        if(verEnd == string::npos) {
+            // substring(verStart, -1) returns the prefix before verStart
+            ver = jsParseInt(userAgent.substr(0, verStart));
+        } else {
+            ver = jsParseInt(userAgent.substr(verStart, verEnd - verStart));
+        }
+        bool win16Bit =
+            contains("windows 3.1") ||
+            contains("win16") ||
+            contains("windows 16-bit");
+        quirks.useOnMouseWheel = true;
+        if(ver && *ver <= 8) {
+            quirks.fixMousePosition = true;
+            quirks.leftMouseButtonIs1 = true;
+        }
+        if(ver && (*ver <= 4 || (*ver == 5 && win16Bit))) {
+            quirks.bodyOverflowHiddenNotSupported = true;
+            quirks.useBackspaceCaptureHack = true;
+        }
+        if(ver && *ver <= 4) {
+            quirks.stringTimeoutCallbacks = true;
+        }
+    }
+    if(contains("firefox") || contains("netscape") || contains("opera")) {
+        quirks.serverPushBrowser = true;
+    }
+
+    return quirks;
+}
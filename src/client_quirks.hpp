@@ -0,0 +1,20 @@
+#pragma once
+
+#include "common.hpp"
+
+// Browser quirk flags of a client, determined from its User-Agent in the same
+// way as detectUserAgentQuirks in html/main.html does. The flags are used to
+// select the variant of the main page specialized for the browser family at
+// build time by gen_html_header.py; see html/main.html for their meaning.
+struct ClientQuirks {
+    bool useOnDOMMouseScroll;
+    bool useOnMouseWheel;
+    bool fixMousePosition;
+    bool leftMouseButtonIs1;
+    bool bodyOverflowHiddenNotSupported;
+    bool useBackspaceCaptureHack;
+    bool serverPushBrowser;
+    bool stringTimeoutCallbacks;
+};
+
+ClientQuirks detectClientQuirks(string userAgent);
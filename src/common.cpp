@@ -1,5 +1,10 @@
 #include "common.hpp"
 
+#include "globals.hpp"
+#include "metrics.hpp"
+#include "trace.hpp"
+#include "ui_lag_monitor.hpp"
+
 #include "include/wrapper/cef_closure_task.h"
 
 static atomic<bool> panicUsingCEFFatalError_(false);
@@ -26,11 +31,34 @@ void enablePanicUsingCEFFatalError() {
     panicUsingCEFFatalError_.store(true);
 }
 
-void postTask(function<void()> func) {
-    void (*call)(function<void()>) = [](function<void()> func) {
-        func();
+void postTask(function<void()> func, const char* file, int line) {
+    void (*call)(
+        const char*, int, steady_clock::time_point, uint64_t, function<void()>
+    ) = [](
+        const char* file,
+        int line,
+        steady_clock::time_point postTime,
+        uint64_t traceSessionID,
+        function<void()> func
+    ) {
+        TraceSessionScope traceSessionScope(traceSessionID);
+        if(globals) {
+            globals->metrics->uiTaskLag.observeSince(postTime);
+            globals->metrics->uiTasksPending.fetch_sub(1, memory_order_relaxed);
+            globals->uiLagMonitor->runTask(file, line, postTime, func);
+        } else {
+            func();
+        }
     };
-    CefPostTask(TID_UI, base::Bind(call, func));
+    if(globals) {
+        globals->metrics->uiTasksPending.fetch_add(1, memory_order_relaxed);
+    }
+    CefPostTask(
+        TID_UI,
+        base::Bind(
+            call, file, line, steady_clock::now(), currentTraceSession(), func
+        )
+    );
 }
 
 atomic<bool> requireUIThreadEnabled_(false);
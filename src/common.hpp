@@ -78,6 +78,7 @@ using std::vector;
 using std::weak_ptr;
 
 using std::chrono::duration_cast;
+using std::chrono::microseconds;
 using std::chrono::milliseconds;
 using std::chrono::steady_clock;
 
@@ -258,23 +259,77 @@ public:
         DISABLE_COPY_MOVE(ClassName)
 
 // Convenience functions for posting tasks to be run from the CEF UI thread
-// loop. May be called from any thread.
-void postTask(function<void()> func);
+// loop. May be called from any thread. The trace session of the calling thread
+// (see trace.hpp) is carried over to the task, and the task is attributed to
+// the source location of the postTask call in the UI lag monitor (see
+// ui_lag_monitor.hpp).
+void postTask(
+    function<void()> func,
+    const char* file = __builtin_FILE(),
+    int line = __builtin_LINE()
+);
+
+// The object whose member function is called by a task posted using postTask,
+// given as a shared_ptr (kept alive until the task is run) or a weak_ptr (the
+// call is skipped if the object has been destroyed). As the source location
+// arguments cannot follow the argument pack of postTask, the location is
+// recorded when the pointer is implicitly converted to PostTaskTarget.
+template <typename T>
+struct PostTaskTarget {
+    template <typename U>
+    PostTaskTarget(
+        shared_ptr<U> ptr,
+        const char* file = __builtin_FILE(),
+        int line = __builtin_LINE()
+    )
+        : ptr(move(ptr)),
+          file(file),
+          line(line)
+    {}
 
-template <typename T, typename... Args>
-void postTask(shared_ptr<T> ptr, void (T::*func)(Args...), Args... args) {
-    postTask([ptr, func, args...]() {
-        (ptr.get()->*func)(args...);
-    });
-}
+    template <typename U>
+    PostTaskTarget(
+        weak_ptr<U> weakPtr,
+        const char* file = __builtin_FILE(),
+        int line = __builtin_LINE()
+    )
+        : weakPtr(move(weakPtr)),
+          file(file),
+          line(line)
+    {}
+
+    shared_ptr<T> ptr;
+    weak_ptr<T> weakPtr;
+    const char* file;
+    int line;
+};
+
+// Prevents deducing T from the argument, so that it is only deduced from the
+// member function pointer and the argument is converted to PostTaskTarget
+template <typename T>
+struct PostTaskNonDeduced {
+    typedef T Type;
+};
 
 template <typename T, typename... Args>
-void postTask(weak_ptr<T> weakPtr, void (T::*func)(Args...), Args... args) {
-    postTask([weakPtr, func, args...]() {
-        if(shared_ptr<T> ptr = weakPtr.lock()) {
-            (ptr.get()->*func)(args...);
-        }
-    });
+void postTask(
+    typename PostTaskNonDeduced<PostTaskTarget<T>>::Type target,
+    void (T::*func)(Args...),
+    Args... args
+) {
+    shared_ptr<T> ptr = move(target.ptr);
+    weak_ptr<T> weakPtr = move(target.weakPtr);
+    postTask(
+        [ptr, weakPtr, func, args...]() {
+            if(ptr) {
+                (ptr.get()->*func)(args...);
+            } else if(shared_ptr<T> lockedPtr = weakPtr.lock()) {
+                (lockedPtr.get()->*func)(args...);
+            }
+        },
+        target.file,
+        target.line
+    );
 }
 
 // The macro REQUIRE_UI_THREAD is a version of CEF_REQUIRE_UI_THREAD that is
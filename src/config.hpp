@@ -26,5 +26,18 @@ public:
     const string dataDir;
     const int sessionLimit;
     const string httpAuth;
+    const string adminAuth;
+    const bool serverPush;
+    const bool webSocket;
+    const bool eventRequests;
+    const bool compactEvents;
+    const int imagePipelineDepth;
+    const bool streamDownloads;
+    const string clientProfiles;
+    const int bandwidthLimit;
+    const int sessionBandwidthLimit;
+    const bool tracing;
+    const string syntheticRender;
+    const string recordDir;
     const vector<pair<string, optional<string>>> chromiumArgs;
 };
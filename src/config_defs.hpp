@@ -7,6 +7,19 @@
     CONF_FOREACH_OPT_ITEM(dataDir) \
     CONF_FOREACH_OPT_ITEM(sessionLimit) \
     CONF_FOREACH_OPT_ITEM(httpAuth) \
+    CONF_FOREACH_OPT_ITEM(adminAuth) \
+    CONF_FOREACH_OPT_ITEM(serverPush) \
+    CONF_FOREACH_OPT_ITEM(webSocket) \
+    CONF_FOREACH_OPT_ITEM(eventRequests) \
+    CONF_FOREACH_OPT_ITEM(compactEvents) \
+    CONF_FOREACH_OPT_ITEM(imagePipelineDepth) \
+    CONF_FOREACH_OPT_ITEM(streamDownloads) \
+    CONF_FOREACH_OPT_ITEM(clientProfiles) \
+    CONF_FOREACH_OPT_ITEM(bandwidthLimit) \
+    CONF_FOREACH_OPT_ITEM(sessionBandwidthLimit) \
+    CONF_FOREACH_OPT_ITEM(tracing) \
+    CONF_FOREACH_OPT_ITEM(syntheticRender) \
+    CONF_FOREACH_OPT_ITEM(recordDir) \
     CONF_FOREACH_OPT_ITEM(chromiumArgs)
 
 CONF_DEF_OPT_INFO(httpListenAddr) {
@@ -51,7 +64,7 @@ CONF_DEF_OPT_INFO(defaultQuality) {
     const char* valSpec = "QUALITY";
     string desc() {
         stringstream ss;
-        ss << "initial image quality for each session ";
+        ss << "initial image quality for sessions whose client profile does not set it ";
         ss << "(" << MinQuality << ".." << (MaxQuality - 1) << " or PNG)";
         return ss.str();
     }
@@ -171,6 +184,233 @@ CONF_DEF_OPT_INFO(httpAuth) {
     }
 };
 
+CONF_DEF_OPT_INFO(adminAuth) {
+    const char* name = "admin-auth";
+    const char* valSpec = "USER:PASSWORD";
+    string desc() {
+        return "if nonempty, the session administration page /admin/sessions/ is enabled and protected by HTTP basic authentication with given username and password instead of --http-auth; if the special value 'env' is specified, the value is read from the environment variable BROWSERVICE_ADMIN_AUTH_CREDENTIALS";
+    }
+    string defaultValStr() {
+        return "default empty";
+    }
+    string defaultVal() {
+        return "";
+    }
+    optional<string> parse(string str) {
+        optional<string> empty;
+
+        if(str.empty()) {
+            return string();
+        } else {
+            string value;
+            if(str == "env") {
+                const char* valuePtr = getenv("BROWSERVICE_ADMIN_AUTH_CREDENTIALS");
+                if(valuePtr == nullptr) {
+                    ERROR_LOG("Environment variable BROWSERVICE_ADMIN_AUTH_CREDENTIALS missing");
+                    return empty;
+                }
+                value = valuePtr;
+            } else {
+                value = str;
+            }
+
+            size_t colonPos = value.find(':');
+            if(colonPos == value.npos || !colonPos || colonPos + 1 == value.size()) {
+                ERROR_LOG("Given admin authentication credential string is invalid");
+                return empty;
+            }
+            return value;
+        }
+    }
+};
+
+CONF_DEF_OPT_INFO(serverPush) {
+    const char* name = "server-push";
+    const char* valSpec = "YES/NO";
+    string desc() {
+        return
+            "if enabled, client browsers that support server push (Firefox, Netscape and Opera) receive the "
+            "frames as a multipart/x-mixed-replace stream over a single HTTP response instead of requesting "
+            "each frame separately, and input events are sent using short requests";
+    }
+    bool defaultVal() {
+        return false;
+    }
+};
+
+CONF_DEF_OPT_INFO(webSocket) {
+    const char* name = "websocket";
+    const char* valSpec = "YES/NO";
+    string desc() {
+        return
+            "if enabled, client browsers that support WebSockets receive the frames and send the input events "
+            "over a single WebSocket connection; the client falls back to the image request protocol if the "
+            "connection cannot be opened";
+    }
+    bool defaultVal() {
+        return true;
+    }
+};
+
+CONF_DEF_OPT_INFO(eventRequests) {
+    const char* name = "event-requests";
+    const char* valSpec = "YES/NO";
+    string desc() {
+        return
+            "if enabled, clients that use the image request protocol send input events immediately in "
+            "separate short requests instead of waiting for the pending image request to complete; this "
+            "uses one more connection per window";
+    }
+    bool defaultVal() {
+        return false;
+    }
+};
+
+CONF_DEF_OPT_INFO(compactEvents) {
+    const char* name = "compact-events";
+    const char* valSpec = "YES/NO";
+    string desc() {
+        return
+            "if enabled, clients send input events in a compact encoding with short opcodes, base-36 "
+            "numbers and relative mouse coordinates, reducing the length of the request URLs";
+    }
+    bool defaultVal() {
+        return true;
+    }
+};
+
+CONF_DEF_OPT_INFO(imagePipelineDepth) {
+    const char* name = "image-pipeline-depth";
+    const char* valSpec = "COUNT";
+    string desc() {
+        return
+            "maximum number of image requests the client keeps in flight at the same time when using the "
+            "image request protocol; values above 1 hide the network round trip time between frames, "
+            "allowing higher frame rates on high latency connections (1-4)";
+    }
+    int defaultVal() {
+        return 1;
+    }
+    bool validate(int val) {
+        return val >= 1 && val <= 4;
+    }
+};
+
+CONF_DEF_OPT_INFO(streamDownloads) {
+    const char* name = "stream-downloads";
+    const char* valSpec = "YES/NO";
+    string desc() {
+        return
+            "if enabled, accepted file downloads are forwarded to the client while the proxy is still "
+            "downloading them instead of waiting for the download to complete";
+    }
+    bool defaultVal() {
+        return false;
+    }
+};
+
+CONF_DEF_OPT_INFO(clientProfiles) {
+    const char* name = "client-profiles";
+    const char* valSpec = "PATH";
+    string desc() {
+        return
+            "if nonempty, read profiles of per-client settings (quality, frame rate and size limits, long poll "
+            "timeout, page variant) matched by the User-Agent from this file, in addition to the built-in ones; "
+            "see src/client_profile.hpp for the format";
+    }
+    string defaultValStr() {
+        return "default empty";
+    }
+    string defaultVal() {
+        return "";
+    }
+};
+
+CONF_DEF_OPT_INFO(bandwidthLimit) {
+    const char* name = "bandwidth-limit";
+    const char* valSpec = "KBPS";
+    string desc() {
+        return
+            "maximum total rate of data sent to the clients in kilobytes (1024 bytes) per second, or 0 for "
+            "unlimited; throttled sessions compress frames less often";
+    }
+    int defaultVal() {
+        return 0;
+    }
+    bool validate(int val) {
+        return val >= 0 && val <= 1000000;
+    }
+};
+
+CONF_DEF_OPT_INFO(sessionBandwidthLimit) {
+    const char* name = "session-bandwidth-limit";
+    const char* valSpec = "KBPS";
+    string desc() {
+        return
+            "maximum rate of data sent to the client of a single session in kilobytes (1024 bytes) per "
+            "second, or 0 for unlimited";
+    }
+    int defaultVal() {
+        return 0;
+    }
+    bool validate(int val) {
+        return val >= 0 && val <= 1000000;
+    }
+};
+
+CONF_DEF_OPT_INFO(tracing) {
+    const char* name = "tracing";
+    const char* valSpec = "YES/NO";
+    string desc() {
+        return
+            "if enabled, the durations of the image pipeline stages are recorded to in-memory ring buffers "
+            "that can be downloaded in the Chrome trace event format from /trace/SESSION_ID";
+    }
+    bool defaultVal() {
+        return false;
+    }
+};
+
+CONF_DEF_OPT_INFO(syntheticRender) {
+    const char* name = "synthetic-render";
+    const char* valSpec = "MODE";
+    string desc() {
+        return
+            "if nonempty, sessions do not open a browser but paint synthetic content for benchmarking the "
+            "server pipeline; MODE is 'scroll' (continuously scrolling text page), 'animate' (static page with "
+            "a moving box) or 'corpus:DIR' (cycle through the frames of a compression benchmark corpus)";
+    }
+    string defaultValStr() {
+        return "default empty";
+    }
+    string defaultVal() {
+        return "";
+    }
+    bool validate(string val) {
+        return
+            val.empty() ||
+            val == "scroll" ||
+            val == "animate" ||
+            (val.size() > 7 && val.substr(0, 7) == "corpus:");
+    }
+};
+
+CONF_DEF_OPT_INFO(recordDir) {
+    const char* name = "record-dir";
+    const char* valSpec = "PATH";
+    string desc() {
+        return
+            "if nonempty, the frames and client events of each session are recorded to the file "
+            "session-ID.bsrec in this directory, for replaying with bench/session_replay.cpp";
+    }
+    string defaultValStr() {
+        return "default empty";
+    }
+    string defaultVal() {
+        return "";
+    }
+};
+
 CONF_DEF_OPT_INFO(chromiumArgs) {
     const char* name = "chromium-args";
     const char* valSpec = "NAME(=VAL),...";
@@ -272,7 +272,8 @@ struct ControlBar::Layout {
     Layout(
         int width,
         bool isDownloadVisible,
-        bool isFindBarVisible
+        bool isFindBarVisible,
+        bool isPerfStatsVisible
     ) : width(width) {
         int contentStart = 1;
         int contentEnd = width - 1;
@@ -281,6 +282,7 @@ struct ControlBar::Layout {
         const int AddressTextWidth = 52;
         const int QualityTextWidth = 46;
         const int FindTextWidth = 29;
+        const int PerfStatsWidth = 184;
 
         int downloadWidth = isDownloadVisible ? 88 : 0;
         int downloadSpacerWidth = isDownloadVisible ? 2 : 0;
@@ -319,7 +321,10 @@ struct ControlBar::Layout {
         qualityTextEnd = qualitySelectorStart;
         qualityTextStart = qualityTextEnd - QualityTextWidth;
 
-        int separator2End = qualityTextStart;
+        perfStatsEnd = qualityTextStart;
+        perfStatsStart = perfStatsEnd - (isPerfStatsVisible ? PerfStatsWidth : 0);
+
+        int separator2End = perfStatsStart;
         int separator2Start = separator2End - SeparatorWidth;
         separator2Pos = separator2Start + SeparatorWidth / 2;
 
@@ -376,6 +381,9 @@ struct ControlBar::Layout {
     int separator3Pos;
     bool separator3Visible;
 
+    int perfStatsStart;
+    int perfStatsEnd;
+
     int qualityTextStart;
     int qualityTextEnd;
 
@@ -401,7 +409,8 @@ struct ControlBar::Layout {
 ControlBar::ControlBar(CKey,
     weak_ptr<WidgetParent> widgetParent,
     weak_ptr<ControlBarEventHandler> eventHandler,
-    bool allowPNG
+    bool allowPNG,
+    int defaultQuality
 )
     : Widget(widgetParent)
 {
@@ -410,6 +419,7 @@ ControlBar::ControlBar(CKey,
     eventHandler_ = eventHandler;
 
     allowPNG_ = allowPNG;
+    defaultQuality_ = defaultQuality;
 
     animationTimeout_ = Timeout::create(30);
 
@@ -419,6 +429,9 @@ ControlBar::ControlBar(CKey,
     qualityText_ = TextLayout::create();
     qualityText_->setText("Quality");
 
+    perfStatsVisible_ = false;
+    perfStatsText_ = TextLayout::create();
+
     findBarVisible_ = false;
     findText_ = TextLayout::create();
     findText_->setText("Find");
@@ -479,9 +492,15 @@ void ControlBar::setDownloadProgress(vector<int> progress) {
     REQUIRE_UI_THREAD();
 
     if(progress != downloadProgress_) {
-        downloadProgress_ = move(progress);
-        signalViewDirty_();
-        widgetViewportUpdated_();
+        if(progress.size() == downloadProgress_.size()) {
+            // Only the progress bars change, which is rendered as an animation
+            downloadProgress_ = move(progress);
+            scheduleAnimationFrame_();
+        } else {
+            downloadProgress_ = move(progress);
+            signalViewDirty_();
+            widgetViewportUpdated_();
+        }
     }
 }
 
@@ -516,6 +535,23 @@ void ControlBar::activateAddress() {
     addrField_->activate();
 }
 
+void ControlBar::setPerfStats(optional<string> text) {
+    REQUIRE_UI_THREAD();
+
+    bool visible = (bool)text;
+    if(visible != perfStatsVisible_) {
+        perfStatsVisible_ = visible;
+        if(text) {
+            perfStatsText_->setText(move(*text));
+        }
+        widgetViewportUpdated_();
+        signalViewDirty_();
+    } else if(text && *text != perfStatsText_->text()) {
+        perfStatsText_->setText(move(*text));
+        signalViewDirty_();
+    }
+}
+
 void ControlBar::onTextFieldSubmitted(string text) {
     REQUIRE_UI_THREAD();
     postTask(eventHandler_, &ControlBarEventHandler::onAddressSubmitted, text);
@@ -590,7 +626,9 @@ void ControlBar::afterConstruct_(shared_ptr<ControlBar> self) {
     goButton_ = MenuButton::create(goIcon, self, self);
     findButton_ = MenuButton::create(findIcon, self, self);
     clipboardButton_ = MenuButton::create(clipboardIcon, self, self);
-    qualitySelector_ = QualitySelector::create(self, self, allowPNG_);
+    qualitySelector_ = QualitySelector::create(
+        self, self, allowPNG_, defaultQuality_
+    );
     downloadButton_ = Button::create(self, self);
     findBar_ = FindBar::create(self, self);
 }
@@ -600,7 +638,31 @@ bool ControlBar::isDownloadVisible_() {
 }
 
 ControlBar::Layout ControlBar::layout_() {
-    return Layout(getViewport().width(), isDownloadVisible_(), findBarVisible_);
+    return Layout(
+        getViewport().width(),
+        isDownloadVisible_(),
+        findBarVisible_,
+        perfStatsVisible_
+    );
+}
+
+void ControlBar::scheduleAnimationFrame_() {
+    REQUIRE_UI_THREAD();
+
+    if(animationTimeout_->isActive()) {
+        return;
+    }
+
+    weak_ptr<ControlBar> selfWeak = shared_from_this();
+    animationTimeout_->set([selfWeak]() {
+        if(shared_ptr<ControlBar> self = selfWeak.lock()) {
+            if(self->canRenderAnimationFrame()) {
+                self->signalViewDirty_();
+            } else {
+                self->scheduleAnimationFrame_();
+            }
+        }
+    });
 }
 
 void ControlBar::widgetViewportUpdated_() {
@@ -692,6 +754,14 @@ void ControlBar::widgetRender_() {
         viewport.fill(layout.separator3Pos, layout.separator3Pos + 1, 1, Height - 4, 255);
     }
 
+    // Performance statistics
+    if(perfStatsVisible_) {
+        perfStatsText_->render(
+            viewport.subRect(layout.perfStatsStart, layout.perfStatsEnd, 1, Height - 4),
+            3, -4, 64
+        );
+    }
+
     // "Quality" text
     qualityText_->render(
         viewport.subRect(layout.qualityTextStart, layout.qualityTextEnd, 1, Height - 4),
@@ -760,17 +830,16 @@ void ControlBar::widgetRender_() {
             }
         }
 
-        weak_ptr<ControlBar> selfWeak = shared_from_this();
-        animationTimeout_->set([selfWeak]() {
-            if(shared_ptr<ControlBar> self = selfWeak.lock()) {
-                self->signalViewDirty_();
-            }
-        });
+        scheduleAnimationFrame_();
     } else {
         loadingAnimationStartTime_.reset();
     }
 }
 
+bool ControlBar::widgetIsOpaque_() {
+    return true;
+}
+
 vector<shared_ptr<Widget>> ControlBar::widgetListChildren_() {
     REQUIRE_UI_THREAD();
     vector<shared_ptr<Widget>> children = {
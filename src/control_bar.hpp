@@ -42,7 +42,8 @@ public:
     ControlBar(CKey,
         weak_ptr<WidgetParent> widgetParent,
         weak_ptr<ControlBarEventHandler> eventHandler,
-        bool allowPNG
+        bool allowPNG,
+        int defaultQuality
     );
 
     void setSecurityStatus(SecurityStatus value);
@@ -58,6 +59,10 @@ public:
 
     void activateAddress();
 
+    // Show given performance statistics text next to the quality selector, or
+    // hide the statistics if empty
+    void setPerfStats(optional<string> text);
+
     // TextFieldEventHandler:
     virtual void onTextFieldSubmitted(string text) override;
 
@@ -83,14 +88,20 @@ private:
     class Layout;
     Layout layout_();
 
+    // Render the control bar again after the animation interval, skipping
+    // the frames that the client cannot keep up with
+    void scheduleAnimationFrame_();
+
     // Widget:
     virtual void widgetViewportUpdated_() override;
     virtual void widgetRender_() override;
+    virtual bool widgetIsOpaque_() override;
     virtual vector<shared_ptr<Widget>> widgetListChildren_() override;
 
     weak_ptr<ControlBarEventHandler> eventHandler_;
 
     bool allowPNG_;
+    int defaultQuality_;
 
     shared_ptr<Timeout> animationTimeout_;
 
@@ -106,6 +117,9 @@ private:
     shared_ptr<TextLayout> qualityText_;
     shared_ptr<QualitySelector> qualitySelector_;
 
+    bool perfStatsVisible_;
+    shared_ptr<TextLayout> perfStatsText_;
+
     bool findBarVisible_;
     shared_ptr<TextLayout> findText_;
     shared_ptr<FindBar> findBar_;
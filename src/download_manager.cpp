@@ -1,10 +1,14 @@
 #include "download_manager.hpp"
 
+#include "globals.hpp"
 #include "http.hpp"
 #include "temp_dir.hpp"
 
 #include "include/cef_download_handler.h"
 
+#include <fcntl.h>
+#include <unistd.h>
+
 namespace {
 
 pair<string, string> extractExtension(const string& filename) {
@@ -77,7 +81,7 @@ string sanitizeFilename(const string& filename) {
 
 }
 
-CompletedDownload::CompletedDownload(CKey,
+DownloadFile::DownloadFile(CKey,
     shared_ptr<TempDir> tempDir,
     string path,
     string name,
@@ -86,60 +90,169 @@ CompletedDownload::CompletedDownload(CKey,
     tempDir_ = tempDir;
     path_ = move(path);
     name_ = move(name);
+    fd_ = -1;
+    complete_ = true;
+    failed_ = false;
     length_ = length;
 }
 
-CompletedDownload::~CompletedDownload() {
-    if(unlink(path_.c_str())) {
+DownloadFile::DownloadFile(CKey,
+    shared_ptr<TempDir> tempDir,
+    string path,
+    string name,
+    int fd,
+    optional<uint64_t> expectedLength
+) {
+    REQUIRE(fd >= 0);
+
+    tempDir_ = tempDir;
+    path_ = move(path);
+    name_ = move(name);
+    fd_ = fd;
+    expectedLength_ = expectedLength;
+    complete_ = false;
+    failed_ = false;
+    length_ = 0;
+}
+
+DownloadFile::~DownloadFile() {
+    if(fd_ >= 0) {
+        close(fd_);
+    }
+
+    // If the download failed, DownloadManager has already removed the file
+    if(complete_ && unlink(path_.c_str())) {
         WARNING_LOG("Unlinking file ", path_, " failed");
     }
 }
 
-string CompletedDownload::name() {
+string DownloadFile::name() {
     REQUIRE_UI_THREAD();
     return name_;
 }
 
-void CompletedDownload::serve(shared_ptr<HTTPRequest> request) {
+void DownloadFile::serve(shared_ptr<HTTPRequest> request) {
     REQUIRE_UI_THREAD();
 
-    shared_ptr<CompletedDownload> self = shared_from_this();
+    vector<pair<string, string>> headers = {
+        {"Content-Disposition", "attachment; filename=\"" + name_ + "\""}
+    };
+
+    if(complete_) {
+        request->sendFileResponse(
+            path_, length_, "application/download", false, move(headers)
+        );
+        return;
+    }
+    if(failed_) {
+        request->sendTextResponse(500, "ERROR: Download failed\n");
+        return;
+    }
+
+    // The download is still in progress; range requests are not supported
+    // until it is complete
+    shared_ptr<DownloadFile> self = shared_from_this();
     function<void(ostream&)> body = [self](ostream& out) {
-        ifstream fp;
-        fp.open(self->path_, ifstream::binary);
+        self->stream_(out);
+    };
+    if(expectedLength_) {
+        request->sendResponse(
+            200, "application/download", *expectedLength_, body, false, move(headers)
+        );
+    } else {
+        request->sendStreamingResponse(
+            200, "application/download", body, false, move(headers)
+        );
+    }
+}
 
-        if(!fp.good()) {
-            ERROR_LOG("Opening downloaded file ", self->path_, " failed");
-            return;
-        }
+void DownloadFile::downloadProgressed_() {
+    REQUIRE_UI_THREAD();
+    downloadProgressedCV_.notify_all();
+}
 
-        const uint64_t BufSize = 1 << 16;
-        char buf[BufSize];
+void DownloadFile::downloadCompleted_(uint64_t length) {
+    REQUIRE_UI_THREAD();
+    REQUIRE(!complete_ && !failed_);
 
-        uint64_t left = self->length_;
-        while(left) {
-            uint64_t readSize = min(left, BufSize);
-            fp.read(buf, readSize);
+    {
+        lock_guard<mutex> lock(mutex_);
+        complete_ = true;
+        length_ = length;
+    }
+    downloadProgressedCV_.notify_all();
 
-            if(!fp.good()) {
-                ERROR_LOG("Reading downloaded file ", self->path_, " failed");
-                return;
-            }
+    if(expectedLength_ && *expectedLength_ != length) {
+        WARNING_LOG(
+            "Length of streamed download ", name_, " differs from the expected length"
+        );
+    }
+}
+
+void DownloadFile::downloadFailed_() {
+    REQUIRE_UI_THREAD();
+    REQUIRE(!complete_ && !failed_);
+
+    {
+        lock_guard<mutex> lock(mutex_);
+        failed_ = true;
+    }
+    downloadProgressedCV_.notify_all();
+}
 
-            out.write(buf, readSize);
-            left -= readSize;
+void DownloadFile::stream_(ostream& out) {
+    const uint64_t BufSize = 1 << 16;
+    vector<char> buf(BufSize);
+
+    uint64_t pos = 0;
+    uint64_t end = expectedLength_.value_or(UINT64_MAX);
+
+    // Set after the download is complete, when the rest of the file is read
+    // for the last time
+    optional<uint64_t> finalLength;
+
+    while(pos < end && out.good()) {
+        ssize_t readSize = pread(fd_, buf.data(), (size_t)min(end - pos, BufSize), (off_t)pos);
+        if(readSize < 0 && errno == EINTR) {
+            continue;
+        }
+        if(readSize < 0) {
+            ERROR_LOG("Reading downloaded file ", path_, " failed");
+            out.setstate(std::ios_base::badbit);
+            return;
+        }
+        if(readSize > 0) {
+            out.write(buf.data(), readSize);
+            pos += (uint64_t)readSize;
+            continue;
         }
-        fp.close();
-    };
 
-    request->sendResponse(
-        200,
-        "application/download",
-        length_,
-        body,
-        false,
-        {{"Content-Disposition", "attachment; filename=\"" + name_ + "\""}}
-    );
+        if(finalLength) {
+            if(pos != *finalLength) {
+                ERROR_LOG("Downloaded file ", path_, " is shorter than reported");
+            }
+            if(pos != *finalLength || expectedLength_) {
+                // The file is shorter than the Content-Length we promised
+                out.setstate(std::ios_base::badbit);
+            }
+            return;
+        }
+
+        // Reached the end of the data written so far; wait for the browser to
+        // write more
+        out.flush();
+        std::unique_lock<mutex> lock(mutex_);
+        if(failed_) {
+            WARNING_LOG("Download ", name_, " failed while it was streamed to the client");
+            out.setstate(std::ios_base::badbit);
+            return;
+        }
+        if(complete_) {
+            finalLength = length_;
+        } else {
+            downloadProgressedCV_.wait_for(lock, milliseconds(200));
+        }
+    }
 }
 
 class DownloadManager::DownloadHandler : public CefDownloadHandler {
@@ -194,21 +307,28 @@ public:
             int64_t length = downloadItem->GetReceivedBytes();
             REQUIRE(length >= 0);
 
-            shared_ptr<CompletedDownload> file = CompletedDownload::create(
-                downloadManager_->tempDir_,
-                downloadManager_->getFilePath_(info.fileIdx),
-                move(info.name),
-                (uint64_t)length
-            );
+            if(info.file) {
+                info.file->downloadCompleted_((uint64_t)length);
+            } else {
+                shared_ptr<DownloadFile> file = DownloadFile::create(
+                    downloadManager_->tempDir_,
+                    downloadManager_->getFilePath_(info.fileIdx),
+                    move(info.name),
+                    (uint64_t)length
+                );
+                postTask(
+                    downloadManager_->eventHandler_,
+                    &DownloadManagerEventHandler::onDownloadReady,
+                    file
+                );
+            }
             downloadManager_->infos_.erase(id);
-            postTask(
-                downloadManager_->eventHandler_,
-                &DownloadManagerEventHandler::onDownloadCompleted,
-                file
-            );
         } else if(!downloadItem->IsInProgress()) {
             info.cancelCallback->Cancel();
             downloadManager_->unlinkFile_(info.fileIdx);
+            if(info.file) {
+                info.file->downloadFailed_();
+            }
             downloadManager_->infos_.erase(id);
         } else {
             info.progress = downloadItem->GetPercentComplete();
@@ -216,6 +336,12 @@ public:
                 info.progress = 50;
             }
             info.progress = max(0, min(100, info.progress));
+
+            if(info.file) {
+                info.file->downloadProgressed_();
+            } else if(globals->config->streamDownloads) {
+                downloadManager_->startStreaming_(info, downloadItem);
+            }
         }
         downloadManager_->downloadProgressChanged_();
     }
@@ -243,6 +369,9 @@ DownloadManager::~DownloadManager() {
                 info.cancelCallback->Cancel();
             }
             unlinkFile_(info.fileIdx);
+            if(info.file) {
+                info.file->downloadFailed_();
+            }
         }
     }
 }
@@ -273,6 +402,37 @@ CefRefPtr<CefDownloadHandler> DownloadManager::createCefDownloadHandler() {
     return new DownloadHandler(shared_from_this());
 }
 
+void DownloadManager::startStreaming_(
+    DownloadInfo& info,
+    CefRefPtr<CefDownloadItem> downloadItem
+) {
+    REQUIRE(!info.file);
+
+    // The browser writes the file to an intermediate path that is renamed once
+    // the download is complete; the file descriptor remains valid across the
+    // rename. If the file has not been created yet, we try again on the next
+    // update.
+    string currentPath = downloadItem->GetFullPath().ToString();
+    if(currentPath.empty()) {
+        return;
+    }
+    int fd = open(currentPath.c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd == -1) {
+        return;
+    }
+
+    optional<uint64_t> expectedLength;
+    int64_t totalBytes = downloadItem->GetTotalBytes();
+    if(totalBytes > 0) {
+        expectedLength = (uint64_t)totalBytes;
+    }
+
+    info.file = DownloadFile::create(
+        tempDir_, getFilePath_(info.fileIdx), info.name, fd, expectedLength
+    );
+    postTask(eventHandler_, &DownloadManagerEventHandler::onDownloadReady, info.file);
+}
+
 string DownloadManager::getFilePath_(int fileIdx) {
     if(!tempDir_) {
         tempDir_ = TempDir::create();
@@ -2,19 +2,39 @@
 
 #include "common.hpp"
 
+#include <condition_variable>
+
 class HTTPRequest;
 class TempDir;
 
-class CompletedDownload : public enable_shared_from_this<CompletedDownload> {
-SHARED_ONLY_CLASS(CompletedDownload);
+// File downloaded by the browser, served to the client. In the streaming mode
+// (--stream-downloads), the client is given the file while the browser is
+// still downloading it, and the responses follow the file as it grows until
+// the download is complete.
+class DownloadFile : public enable_shared_from_this<DownloadFile> {
+SHARED_ONLY_CLASS(DownloadFile);
 public:
-    CompletedDownload(CKey,
+    // Complete file of given length
+    DownloadFile(CKey,
         shared_ptr<TempDir> tempDir,
         string path,
         string name,
         uint64_t length
     );
-    ~CompletedDownload();
+
+    // File that is still being downloaded, readable through fd (of which the
+    // object takes ownership). Once complete, the file is found in path.
+    // expectedLength is the final length of the file if it is known in
+    // advance.
+    DownloadFile(CKey,
+        shared_ptr<TempDir> tempDir,
+        string path,
+        string name,
+        int fd,
+        optional<uint64_t> expectedLength
+    );
+
+    ~DownloadFile();
 
     string name();
 
@@ -24,21 +44,43 @@ public:
     void serve(shared_ptr<HTTPRequest> request);
 
 private:
+    // Called by DownloadManager in the UI thread for files still being
+    // downloaded
+    void downloadProgressed_();
+    void downloadCompleted_(uint64_t length);
+    void downloadFailed_();
+
+    // Writes the file to out as it grows; called in an HTTP server thread
+    void stream_(ostream& out);
+
     shared_ptr<TempDir> tempDir_;
     string path_;
     string name_;
+    int fd_;
+    optional<uint64_t> expectedLength_;
+
+    // Modified only in the UI thread, protected by mutex_ for stream_
+    mutex mutex_;
+    std::condition_variable downloadProgressedCV_;
+    bool complete_;
+    bool failed_;
     uint64_t length_;
+
+    friend class DownloadManager;
 };
 
 class DownloadManagerEventHandler {
 public:
     virtual void onPendingDownloadCountChanged(int count) = 0;
     virtual void onDownloadProgressChanged(vector<int> progress) {}
-    virtual void onDownloadCompleted(shared_ptr<CompletedDownload> file) = 0;
+    // Called when the file is ready to be served to the client: when the
+    // download is complete, or in the streaming mode, as soon as it has started
+    virtual void onDownloadReady(shared_ptr<DownloadFile> file) = 0;
 };
 
 class CefDownloadHandler;
 class CefBeforeDownloadCallback;
+class CefDownloadItem;
 class CefDownloadItemCallback;
 
 class DownloadManager : public enable_shared_from_this<DownloadManager> {
@@ -62,8 +104,17 @@ private:
         CefRefPtr<CefBeforeDownloadCallback> startCallback;
         CefRefPtr<CefDownloadItemCallback> cancelCallback;
         int progress;
+
+        // Set in the streaming mode once the file has been given to the
+        // client
+        shared_ptr<DownloadFile> file;
     };
 
+    void startStreaming_(
+        DownloadInfo& info,
+        CefRefPtr<CefDownloadItem> downloadItem
+    );
+
     string getFilePath_(int fileIdx);
     void unlinkFile_(int fileIdx);
 
@@ -5,6 +5,95 @@
 
 namespace {
 
+// The compact event encoding used by clients that support it to reduce the
+// length of the request paths. Each event consists of a single letter opcode
+// followed by the arguments of the corresponding plain event as base-36
+// numbers (digits 0-9A-Z with optional '-' sign) separated by '_'. For mouse
+// events, the first two arguments are the coordinates relative to the previous
+// mouse event in the same request, or to (0, 0) for the first mouse event of
+// the request, so that a lost request cannot break the coordinates of the
+// later ones. For example, "MDN_130_40_0" following "MMO_120_45" is encoded as
+// "DA_-5_0". The opcodes never coincide with the first letter of a plain event
+// name, so the encodings can be mixed.
+struct CompactEvent {
+    char opcode;
+    const char* name;
+    bool isMouseEvent;
+};
+
+const CompactEvent CompactEvents[] = {
+    {'V', "MMO", true},
+    {'D', "MDN", true},
+    {'U', "MUP", true},
+    {'B', "MDBL", true},
+    {'W', "MWH", true},
+    {'O', "MOUT", true},
+    {'H', "KDN", false},
+    {'R', "KUP", false},
+    {'P', "KPR", false},
+    {'L', "FOUT", false}
+};
+
+const CompactEvent* findCompactEvent(char opcode) {
+    for(const CompactEvent& compactEvent : CompactEvents) {
+        if(compactEvent.opcode == opcode) {
+            return &compactEvent;
+        }
+    }
+    return nullptr;
+}
+
+bool isMouseEventName(const string& name) {
+    for(const CompactEvent& compactEvent : CompactEvents) {
+        if(compactEvent.isMouseEvent && name == compactEvent.name) {
+            return true;
+        }
+    }
+    return false;
+}
+
+optional<int> parseBase36(
+    string::const_iterator begin,
+    string::const_iterator end
+) {
+    optional<int> empty;
+
+    bool negative = false;
+    if(begin != end && *begin == '-') {
+        negative = true;
+        ++begin;
+    }
+    if(begin == end) {
+        return empty;
+    }
+
+    int64_t value = 0;
+    for(string::const_iterator pos = begin; pos != end; ++pos) {
+        int digit;
+        if(*pos >= '0' && *pos <= '9') {
+            digit = *pos - '0';
+        } else if(*pos >= 'A' && *pos <= 'Z') {
+            digit = *pos - 'A' + 10;
+        } else {
+            return empty;
+        }
+        value = 36 * value + digit;
+        if(value > INT_MAX) {
+            return empty;
+        }
+    }
+    return (int)(negative ? -value : value);
+}
+
+// Make sure that the absolute coordinates computed from the relative ones
+// cannot overflow
+int addCoord(int base, int delta) {
+    int64_t coord = (int64_t)base + (int64_t)delta;
+    coord = max(coord, (int64_t)-1000000);
+    coord = min(coord, (int64_t)1000000);
+    return (int)coord;
+}
+
 bool processParsedEvent(
     shared_ptr<Widget> widget,
     const string& name,
@@ -98,31 +187,43 @@ bool processParsedEvent(
     return false;
 }
 
-}
+const int MaxArgCount = 3;
 
-bool processEvent(
-    shared_ptr<Widget> widget,
+// Parse the name and the arguments of the event, converting relative mouse
+// coordinates to absolute ones and updating the state
+bool parseEvent(
+    EventState& state,
     string::const_iterator begin,
-    string::const_iterator end
+    string::const_iterator end,
+    string& name,
+    int* args,
+    int& argCount
 ) {
-    REQUIRE_UI_THREAD();
     REQUIRE(begin < end && *(end - 1) == '/');
 
-    string name;
+    argCount = 0;
 
-    const int MaxArgCount = 3;
-    int args[MaxArgCount];
-    int argCount = 0;
+    const CompactEvent* compactEvent = findCompactEvent(*begin);
 
     string::const_iterator pos = begin;
-    while(*pos != '/' && *pos != '_') {
+    bool hasArgs;
+    if(compactEvent != nullptr) {
+        name = compactEvent->name;
         ++pos;
+        hasArgs = *pos != '/';
+    } else {
+        while(*pos != '/' && *pos != '_') {
+            ++pos;
+        }
+        name = string(begin, pos);
+        hasArgs = *pos == '_';
+        if(hasArgs) {
+            ++pos;
+        }
     }
-    name = string(begin, pos);
 
     bool ok = true;
-    if(*pos == '_') {
-        ++pos;
+    if(hasArgs) {
         while(true) {
             if(argCount == MaxArgCount) {
                 ok = false;
@@ -132,7 +233,12 @@ bool processEvent(
             while(*pos != '/' && *pos != '_') {
                 ++pos;
             }
-            optional<int> arg = parseString<int>(argStart, pos);
+            optional<int> arg;
+            if(compactEvent != nullptr) {
+                arg = parseBase36(argStart, pos);
+            } else {
+                arg = parseString<int>(argStart, pos);
+            }
             if(!arg) {
                 ok = false;
                 break;
@@ -144,6 +250,52 @@ bool processEvent(
             ++pos;
         }
     }
+    if(!ok) {
+        return false;
+    }
+
+    bool isMouseEvent =
+        compactEvent != nullptr ? compactEvent->isMouseEvent : isMouseEventName(name);
+    if(isMouseEvent && argCount >= 2) {
+        if(compactEvent != nullptr) {
+            args[0] = addCoord(state.mouseX, args[0]);
+            args[1] = addCoord(state.mouseY, args[1]);
+        }
+        state.mouseX = args[0];
+        state.mouseY = args[1];
+    }
+
+    return true;
+}
+
+}
+
+bool processEvent(
+    shared_ptr<Widget> widget,
+    EventState& state,
+    string::const_iterator begin,
+    string::const_iterator end
+) {
+    REQUIRE_UI_THREAD();
+
+    string name;
+    int args[MaxArgCount];
+    int argCount;
+    if(!parseEvent(state, begin, end, name, args, argCount)) {
+        return false;
+    }
+    return processParsedEvent(widget, name, argCount, args);
+}
+
+void skipEvent(
+    EventState& state,
+    string::const_iterator begin,
+    string::const_iterator end
+) {
+    REQUIRE_UI_THREAD();
 
-    return ok && processParsedEvent(widget, name, argCount, args);
+    string name;
+    int args[MaxArgCount];
+    int argCount;
+    parseEvent(state, begin, end, name, args, argCount);
 }
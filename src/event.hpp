@@ -4,10 +4,31 @@
 
 class Widget;
 
-// Parse event string given by range [begin, end). If successful, return true
-// and send the event to widget, otherwise return false.
+// State shared by the consecutive events in a single request sent by a client.
+// The mouse events of the compact encoding have coordinates relative to the
+// previous mouse event, regardless of the encoding of the previous event. The
+// state should be reset to zero at the start of each request.
+struct EventState {
+    int mouseX;
+    int mouseY;
+};
+
+// Parse event string given by range [begin, end) in either the plain encoding
+// (such as "MMO_120_45/") or the compact encoding (such as "V3_-A/"), see
+// event.cpp. If successful, return true and send the event to widget,
+// otherwise return false.
 bool processEvent(
     shared_ptr<Widget> widget,
+    EventState& state,
+    string::const_iterator begin,
+    string::const_iterator end
+);
+
+// Update state by given event like processEvent, without sending the event to
+// any widget. Used for the events of a request that have already been handled,
+// as the relative coordinates of the later events depend on them.
+void skipEvent(
+    EventState& state,
     string::const_iterator begin,
     string::const_iterator end
 );
@@ -168,6 +168,7 @@ void FindBar::open() {
     if(!isOpen_) {
         isOpen_ = true;
         findResult_ = true;
+        textField_->setBackgroundColor(255, 255, 255);
         text_.reset();
         textField_->setText("");
         lastDirForward_ = true;
@@ -202,6 +203,11 @@ void FindBar::setFindResult(bool found) {
 
     if(isOpen_ && findResult_ != found) {
         findResult_ = found;
+        if(findResult_) {
+            textField_->setBackgroundColor(255, 255, 255);
+        } else {
+            textField_->setBackgroundColor(255, 176, 176);
+        }
         signalViewDirty_();
     }
 }
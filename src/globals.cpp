@@ -1,13 +1,21 @@
 #include "globals.hpp"
 
+#include "bandwidth_limiter.hpp"
+#include "metrics.hpp"
 #include "quality.hpp"
 #include "text.hpp"
+#include "ui_lag_monitor.hpp"
 #include "xwindow.hpp"
 
 Globals::Globals(CKey, shared_ptr<Config> config)
     : config(config),
       xWindow(XWindow::create()),
-      textRenderContext(TextRenderContext::create())
+      textRenderContext(TextRenderContext::create()),
+      metrics(Metrics::create()),
+      bandwidthLimiter(
+          BandwidthLimiter::create((uint64_t)config->bandwidthLimit * 1024)
+      ),
+      uiLagMonitor(UILagMonitor::create())
 {
     REQUIRE(config);
 }
@@ -2,7 +2,10 @@
 
 #include "config.hpp"
 
+class BandwidthLimiter;
+class Metrics;
 class TextRenderContext;
+class UILagMonitor;
 class XWindow;
 
 class Globals {
@@ -13,6 +16,9 @@ public:
     const shared_ptr<Config> config;
     const shared_ptr<XWindow> xWindow;
     const shared_ptr<TextRenderContext> textRenderContext;
+    const shared_ptr<Metrics> metrics;
+    const shared_ptr<BandwidthLimiter> bandwidthLimiter;
+    const shared_ptr<UILagMonitor> uiLagMonitor;
 };
 
 extern shared_ptr<Globals> globals;
@@ -1,6 +1,6 @@
 #pragma once
 
-#include "common.hpp"
+#include "client_quirks.hpp"
 
 struct NewSessionHTMLData {
     uint64_t sessionID;
@@ -11,6 +11,16 @@ struct MainHTMLData {
     uint64_t sessionID;
     uint64_t mainIdx;
     const string& nonCharKeyList;
+    bool serverPush;
+    bool webSocket;
+    bool eventRequests;
+    bool compactEvents;
+    int imgPipelineDepth;
+
+    // Selects the variant of the page specialized for the browser family; if
+    // specialized is false, the generic variant is always used
+    bool specialized;
+    ClientQuirks quirks;
 };
 void writeMainHTML(ostream& out, const MainHTMLData& data);
 
@@ -54,3 +64,9 @@ struct ClipboardHTMLData {
     string escapedText;
 };
 void writeClipboardHTML(ostream& out, const ClipboardHTMLData& data);
+
+struct AdminSessionsHTMLData {
+    string totalBandwidth;
+    string rows;
+};
+void writeAdminSessionsHTML(ostream& out, const AdminSessionsHTMLData& data);
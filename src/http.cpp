@@ -1,6 +1,9 @@
 #include "http.hpp"
 
+#include "bandwidth_limiter.hpp"
 #include "globals.hpp"
+#include "metrics.hpp"
+#include "trace.hpp"
 
 #include "include/cef_parser.h"
 
@@ -9,7 +12,430 @@
 #include <Poco/Net/HTTPServerResponse.h>
 #include <Poco/Net/HTTPRequest.h>
 #include <Poco/Net/HTTPServerRequest.h>
+#include <Poco/Net/HTTPServerRequestImpl.h>
 #include <Poco/Net/HTTPRequestHandler.h>
+#include <Poco/Net/StreamSocket.h>
+#include <Poco/Net/WebSocket.h>
+
+#include <fcntl.h>
+#include <sys/sendfile.h>
+#include <unistd.h>
+
+namespace {
+
+// Maximum size of a message received from a WebSocket client
+constexpr int MaxWebSocketMessageSize = 64 * 1024;
+
+// The maximum number of threads in the HTTP server pool. Each request holds a
+// thread until it has been responded to, so we reserve threads for the
+// requests that each session may keep waiting at the same time: the long
+// polled image requests (or the push stream or WebSocket connection that
+// replaces them), one miscellaneous request, an event request and a streamed
+// download. The rest of the threads are left for the short requests and
+// the responses delayed by bandwidth throttling.
+int maxHTTPThreadCount() {
+    int perSession = globals->config->imagePipelineDepth + 1;
+    if(globals->config->eventRequests) {
+        ++perSession;
+    }
+    if(globals->config->streamDownloads) {
+        ++perSession;
+    }
+    return perSession * globals->config->sessionLimit + 16;
+}
+
+// Owns a file descriptor, closing it upon destruction
+class FileDescriptor {
+public:
+    FileDescriptor(int fd) : fd_(fd) {}
+    ~FileDescriptor() {
+        close(fd_);
+    }
+
+    DISABLE_COPY_MOVE(FileDescriptor);
+
+    int get() {
+        return fd_;
+    }
+
+private:
+    int fd_;
+};
+
+regex byteRangeRegex("bytes=([0-9]*)-([0-9]*)");
+
+// Parses the value of a Range header for a resource of given length. Returns
+// the requested range as a half-open interval, which is empty if the range is
+// not satisfiable, or nothing if the header should be ignored (because it is
+// invalid or it requests multiple ranges).
+optional<pair<uint64_t, uint64_t>> parseByteRange(const string& header, uint64_t length) {
+    optional<pair<uint64_t, uint64_t>> empty;
+
+    smatch match;
+    if(!regex_match(header, match, byteRangeRegex)) {
+        return empty;
+    }
+    REQUIRE(match.size() == 3);
+
+    if(match[1].length() == 0) {
+        // Suffix range "bytes=-N" for the last N bytes
+        optional<uint64_t> suffixLength = parseString<uint64_t>(match[2]);
+        if(!suffixLength) {
+            return empty;
+        }
+        return pair<uint64_t, uint64_t>(length - min(*suffixLength, length), length);
+    }
+
+    optional<uint64_t> first = parseString<uint64_t>(match[1]);
+    if(!first) {
+        return empty;
+    }
+    optional<uint64_t> last;
+    if(match[2].length() != 0) {
+        last = parseString<uint64_t>(match[2]);
+        if(!last || *last < *first) {
+            return empty;
+        }
+    }
+    if(*first >= length) {
+        return pair<uint64_t, uint64_t>(length, length);
+    }
+    uint64_t end = last ? min(*last, length - 1) + 1 : length;
+    return pair<uint64_t, uint64_t>(*first, end);
+}
+
+bool hasBandwidthLimit(const vector<shared_ptr<BandwidthLimiter>>& limiters) {
+    for(const shared_ptr<BandwidthLimiter>& limiter : limiters) {
+        if(limiter->limit() != 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Output stream buffer that forwards the data to dest in chunks, waiting
+// before each chunk until the bandwidth limiters allow sending
+class ThrottledStreamBuf : public std::streambuf {
+public:
+    ThrottledStreamBuf(
+        ostream& dest,
+        vector<shared_ptr<BandwidthLimiter>> limiters
+    )
+        : dest_(dest),
+          limiters_(move(limiters)),
+          buf_(ChunkSize)
+    {
+        setp(buf_.data(), buf_.data() + buf_.size());
+    }
+
+    DISABLE_COPY_MOVE(ThrottledStreamBuf);
+
+protected:
+    virtual int overflow(int c) override {
+        if(!writeChunk_()) {
+            return traits_type::eof();
+        }
+        if(!traits_type::eq_int_type(c, traits_type::eof())) {
+            *pptr() = traits_type::to_char_type(c);
+            pbump(1);
+        }
+        return traits_type::not_eof(c);
+    }
+
+    virtual int sync() override {
+        if(!writeChunk_()) {
+            return -1;
+        }
+        dest_.flush();
+        return dest_.good() ? 0 : -1;
+    }
+
+private:
+    static constexpr size_t ChunkSize = 16 * 1024;
+
+    bool writeChunk_() {
+        std::streamsize size = pptr() - pbase();
+        if(size > 0) {
+            BandwidthLimiter::throttle(limiters_, (uint64_t)size);
+            dest_.write(pbase(), size);
+            setp(buf_.data(), buf_.data() + buf_.size());
+        }
+        return dest_.good();
+    }
+
+    ostream& dest_;
+    vector<shared_ptr<BandwidthLimiter>> limiters_;
+    vector<char> buf_;
+};
+
+// Output stream buffer used instead of ThrottledStreamBuf when the limiters
+// have no limits. The data is forwarded to dest without extra buffering, and
+// the bytes are deducted from the limiters (to measure the usage) only when the
+// stream is flushed, to avoid locking the limiters on every write.
+class CountingStreamBuf : public std::streambuf {
+public:
+    CountingStreamBuf(
+        ostream& dest,
+        vector<shared_ptr<BandwidthLimiter>> limiters
+    )
+        : dest_(dest),
+          limiters_(move(limiters)),
+          pendingBytes_(0)
+    {}
+
+    DISABLE_COPY_MOVE(CountingStreamBuf);
+
+protected:
+    virtual int overflow(int c) override {
+        if(!traits_type::eq_int_type(c, traits_type::eof())) {
+            dest_.put(traits_type::to_char_type(c));
+            ++pendingBytes_;
+        }
+        return dest_.good() ? traits_type::not_eof(c) : traits_type::eof();
+    }
+
+    virtual std::streamsize xsputn(const char* data, std::streamsize size) override {
+        dest_.write(data, size);
+        pendingBytes_ += (uint64_t)size;
+        return dest_.good() ? size : 0;
+    }
+
+    virtual int sync() override {
+        for(const shared_ptr<BandwidthLimiter>& limiter : limiters_) {
+            limiter->consume(pendingBytes_);
+        }
+        pendingBytes_ = 0;
+        dest_.flush();
+        return dest_.good() ? 0 : -1;
+    }
+
+private:
+    ostream& dest_;
+    vector<shared_ptr<BandwidthLimiter>> limiters_;
+    uint64_t pendingBytes_;
+};
+
+// Writes the bytes [begin, end) of the file to the connection of the request
+// after the response headers written to out. If possible, the data is copied by
+// the kernel directly from the file to the socket using sendfile(2); otherwise
+// it is read and written through out. As sendfile(2) bypasses out, it is only
+// used if the bandwidth limiters have no limits, and the bytes sent are
+// deducted from the limiters directly.
+void sendFileRange(
+    ostream& out,
+    Poco::Net::HTTPServerRequest& request,
+    int fd,
+    uint64_t begin,
+    uint64_t end,
+    const vector<shared_ptr<BandwidthLimiter>>& limiters
+) {
+    uint64_t pos = begin;
+
+    Poco::Net::HTTPServerRequestImpl* requestImpl =
+        dynamic_cast<Poco::Net::HTTPServerRequestImpl*>(&request);
+    if(requestImpl != nullptr && !hasBandwidthLimit(limiters)) {
+        out.flush();
+        if(!out.good()) {
+            return;
+        }
+
+        Poco::Net::StreamSocket& socket = requestImpl->socket();
+        while(pos < end) {
+            off_t offset = (off_t)pos;
+            size_t count = (size_t)min(end - pos, (uint64_t)1 << 30);
+            ssize_t written = sendfile(socket.impl()->sockfd(), fd, &offset, count);
+            if(written > 0) {
+                pos += (uint64_t)written;
+                for(const shared_ptr<BandwidthLimiter>& limiter : limiters) {
+                    limiter->consume((uint64_t)written);
+                }
+                continue;
+            }
+            if(written < 0 && errno == EINTR) {
+                continue;
+            }
+            if(written < 0 && (errno == EINVAL || errno == ENOSYS) && pos == begin) {
+                // sendfile is not supported for this file or socket
+                break;
+            }
+
+            // The connection cannot be reused, as the response is incomplete
+            try {
+                socket.shutdown();
+            } catch(const Poco::Exception&) {}
+            return;
+        }
+    }
+
+    const uint64_t BufSize = 1 << 16;
+    vector<char> buf(BufSize);
+    while(pos < end && out.good()) {
+        ssize_t readSize = pread(fd, buf.data(), (size_t)min(end - pos, BufSize), (off_t)pos);
+        if(readSize < 0 && errno == EINTR) {
+            continue;
+        }
+        if(readSize <= 0) {
+            ERROR_LOG("Reading file for HTTP response failed");
+
+            // The response is incomplete, so sendResponse must shut down the
+            // connection
+            out.setstate(std::ios_base::badbit);
+            return;
+        }
+        out.write(buf.data(), readSize);
+        pos += (uint64_t)readSize;
+    }
+}
+
+}
+
+class WebSocketConnection::Impl {
+public:
+    Impl(
+        unique_ptr<Poco::Net::WebSocket> socket,
+        vector<shared_ptr<BandwidthLimiter>> bandwidthLimiters
+    )
+        : socket_(move(socket)),
+          bandwidthLimiters_(move(bandwidthLimiters)),
+          closed_(false)
+    {
+        socket_->setReceiveTimeout(Poco::Timespan(30, 0));
+    }
+
+    ~Impl() {
+        close();
+    }
+
+    DISABLE_COPY_MOVE(Impl);
+
+    bool waitForMessage(int64_t timeoutMs) {
+        try {
+            // Data read past the HTTP request may already be buffered in the
+            // WebSocket, in which case the socket does not become readable
+            if(socket_->available() > 0) {
+                return true;
+            }
+            return socket_->poll(
+                Poco::Timespan(timeoutMs * 1000),
+                Poco::Net::Socket::SELECT_READ | Poco::Net::Socket::SELECT_ERROR
+            );
+        } catch(const Poco::Exception&) {
+            return true;
+        }
+    }
+
+    optional<string> receiveMessage() {
+        optional<string> empty;
+
+        vector<char> buf(MaxWebSocketMessageSize);
+        while(true) {
+            int flags = 0;
+            int size;
+            try {
+                size = socket_->receiveFrame(buf.data(), (int)buf.size(), flags);
+            } catch(const Poco::Exception&) {
+                return empty;
+            }
+
+            int opcode = flags & Poco::Net::WebSocket::FRAME_OP_BITMASK;
+            if(
+                (size <= 0 && flags == 0) ||
+                opcode == Poco::Net::WebSocket::FRAME_OP_CLOSE
+            ) {
+                return empty;
+            }
+            if(opcode == Poco::Net::WebSocket::FRAME_OP_PING) {
+                int pongFlags =
+                    Poco::Net::WebSocket::FRAME_FLAG_FIN |
+                    Poco::Net::WebSocket::FRAME_OP_PONG;
+                if(!sendFrame_(buf.data(), size, pongFlags)) {
+                    return empty;
+                }
+                continue;
+            }
+            if(opcode == Poco::Net::WebSocket::FRAME_OP_PONG) {
+                continue;
+            }
+            if(
+                (
+                    opcode != Poco::Net::WebSocket::FRAME_OP_TEXT &&
+                    opcode != Poco::Net::WebSocket::FRAME_OP_BINARY
+                ) ||
+                !(flags & Poco::Net::WebSocket::FRAME_FLAG_FIN)
+            ) {
+                // Fragmented messages are not supported
+                WARNING_LOG("Unsupported WebSocket frame received, closing connection");
+                return empty;
+            }
+            return string(buf.data(), (size_t)size);
+        }
+    }
+
+    bool sendBinaryMessage(const void* data, size_t size) {
+        if(size > (size_t)INT_MAX) {
+            return false;
+        }
+        BandwidthLimiter::throttle(bandwidthLimiters_, size);
+        return sendFrame_(data, (int)size, Poco::Net::WebSocket::FRAME_BINARY);
+    }
+
+    void close() {
+        lock_guard<mutex> lock(sendMutex_);
+        if(closed_) {
+            return;
+        }
+        closed_ = true;
+
+        // Send a close frame and shut down the underlying connection to make
+        // sure that a pending receive returns
+        try {
+            socket_->shutdown();
+        } catch(const Poco::Exception&) {}
+        try {
+            socket_->impl()->shutdown();
+        } catch(const Poco::Exception&) {}
+    }
+
+private:
+    bool sendFrame_(const void* data, int size, int flags) {
+        lock_guard<mutex> lock(sendMutex_);
+        if(closed_) {
+            return false;
+        }
+        try {
+            return socket_->sendFrame(data, size, flags) >= size;
+        } catch(const Poco::Exception&) {
+            return false;
+        }
+    }
+
+    unique_ptr<Poco::Net::WebSocket> socket_;
+    vector<shared_ptr<BandwidthLimiter>> bandwidthLimiters_;
+    mutex sendMutex_;
+    bool closed_;
+};
+
+WebSocketConnection::WebSocketConnection(CKey, unique_ptr<Impl> impl)
+    : impl_(move(impl))
+{}
+
+WebSocketConnection::~WebSocketConnection() {}
+
+bool WebSocketConnection::waitForMessage(int64_t timeoutMs) {
+    return impl_->waitForMessage(timeoutMs);
+}
+
+optional<string> WebSocketConnection::receiveMessage() {
+    return impl_->receiveMessage();
+}
+
+bool WebSocketConnection::sendBinaryMessage(const void* data, size_t size) {
+    return impl_->sendBinaryMessage(data, size);
+}
+
+void WebSocketConnection::close() {
+    impl_->close();
+}
 
 class HTTPRequest::Impl {
 public:
@@ -19,7 +445,8 @@ public:
     )
         : request_(request),
           responderPromise_(move(responderPromise)),
-          responseSent_(false)
+          responseSent_(false),
+          bandwidthLimiters_({globals->bandwidthLimiter})
     {}
 
     ~Impl() {
@@ -90,27 +517,55 @@ public:
         return string(buf.begin(), buf.end());
     }
 
+    bool isWebSocketUpgrade() {
+        REQUIRE(!responseSent_);
+
+        string upgrade = request_.get("Upgrade", "");
+        for(char& c : upgrade) {
+            c = tolower(c);
+        }
+        return upgrade == "websocket";
+    }
+
+    void addBandwidthLimiter(shared_ptr<BandwidthLimiter> limiter) {
+        REQUIRE(!responseSent_);
+        REQUIRE(limiter);
+        bandwidthLimiters_.push_back(limiter);
+    }
+
+    // If contentLength is empty, the response is streamed without a length
+    // and the connection is closed after the body has been written
     void sendResponse(
         int status,
         string contentType,
-        uint64_t contentLength,
+        optional<uint64_t> contentLength,
         function<void(ostream&)> body,
         bool noCache,
         vector<pair<string, string>> extraHeaders
     ) {
         REQUIRE(!responseSent_);
         responseSent_ = true;
+        uint64_t traceSessionID = currentTraceSession();
+        Poco::Net::HTTPServerRequest* request = &request_;
         responderPromise_.set_value(
             [
+                traceSessionID,
+                request,
                 status,
                 contentType{move(contentType)},
                 contentLength,
                 body,
                 noCache,
-                extraHeaders{move(extraHeaders)}
+                extraHeaders{move(extraHeaders)},
+                bandwidthLimiters{bandwidthLimiters_}
             ](Poco::Net::HTTPServerResponse& response) {
                 response.add("Content-Type", contentType);
-                response.setContentLength64(contentLength);
+                if(contentLength) {
+                    response.setContentLength64(*contentLength);
+                } else {
+                    response.setChunkedTransferEncoding(false);
+                    response.setKeepAlive(false);
+                }
                 if(noCache) {
                     response.add("Cache-Control", "no-cache, no-store, must-revalidate");
                     response.add("Pragma", "no-cache");
@@ -120,11 +575,140 @@ public:
                     response.add(header.first, header.second);
                 }
                 response.setStatus((Poco::Net::HTTPResponse::HTTPStatus)status);
-                body(response.send());
+
+                TraceSessionScope traceSessionScope(traceSessionID);
+                TRACE_SCOPE("HTTPRequest response write");
+                unique_ptr<std::streambuf> streamBuf;
+                if(hasBandwidthLimit(bandwidthLimiters)) {
+                    streamBuf = make_unique<ThrottledStreamBuf>(
+                        response.send(), bandwidthLimiters
+                    );
+                } else {
+                    streamBuf = make_unique<CountingStreamBuf>(
+                        response.send(), bandwidthLimiters
+                    );
+                }
+                ostream out(streamBuf.get());
+                body(out);
+                out.flush();
+
+                if(contentLength && !out.good()) {
+                    // The response may be incomplete, so the connection
+                    // cannot be reused
+                    Poco::Net::HTTPServerRequestImpl* requestImpl =
+                        dynamic_cast<Poco::Net::HTTPServerRequestImpl*>(request);
+                    if(requestImpl != nullptr) {
+                        try {
+                            requestImpl->socket().shutdown();
+                        } catch(const Poco::Exception&) {}
+                    }
+                }
             }
         );
     }
 
+    void acceptWebSocket(function<void(shared_ptr<WebSocketConnection>)> handler) {
+        REQUIRE(!responseSent_);
+        responseSent_ = true;
+        uint64_t traceSessionID = currentTraceSession();
+        Poco::Net::HTTPServerRequest* request = &request_;
+        vector<shared_ptr<BandwidthLimiter>> bandwidthLimiters = bandwidthLimiters_;
+        responderPromise_.set_value(
+            [
+                traceSessionID, request, handler, bandwidthLimiters
+            ](Poco::Net::HTTPServerResponse& response) {
+                TraceSessionScope traceSessionScope(traceSessionID);
+
+                unique_ptr<Poco::Net::WebSocket> socket;
+                try {
+                    socket = make_unique<Poco::Net::WebSocket>(*request, response);
+                } catch(const Poco::Exception& e) {
+                    WARNING_LOG("WebSocket handshake failed: ", e.displayText());
+                    if(!response.sent()) {
+                        response.setStatusAndReason(Poco::Net::HTTPResponse::HTTP_BAD_REQUEST);
+                        response.setContentLength64(0);
+                        response.send();
+                    }
+                    return;
+                }
+
+                handler(WebSocketConnection::create(
+                    make_unique<WebSocketConnection::Impl>(
+                        move(socket), bandwidthLimiters
+                    )
+                ));
+            }
+        );
+    }
+
+    void sendFileResponse(
+        string path,
+        uint64_t length,
+        string contentType,
+        bool noCache,
+        vector<pair<string, string>> extraHeaders
+    ) {
+        REQUIRE(!responseSent_);
+
+        // The file is opened right away so that it may be unlinked while the
+        // response is still being sent
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if(fd == -1) {
+            ERROR_LOG("Opening file ", path, " for HTTP response failed");
+            sendTextResponse(500, "ERROR: Opening file failed\n", true, {});
+            return;
+        }
+        shared_ptr<FileDescriptor> file = make_shared<FileDescriptor>(fd);
+
+        int status = 200;
+        uint64_t begin = 0;
+        uint64_t end = length;
+        extraHeaders.emplace_back("Accept-Ranges", "bytes");
+
+        // As the response has no validators that If-Range could match, the
+        // Range header must be ignored if If-Range is given
+        if(request_.has("Range") && !request_.has("If-Range")) {
+            optional<pair<uint64_t, uint64_t>> range =
+                parseByteRange(request_.get("Range"), length);
+            if(range) {
+                tie(begin, end) = *range;
+                if(begin == end) {
+                    extraHeaders.emplace_back(
+                        "Content-Range", "bytes */" + toString(length)
+                    );
+                    sendTextResponse(
+                        416,
+                        "ERROR: Requested range not satisfiable\n",
+                        noCache,
+                        move(extraHeaders)
+                    );
+                    return;
+                }
+                status = 206;
+                extraHeaders.emplace_back(
+                    "Content-Range",
+                    "bytes " + toString(begin) + "-" + toString(end - 1) +
+                        "/" + toString(length)
+                );
+            }
+        }
+
+        Poco::Net::HTTPServerRequest* request = &request_;
+        vector<shared_ptr<BandwidthLimiter>> bandwidthLimiters = bandwidthLimiters_;
+        sendResponse(
+            status,
+            move(contentType),
+            end - begin,
+            [request, file, begin, end, bandwidthLimiters](ostream& out) {
+                sendFileRange(
+                    out, *request, file->get(), begin, end, bandwidthLimiters
+                );
+            },
+            noCache,
+            move(extraHeaders)
+        );
+    }
+
     void sendTextResponse(
         int status,
         string text,
@@ -149,6 +733,7 @@ private:
     optional<Poco::Net::HTMLForm> form_;
     promise<function<void(Poco::Net::HTTPServerResponse&)>> responderPromise_;
     bool responseSent_;
+    vector<shared_ptr<BandwidthLimiter>> bandwidthLimiters_;
 };
 
 namespace http_ {
@@ -163,6 +748,8 @@ public:
         Poco::Net::HTTPServerRequest& request,
         Poco::Net::HTTPServerResponse& response
     ) override {
+        steady_clock::time_point startTime = steady_clock::now();
+
         promise<function<void(Poco::Net::HTTPServerResponse&)>> responderPromise;
         future<function<void(Poco::Net::HTTPServerResponse&)>> responderFuture =
             responderPromise.get_future();
@@ -180,6 +767,8 @@ public:
 
         std::function<void(Poco::Net::HTTPServerResponse&)> responder = responderFuture.get();
         responder(response);
+
+        globals->metrics->httpRequestTime.observeSince(startTime);
     }
 
 private:
@@ -234,6 +823,16 @@ optional<string> HTTPRequest::getBasicAuthCredentials() {
     return impl_->getBasicAuthCredentials();
 }
 
+bool HTTPRequest::isWebSocketUpgrade() {
+    REQUIRE_UI_THREAD();
+    return impl_->isWebSocketUpgrade();
+}
+
+void HTTPRequest::addBandwidthLimiter(shared_ptr<BandwidthLimiter> limiter) {
+    REQUIRE_UI_THREAD();
+    impl_->addBandwidthLimiter(limiter);
+}
+
 void HTTPRequest::sendResponse(
     int status,
     string contentType,
@@ -248,6 +847,32 @@ void HTTPRequest::sendResponse(
     );
 }
 
+void HTTPRequest::sendStreamingResponse(
+    int status,
+    string contentType,
+    function<void(ostream&)> body,
+    bool noCache,
+    vector<pair<string, string>> extraHeaders
+) {
+    REQUIRE_UI_THREAD();
+    impl_->sendResponse(
+        status, contentType, {}, body, noCache, move(extraHeaders)
+    );
+}
+
+void HTTPRequest::sendFileResponse(
+    string path,
+    uint64_t length,
+    string contentType,
+    bool noCache,
+    vector<pair<string, string>> extraHeaders
+) {
+    REQUIRE_UI_THREAD();
+    impl_->sendFileResponse(
+        move(path), length, move(contentType), noCache, move(extraHeaders)
+    );
+}
+
 void HTTPRequest::sendTextResponse(
     int status,
     string text,
@@ -258,6 +883,13 @@ void HTTPRequest::sendTextResponse(
     impl_->sendTextResponse(status, move(text), noCache, move(extraHeaders));
 }
 
+void HTTPRequest::acceptWebSocket(
+    function<void(shared_ptr<WebSocketConnection>)> handler
+) {
+    REQUIRE_UI_THREAD();
+    impl_->acceptWebSocket(handler);
+}
+
 class HTTPServer::Impl : public enable_shared_from_this<Impl> {
 SHARED_ONLY_CLASS(Impl);
 public:
@@ -267,7 +899,7 @@ public:
     )
         : eventHandler_(eventHandler),
           state_(Running),
-          threadPool_(2, 2 * globals->config->sessionLimit + 16),
+          threadPool_(2, maxHTTPThreadCount()),
           socketAddress_(listenSockAddr),
           serverSocket_(socketAddress_),
           httpServer_(
@@ -2,14 +2,53 @@
 
 #include "common.hpp"
 
+class BandwidthLimiter;
+
 namespace http_ {
     class HTTPRequestHandler;
 }
 
+// WebSocket connection accepted using HTTPRequest::acceptWebSocket. The member
+// functions may be called from any thread; one thread may be receiving
+// messages while other threads are sending.
+class WebSocketConnection {
+SHARED_ONLY_CLASS(WebSocketConnection);
+private:
+    class Impl;
+
+public:
+    WebSocketConnection(CKey, unique_ptr<Impl> impl);
+    ~WebSocketConnection();
+
+    // Blocks for at most timeoutMs milliseconds until data is available for
+    // receiveMessage. Returns true also if the connection was closed or
+    // failed, in which case receiveMessage returns empty.
+    bool waitForMessage(int64_t timeoutMs);
+
+    // Blocks until a text or binary message is received. Pings are answered
+    // automatically. Returns empty if the connection was closed or failed.
+    optional<string> receiveMessage();
+
+    // Returns false if sending the message failed
+    bool sendBinaryMessage(const void* data, size_t size);
+
+    // Close the connection, making pending and future receiveMessage calls
+    // return empty
+    void close();
+
+private:
+    unique_ptr<Impl> impl_;
+
+    friend class HTTPRequest;
+};
+
 // Information about a single request. The response should be sent by calling
 // one of the send* functions exactly once. If no response is given, a internal
 // server error response is sent upon object destruction and a warning is
 // logged. No other member functions may be called after sending the response.
+// The response (including the messages sent through a WebSocket connection) is
+// throttled by globals->bandwidthLimiter and the limiters added using
+// addBandwidthLimiter.
 class HTTPRequest {
 SHARED_ONLY_CLASS(HTTPRequest);
 private:
@@ -26,8 +65,15 @@ public:
 
     optional<string> getBasicAuthCredentials();
 
+    // Returns true if the client requests an upgrade to the WebSocket protocol
+    bool isWebSocketUpgrade();
+
+    void addBandwidthLimiter(shared_ptr<BandwidthLimiter> limiter);
+
     // The body function may be called from a different thread. The given
-    // content length should match the number of bytes written by body.
+    // content length should match the number of bytes written by body; if
+    // body cannot write all of them, it should set the badbit of the stream,
+    // and the connection is shut down after it returns.
     void sendResponse(
         int status,
         string contentType,
@@ -37,6 +83,31 @@ public:
         vector<pair<string, string>> extraHeaders = {}
     );
 
+    // Send a response of unknown length that is written incrementally. The
+    // body function is called in the HTTP server thread handling the request
+    // and it may block for as long as it keeps writing the response; the
+    // connection is closed after it returns.
+    void sendStreamingResponse(
+        int status,
+        string contentType,
+        function<void(ostream&)> body,
+        bool noCache = true,
+        vector<pair<string, string>> extraHeaders = {}
+    );
+
+    // Send the first length bytes of the file in given path. The file is opened
+    // immediately, and thus it may be unlinked after the call. If the request
+    // has a Range header for a single byte range, only that range is sent
+    // with status 206 (or status 416 if the range is not satisfiable). The
+    // file is copied to the connection using sendfile(2) when possible.
+    void sendFileResponse(
+        string path,
+        uint64_t length,
+        string contentType,
+        bool noCache = true,
+        vector<pair<string, string>> extraHeaders = {}
+    );
+
     void sendTextResponse(
         int status,
         string text,
@@ -44,6 +115,13 @@ public:
         vector<pair<string, string>> extraHeaders = {}
     );
 
+    // Respond by accepting the WebSocket upgrade requested by the client. The
+    // handler is called with the connection in the HTTP server thread handling
+    // the request and it may block for as long as it uses the connection; the
+    // connection is closed after it returns. If the handshake fails, an error
+    // response is sent and the handler is not called.
+    void acceptWebSocket(function<void(shared_ptr<WebSocketConnection>)> handler);
+
     template <typename Data>
     void sendHTMLResponse(
         int status,
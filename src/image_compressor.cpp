@@ -1,22 +1,36 @@
 #include "image_compressor.hpp"
 
+#include "bandwidth_limiter.hpp"
+#include "client_profile.hpp"
 #include "globals.hpp"
 #include "http.hpp"
 #include "jpeg.hpp"
+#include "metrics.hpp"
 #include "png.hpp"
 #include "quality.hpp"
 #include "timeout.hpp"
+#include "trace.hpp"
 
 #include "include/cef_thread.h"
 #include "include/wrapper/cef_closure_task.h"
 
+#include <condition_variable>
+
 namespace {
 
-void serveWhiteJPEGPixel(shared_ptr<HTTPRequest> request) {
-    REQUIRE_UI_THREAD();
+const string StreamBoundary = "browservice-frame";
+
+// The maximum time a WebSocket stream waits for messages from the client
+// before checking whether the next image is ready to be sent
+constexpr int64_t WebSocketPollMs = 10;
 
+// True in the image compressor thread while it is compressing an image, and
+// thus its CPU time is already being accounted for
+thread_local bool compressCPUTimeAccounted = false;
+
+shared_ptr<vector<uint8_t>> whiteJPEGPixel() {
     // 1x1 white JPEG
-    vector<uint8_t> data = {
+    return make_shared<vector<uint8_t>>(vector<uint8_t>{
         255, 216, 255, 224, 0, 16, 74, 70, 73, 70, 0, 1, 1, 1, 0, 72, 0, 72,
         0, 0, 255, 219, 0, 67, 0, 3, 2, 2, 3, 2, 2, 3, 3, 3, 3, 4, 3, 3, 4,
         5, 8, 5, 5, 4, 4, 5, 10, 7, 7, 6, 8, 12, 10, 12, 12, 11, 10, 11, 11,
@@ -32,29 +46,141 @@ void serveWhiteJPEGPixel(shared_ptr<HTTPRequest> request) {
         1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 255, 196, 0, 20,
         17, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 255, 218, 0,
         12, 3, 1, 0, 2, 17, 3, 17, 0, 63, 0, 84, 193, 255, 217
-    };
-    uint64_t contentLength = data.size();
-    request->sendResponse(
-        200,
-        "image/jpeg",
-        contentLength,
-        [data{move(data)}](ostream& out) {
-            out.write((const char*)data.data(), data.size());
-        }
-    );
+    });
 }
 
+shared_ptr<vector<uint8_t>> unchangedGIF() {
+    // 1x1 GIF
+    return make_shared<vector<uint8_t>>(vector<uint8_t>{
+        71, 73, 70, 56, 55, 97, 1, 0, 1, 0, 128, 0, 0, 0, 0, 0, 0, 0, 0,
+        44, 0, 0, 0, 0, 1, 0, 1, 0, 0, 8, 4, 0, 1, 4, 4, 0, 59
+    });
 }
 
-ImageCompressor::ImageCompressor(CKey, int64_t sendTimeoutMs, bool allowPNG) {
-    REQUIRE_UI_THREAD();
+}
+
+// Stream started by startStream or startWebSocketStream. The images are handed
+// over from the UI thread to the HTTP server thread writing them one at a time:
+// the server thread notifies the compressor through streamPartWritten_ when it
+// is ready for the next image, and through streamClosed_ when it has stopped
+// (i.e. when the CloseNotifier owned by the response handler is destroyed).
+class ImageCompressor::Stream {
+public:
+    class CloseNotifier {
+    public:
+        CloseNotifier(shared_ptr<Stream> stream, weak_ptr<ImageCompressor> compressor)
+            : stream_(stream),
+              compressor_(compressor)
+        {}
+        ~CloseNotifier() {
+            postTask(compressor_, &ImageCompressor::streamClosed_, stream_);
+        }
+
+        DISABLE_COPY_MOVE(CloseNotifier);
+
+    private:
+        shared_ptr<Stream> stream_;
+        weak_ptr<ImageCompressor> compressor_;
+    };
+
+    Stream() : closed_(false) {}
+
+    DISABLE_COPY_MOVE(Stream);
+
+    void push(CompressedImage image) {
+        lock_guard<mutex> lock(mutex_);
+        REQUIRE(!next_);
+        next_ = move(image);
+        cv_.notify_one();
+    }
+
+    void close() {
+        lock_guard<mutex> lock(mutex_);
+        closed_ = true;
+        cv_.notify_one();
+    }
+
+    // Called in the HTTP server thread; writes the images using writeImage
+    // until the stream is closed or writeImage returns false. If idle is
+    // given, it is called repeatedly instead of blocking while there is no
+    // image to write; it should block for a short time, and the stream is
+    // stopped if it returns false.
+    void run(
+        function<bool(const CompressedImage&)> writeImage,
+        shared_ptr<Stream> self,
+        weak_ptr<ImageCompressor> compressor,
+        function<bool()> idle = function<bool()>()
+    ) {
+        while(true) {
+            CompressedImage image;
+            {
+                std::unique_lock<mutex> lock(mutex_);
+                if(idle) {
+                    while(!closed_ && !next_) {
+                        lock.unlock();
+                        if(!idle()) {
+                            return;
+                        }
+                        lock.lock();
+                    }
+                } else {
+                    cv_.wait(lock, [&]() { return closed_ || next_; });
+                }
+                if(closed_) {
+                    return;
+                }
+                image = move(*next_);
+                next_.reset();
+            }
+
+            if(!writeImage(image)) {
+                return;
+            }
 
-    allowPNG_ = allowPNG;
+            postTask(compressor, &ImageCompressor::streamPartWritten_, self);
+        }
+    }
 
-    sendTimeout_ = Timeout::create(sendTimeoutMs);
+private:
+    mutex mutex_;
+    std::condition_variable cv_;
+    optional<CompressedImage> next_;
+    bool closed_;
+};
+
+ImageCompressor::ImageCompressor(CKey,
+    int64_t minSendTimeoutMs,
+    int64_t maxSendTimeoutMs,
+    int maxWaitingRequests,
+    shared_ptr<const ClientProfile> clientProfile,
+    shared_ptr<BandwidthLimiter> bandwidthLimiter,
+    shared_ptr<SessionMetrics> sessionMetrics
+) {
+    REQUIRE_UI_THREAD();
+    REQUIRE(minSendTimeoutMs >= 1 && maxSendTimeoutMs >= minSendTimeoutMs);
+    REQUIRE(maxWaitingRequests >= 1);
+    REQUIRE(clientProfile);
+    REQUIRE(bandwidthLimiter);
+    REQUIRE(sessionMetrics);
+
+    minSendTimeoutMs_ = minSendTimeoutMs;
+    maxSendTimeoutMs_ = maxSendTimeoutMs;
+    maxWaitingRequests_ = maxWaitingRequests;
+    allowPNG_ = clientProfile->allowPNG;
+    frameByteBudget_ = clientProfile->frameByteBudget;
+    bandwidthLimiter_ = bandwidthLimiter;
+    sessionMetrics_ = sessionMetrics;
+
+    sendTimeoutMs_ = minSendTimeoutMs;
+    sendTimeout_ = Timeout::create(sendTimeoutMs_);
     compressorThread_ = CefThread::CreateThread("Image compressor");
 
-    quality_ = getDefaultQuality(allowPNG);
+    if(clientProfile->maxFPS > 0) {
+        frameIntervalTimeout_ = Timeout::create(1000 / clientProfile->maxFPS);
+    }
+
+    quality_ = clientProfile->defaultQuality;
+    REQUIRE(quality_ >= MinQuality && quality_ <= getMaxQuality(allowPNG_));
 
     int pngThreadCount = (int)thread::hardware_concurrency();
     pngThreadCount = min(pngThreadCount, 4);
@@ -62,33 +188,69 @@ ImageCompressor::ImageCompressor(CKey, int64_t sendTimeoutMs, bool allowPNG) {
 
     pngCompressor_ = make_shared<PNGCompressor>(pngThreadCount);
 
+    shared_ptr<SessionMetrics> stripSessionMetrics = sessionMetrics_;
+    pngCompressor_->setStripRunner(
+        [stripSessionMetrics](const function<void()>& runStrip) {
+            TraceSessionScope traceSessionScope(stripSessionMetrics->sessionID);
+            TRACE_SCOPE("PNGCompressor strip");
+
+            if(compressCPUTimeAccounted) {
+                runStrip();
+            } else {
+                uint64_t startCPUTime = threadCPUTimeNanoseconds();
+                runStrip();
+                stripSessionMetrics->compressCPUNanoseconds.add(
+                    threadCPUTimeNanoseconds() - startCPUTime
+                );
+            }
+        }
+    );
+
     // Prior to compressing the first image, our image is a white pixel
     image_ = ImageSlice::createImage(1, 1);
-    compressedImage_ = [](shared_ptr<HTTPRequest> request) {
-        serveWhiteJPEGPixel(request);
+    shared_ptr<vector<uint8_t>> pixel = whiteJPEGPixel();
+    compressedImage_.contentType = "image/jpeg";
+    compressedImage_.length = pixel->size();
+    compressedImage_.writer = [pixel](ostream& out) {
+        out.write((const char*)pixel->data(), pixel->size());
     };
+    compressedImage_.countInMetrics = false;
 
     imageUpdated_ = false;
     compressedImageUpdated_ = false;
     compressionInProgress_ = false;
+
+    streamReady_ = false;
+    compressedImageStreamed_ = false;
 }
 
-ImageCompressor::~ImageCompressor() {}
+ImageCompressor::~ImageCompressor() {
+    if(stream_) {
+        stream_->close();
+    }
+}
 
 void ImageCompressor::setQuality(int quality) {
     REQUIRE(quality >= MinQuality && quality <= getMaxQuality(allowPNG_));
     if(quality != quality_) {
         quality_ = quality;
+        if(!imageUpdated_) {
+            imageUpdateTime_ = steady_clock::now();
+        }
         imageUpdated_ = true;
         pump_();
     }
 }
 
-void ImageCompressor::updateImage(ImageSlice image) {
+void ImageCompressor::updateImage(ImageSlice image, Rect damage) {
     REQUIRE_UI_THREAD();
     REQUIRE(!image.isEmpty());
 
     image_ = image;
+    imageDamage_ = Rect::boundingBox(imageDamage_, damage);
+    if(!imageUpdated_) {
+        imageUpdateTime_ = steady_clock::now();
+    }
     imageUpdated_ = true;
     pump_();
 }
@@ -96,39 +258,164 @@ void ImageCompressor::updateImage(ImageSlice image) {
 void ImageCompressor::sendCompressedImageNow(shared_ptr<HTTPRequest> httpRequest) {
     REQUIRE_UI_THREAD();
 
-    sendTimeout_->clear(true);
+    flush();
+    sendImage_(httpRequest);
+}
 
-    compressedImage_(httpRequest);
+void ImageCompressor::sendCompressedImageWait(
+    shared_ptr<HTTPRequest> httpRequest,
+    bool allowUnchanged
+) {
+    REQUIRE_UI_THREAD();
 
-    compressedImageUpdated_ = false;
-    pump_();
+    if(waitingRequests_.empty() && compressedImageUpdated_) {
+        globals->metrics->longPollWaitTime.observe(0.0);
+        sendImage_(httpRequest);
+        return;
+    }
+
+    waitingRequests_.push({httpRequest, steady_clock::now(), allowUnchanged});
+    if((int)waitingRequests_.size() > maxWaitingRequests_) {
+        sendFirstWaitingRequest_();
+    } else if(waitingRequests_.size() == 1) {
+        setSendTimeout_();
+    }
 }
 
-void ImageCompressor::sendCompressedImageWait(shared_ptr<HTTPRequest> httpRequest) {
+void ImageCompressor::flush() {
     REQUIRE_UI_THREAD();
 
-    sendTimeout_->clear(true);
+    while(!waitingRequests_.empty()) {
+        sendFirstWaitingRequest_();
+    }
+}
+
+void ImageCompressor::resetSendTimeout() {
+    REQUIRE_UI_THREAD();
+    setSendTimeoutMs_(minSendTimeoutMs_);
+}
 
-    if(compressedImageUpdated_) {
-        sendCompressedImageNow(httpRequest);
-    } else {
-        shared_ptr<ImageCompressor> self = shared_from_this();
-        sendTimeout_->set([self, httpRequest]() {
-            REQUIRE_UI_THREAD();
-            self->sendCompressedImageNow(httpRequest);
-        });
+void ImageCompressor::startStream(shared_ptr<HTTPRequest> httpRequest) {
+    REQUIRE_UI_THREAD();
+
+    stopStream();
+
+    shared_ptr<Stream> stream = make_shared<Stream>();
+    weak_ptr<ImageCompressor> self = shared_from_this();
+    shared_ptr<Stream::CloseNotifier> closeNotifier =
+        make_shared<Stream::CloseNotifier>(stream, self);
+
+    httpRequest->sendStreamingResponse(
+        200,
+        "multipart/x-mixed-replace; boundary=" + StreamBoundary,
+        [stream, self, closeNotifier](ostream& out) {
+            out << "--" << StreamBoundary << "\r\n";
+            stream->run(
+                [&out](const CompressedImage& image) {
+                    // Write the boundary immediately after the image so that
+                    // the client displays the image without waiting for the
+                    // next one
+                    out << "Content-Type: " << image.contentType << "\r\n";
+                    out << "Content-Length: " << image.length << "\r\n\r\n";
+                    image.writer(out);
+                    out << "\r\n--" << StreamBoundary << "\r\n";
+                    out.flush();
+                    return out.good();
+                },
+                stream,
+                self
+            );
+        }
+    );
+
+    startStream_(stream);
+}
+
+void ImageCompressor::startWebSocketStream(
+    shared_ptr<HTTPRequest> httpRequest,
+    function<void(string)> messageHandler
+) {
+    REQUIRE_UI_THREAD();
+
+    stopStream();
+
+    shared_ptr<Stream> stream = make_shared<Stream>();
+    weak_ptr<ImageCompressor> self = shared_from_this();
+    shared_ptr<Stream::CloseNotifier> closeNotifier =
+        make_shared<Stream::CloseNotifier>(stream, self);
+
+    httpRequest->acceptWebSocket(
+        [stream, self, closeNotifier, messageHandler](
+            shared_ptr<WebSocketConnection> connection
+        ) {
+            // Receive the messages in this thread while waiting for the next
+            // image to send, so that each connection only holds one thread of
+            // the HTTP server pool
+            stream->run(
+                [&connection](const CompressedImage& image) {
+                    stringstream ss;
+                    image.writer(ss);
+                    string data = ss.str();
+                    return connection->sendBinaryMessage(data.data(), data.size());
+                },
+                stream,
+                self,
+                [&connection, messageHandler]() {
+                    if(!connection->waitForMessage(WebSocketPollMs)) {
+                        return true;
+                    }
+                    optional<string> message = connection->receiveMessage();
+                    if(!message) {
+                        return false;
+                    }
+                    postTask([messageHandler, message]() {
+                        messageHandler(*message);
+                    });
+                    return true;
+                }
+            );
+
+            connection->close();
+        }
+    );
+
+    startStream_(stream);
+}
+
+void ImageCompressor::stopStream() {
+    REQUIRE_UI_THREAD();
+
+    if(stream_) {
+        stream_->close();
+        stream_.reset();
+        streamReady_ = false;
     }
 }
 
-void ImageCompressor::flush() {
+bool ImageCompressor::hasStream() {
+    REQUIRE_UI_THREAD();
+    return (bool)stream_;
+}
+
+bool ImageCompressor::isIdle() {
     REQUIRE_UI_THREAD();
-    sendTimeout_->clear(true);
+
+    return
+        !imageUpdated_ &&
+        !compressionInProgress_ &&
+        !compressedImageUpdated_ &&
+        (!stream_ || streamReady_);
 }
 
 ImageCompressor::CompressedImage ImageCompressor::compressPNG_(
     ImageSlice image,
-    shared_ptr<PNGCompressor> pngCompressor
+    shared_ptr<PNGCompressor> pngCompressor,
+    shared_ptr<SessionMetrics> sessionMetrics
 ) {
+    TRACE_SCOPE("ImageCompressor::compressPNG_");
+
+    steady_clock::time_point startTime = steady_clock::now();
+
     shared_ptr<vector<vector<uint8_t>>> png =
         make_shared<vector<vector<uint8_t>>>(
             pngCompressor->compress(
@@ -144,20 +431,24 @@ ImageCompressor::CompressedImage ImageCompressor::compressPNG_(
         length += chunk.size();
     }
 
-    return [png, length](shared_ptr<HTTPRequest> request) {
-        REQUIRE_UI_THREAD();
+    steady_clock::duration encodeTime = steady_clock::now() - startTime;
+    globals->metrics->pngEncodeTime.observeDuration(encodeTime);
+    globals->metrics->pngEncodeSize.observe((double)length);
+    sessionMetrics->lastImageBytes.store(length);
+    sessionMetrics->lastEncodeMicroseconds.store(
+        (uint64_t)duration_cast<microseconds>(encodeTime).count()
+    );
 
-        request->sendResponse(
-            200,
-            "image/png",
-            length,
-            [png](ostream& out) {
-                for(const vector<uint8_t>& chunk : *png) {
-                    out.write((const char*)chunk.data(), chunk.size());
-                }
-            }
-        );
+    CompressedImage compressedImage;
+    compressedImage.contentType = "image/png";
+    compressedImage.length = length;
+    compressedImage.writer = [png](ostream& out) {
+        for(const vector<uint8_t>& chunk : *png) {
+            out.write((const char*)chunk.data(), chunk.size());
+        }
     };
+    compressedImage.countInMetrics = true;
+    return compressedImage;
 }
 
 ImageCompressor::CompressedImage ImageCompressor::compressJPEG_(
@@ -166,6 +457,8 @@ ImageCompressor::CompressedImage ImageCompressor::compressJPEG_(
 ) {
     REQUIRE(quality > 0 && quality <= 100);
 
+    TRACE_SCOPE("ImageCompressor::compressJPEG_");
+
     shared_ptr<JPEGData> jpeg = make_shared<JPEGData>(compressJPEG(
         image.buf(),
         image.width(),
@@ -173,43 +466,237 @@ ImageCompressor::CompressedImage ImageCompressor::compressJPEG_(
         image.pitch(),
         quality
     ));
-    return [jpeg](shared_ptr<HTTPRequest> request) {
-        REQUIRE_UI_THREAD();
 
-        request->sendResponse(
+    CompressedImage compressedImage;
+    compressedImage.contentType = "image/jpeg";
+    compressedImage.length = jpeg->length;
+    compressedImage.writer = [jpeg](ostream& out) {
+        out.write((const char*)jpeg->data.get(), jpeg->length);
+    };
+    compressedImage.countInMetrics = true;
+    return compressedImage;
+}
+
+ImageCompressor::CompressedImage ImageCompressor::compressJPEGWithinBudget_(
+    ImageSlice image,
+    int quality,
+    uint64_t frameByteBudget,
+    shared_ptr<SessionMetrics> sessionMetrics
+) {
+    steady_clock::time_point startTime = steady_clock::now();
+
+    CompressedImage compressedImage = compressJPEG_(image, quality);
+
+    if(
+        frameByteBudget != 0 &&
+        compressedImage.length > frameByteBudget &&
+        quality > MinQuality
+    ) {
+        // The JPEG size does not scale linearly with the quality, so the
+        // result may still exceed the budget; we accept that rather than
+        // spending more encoding time on the frame
+        int reducedQuality = (int)(
+            (uint64_t)quality * frameByteBudget / compressedImage.length
+        );
+        reducedQuality = max(reducedQuality, MinQuality);
+        compressedImage = compressJPEG_(image, reducedQuality);
+    }
+
+    steady_clock::duration encodeTime = steady_clock::now() - startTime;
+    globals->metrics->jpegEncodeTime.observeDuration(encodeTime);
+    globals->metrics->jpegEncodeSize.observe((double)compressedImage.length);
+    sessionMetrics->lastImageBytes.store(compressedImage.length);
+    sessionMetrics->lastEncodeMicroseconds.store(
+        (uint64_t)duration_cast<microseconds>(encodeTime).count()
+    );
+
+    return compressedImage;
+}
+
+void ImageCompressor::sendImage_(shared_ptr<HTTPRequest> httpRequest) {
+    REQUIRE_UI_THREAD();
+
+    if(compressedImage_.countInMetrics) {
+        sessionMetrics_->framesSent.add();
+        sessionMetrics_->imageBytesSent.add(compressedImage_.length);
+    }
+    httpRequest->sendResponse(
+        200,
+        compressedImage_.contentType,
+        compressedImage_.length,
+        compressedImage_.writer
+    );
+
+    compressedImageUpdated_ = false;
+    pump_();
+}
+
+void ImageCompressor::sendFirstWaitingRequest_() {
+    REQUIRE_UI_THREAD();
+    REQUIRE(!waitingRequests_.empty());
+
+    sendTimeout_->clear(false);
+
+    WaitingRequest waitingRequest = waitingRequests_.front();
+    waitingRequests_.pop();
+    globals->metrics->longPollWaitTime.observeSince(waitingRequest.waitStartTime);
+    if(waitingRequest.allowUnchanged && !compressedImageUpdated_) {
+        shared_ptr<vector<uint8_t>> gif = unchangedGIF();
+        waitingRequest.httpRequest->sendResponse(
             200,
-            "image/jpeg",
-            jpeg->length,
-            [jpeg](ostream& out) {
-                out.write((const char*)jpeg->data.get(), jpeg->length);
+            "image/gif",
+            gif->size(),
+            [gif](ostream& out) {
+                out.write((const char*)gif->data(), gif->size());
             }
         );
-    };
+    } else {
+        sendImage_(waitingRequest.httpRequest);
+    }
+
+    // The timeout of the next request starts only when it becomes the first
+    // one, as it will not get a new image before that anyway
+    if(!waitingRequests_.empty()) {
+        setSendTimeout_();
+    }
+}
+
+void ImageCompressor::sendTimeoutReached_() {
+    REQUIRE_UI_THREAD();
+
+    // If the image has not changed at all during the timeout, the client is
+    // likely showing a static page
+    if(!compressedImageUpdated_ && !imageUpdated_ && !compressionInProgress_) {
+        setSendTimeoutMs_(min(2 * sendTimeoutMs_, maxSendTimeoutMs_));
+    }
+    sendFirstWaitingRequest_();
+}
+
+void ImageCompressor::setSendTimeout_() {
+    REQUIRE_UI_THREAD();
+
+    shared_ptr<ImageCompressor> self = shared_from_this();
+    sendTimeout_->set([self]() {
+        self->sendTimeoutReached_();
+    });
+}
+
+void ImageCompressor::setSendTimeoutMs_(int64_t sendTimeoutMs) {
+    REQUIRE_UI_THREAD();
+
+    if(sendTimeoutMs == sendTimeoutMs_) {
+        return;
+    }
+    sendTimeoutMs_ = sendTimeoutMs;
+
+    // Restart the timeout of the first waiting request with the new delay
+    bool active = sendTimeout_->isActive();
+    sendTimeout_->clear(false);
+    sendTimeout_ = Timeout::create(sendTimeoutMs_);
+    if(active) {
+        setSendTimeout_();
+    }
 }
 
 void ImageCompressor::pump_() {
     if(compressionInProgress_ || !imageUpdated_ || compressedImageUpdated_) {
         return;
     }
+    if(bandwidthTimeout_ && bandwidthTimeout_->isActive()) {
+        return;
+    }
+    int64_t bandwidthDelayMs = max(
+        bandwidthLimiter_->delayMs(), globals->bandwidthLimiter->delayMs()
+    );
+    if(bandwidthDelayMs > 0) {
+        weak_ptr<ImageCompressor> selfWeak = shared_from_this();
+        bandwidthTimeout_ = Timeout::create(bandwidthDelayMs);
+        bandwidthTimeout_->set([selfWeak]() {
+            if(shared_ptr<ImageCompressor> self = selfWeak.lock()) {
+                self->pump_();
+            }
+        });
+        return;
+    }
+    if(frameIntervalTimeout_) {
+        if(frameIntervalTimeout_->isActive()) {
+            return;
+        }
+        weak_ptr<ImageCompressor> selfWeak = shared_from_this();
+        frameIntervalTimeout_->set([selfWeak]() {
+            if(shared_ptr<ImageCompressor> self = selfWeak.lock()) {
+                self->pump_();
+            }
+        });
+    }
 
     REQUIRE(!image_.isEmpty());
 
+    TRACE_SCOPE("ImageCompressor::pump_");
+
     compressionInProgress_ = true;
     imageUpdated_ = false;
 
+    if(
+        imageCopy_.width() != image_.width() ||
+        imageCopy_.height() != image_.height()
+    ) {
+        imageCopy_ = image_.clone();
+    } else if(!imageDamage_.isEmpty()) {
+        imageCopy_.putImage(
+            image_.subRect(
+                imageDamage_.startX, imageDamage_.endX,
+                imageDamage_.startY, imageDamage_.endY
+            ),
+            imageDamage_.startX,
+            imageDamage_.startY
+        );
+    }
+    imageDamage_ = Rect();
+
     int quality = quality_;
-    ImageSlice imageCopy = image_.clone();
+    uint64_t frameByteBudget = frameByteBudget_;
+    ImageSlice imageCopy = imageCopy_;
     shared_ptr<ImageCompressor> self = shared_from_this();
     shared_ptr<PNGCompressor> pngCompressor = pngCompressor_;
-    function<void()> compressTask = [quality, imageCopy, self, pngCompressor]() mutable {
+    shared_ptr<SessionMetrics> sessionMetrics = sessionMetrics_;
+    steady_clock::time_point imageUpdateTime = imageUpdateTime_;
+    steady_clock::time_point postTime = steady_clock::now();
+    function<void()> compressTask = [
+        quality, frameByteBudget, imageCopy, self, pngCompressor, sessionMetrics,
+        imageUpdateTime, postTime
+    ]() mutable {
+        TraceSessionScope traceSessionScope(sessionMetrics->sessionID);
+        recordTraceEvent(
+            "ImageCompressor queued",
+            sessionMetrics->sessionID,
+            postTime,
+            steady_clock::now()
+        );
+
+        uint64_t startCPUTime = threadCPUTimeNanoseconds();
+        compressCPUTimeAccounted = true;
+
         CompressedImage compressedImage;
         if(quality == MaxQuality) {
-            compressedImage = compressPNG_(imageCopy, pngCompressor);
+            compressedImage = compressPNG_(imageCopy, pngCompressor, sessionMetrics);
         } else {
-            compressedImage = compressJPEG_(imageCopy, quality);
+            compressedImage = compressJPEGWithinBudget_(
+                imageCopy, quality, frameByteBudget, sessionMetrics
+            );
         }
 
-        postTask(self, &ImageCompressor::compressTaskDone_, compressedImage);
+        compressCPUTimeAccounted = false;
+        sessionMetrics->compressCPUNanoseconds.add(
+            threadCPUTimeNanoseconds() - startCPUTime
+        );
+
+        postTask(
+            self,
+            &ImageCompressor::compressTaskDone_,
+            compressedImage,
+            imageUpdateTime
+        );
     };
 
     void (*call)(function<void()>) = [](function<void()> func) {
@@ -220,13 +707,73 @@ void ImageCompressor::pump_() {
     );
 }
 
-void ImageCompressor::compressTaskDone_(CompressedImage compressedImage) {
+void ImageCompressor::compressTaskDone_(
+    CompressedImage compressedImage,
+    steady_clock::time_point imageUpdateTime
+) {
     REQUIRE_UI_THREAD();
     REQUIRE(compressionInProgress_);
 
+    TraceSessionScope traceSessionScope(sessionMetrics_->sessionID);
+    TRACE_SCOPE("ImageCompressor::compressTaskDone_");
+
+    globals->metrics->frameLatency.observeSince(imageUpdateTime);
+    sessionMetrics_->framesCompressed.add();
+
     compressionInProgress_ = false;
     compressedImageUpdated_ = true;
     compressedImage_ = compressedImage;
+    compressedImageStreamed_ = false;
+
+    setSendTimeoutMs_(minSendTimeoutMs_);
+    if(!waitingRequests_.empty()) {
+        sendFirstWaitingRequest_();
+    }
+    sendToStream_();
+}
+
+void ImageCompressor::startStream_(shared_ptr<Stream> stream) {
+    REQUIRE_UI_THREAD();
+
+    stream_ = stream;
+    streamReady_ = true;
+    compressedImageStreamed_ = false;
+    sendToStream_();
+}
+
+void ImageCompressor::sendToStream_() {
+    REQUIRE_UI_THREAD();
+
+    if(!stream_ || !streamReady_ || compressedImageStreamed_) {
+        return;
+    }
+
+    if(compressedImage_.countInMetrics) {
+        sessionMetrics_->framesSent.add();
+        sessionMetrics_->imageBytesSent.add(compressedImage_.length);
+    }
+    stream_->push(compressedImage_);
+    streamReady_ = false;
+    compressedImageStreamed_ = true;
 
-    sendTimeout_->clear(true);
+    compressedImageUpdated_ = false;
+    pump_();
+}
+
+void ImageCompressor::streamPartWritten_(shared_ptr<Stream> stream) {
+    REQUIRE_UI_THREAD();
+
+    if(stream == stream_) {
+        streamReady_ = true;
+        sendToStream_();
+    }
+}
+
+void ImageCompressor::streamClosed_(shared_ptr<Stream> stream) {
+    REQUIRE_UI_THREAD();
+
+    if(stream == stream_) {
+        stream_.reset();
+        streamReady_ = false;
+    }
 }
@@ -1,7 +1,11 @@
 #include "image_slice.hpp"
+#include "rect.hpp"
 
+struct ClientProfile;
+class BandwidthLimiter;
 class HTTPRequest;
 class PNGCompressor;
+class SessionMetrics;
 class Timeout;
 
 class CefThread;
@@ -9,52 +13,175 @@ class CefThread;
 // Image compressor service for a single browser session. The image pipeline is
 // run asynchronously: raw images are fed in through updateImage, and compressed
 // images are written to HTTPRequest objects supplied through
-// sendCompressedImage*. At most one image is compressed at a time in a separate
-// thread. At most one HTTP request is kept open at a time; the previous
-// requests are responded to upon each sendImage* call.
+// sendCompressedImage* or pushed to a stream started by startStream or
+// startWebSocketStream.
+// At most one image is compressed at a time in a separate thread. At most
+// maxWaitingRequests HTTP requests are kept open at a time; they are answered
+// in the order they were received, each with the next compressed image (or the
+// latest image upon timeout), and the oldest request is responded to
+// immediately if a new one would exceed the limit.
+// The timeout of the waiting requests is adaptive: it starts at
+// minSendTimeoutMs and doubles (up to maxSendTimeoutMs) each time it is reached
+// without a new image, so that clients showing a static page poll less often.
+// It is reset to minSendTimeoutMs when a new image is compressed and upon
+// resetSendTimeout.
+// The image format, the initial quality and the limits for the frame rate and
+// the JPEG frame size are taken from the client profile. No compression is
+// started while the session bandwidth limiter or globals->bandwidthLimiter is
+// in debt, so that a throttled session gets a lower frame rate instead of
+// frames that are stale by the time they are sent.
 class ImageCompressor : public enable_shared_from_this<ImageCompressor> {
 SHARED_ONLY_CLASS(ImageCompressor);
 public:
-    ImageCompressor(CKey, int64_t sendTimeoutMs, bool allowPNG);
+    ImageCompressor(CKey,
+        int64_t minSendTimeoutMs,
+        int64_t maxSendTimeoutMs,
+        int maxWaitingRequests,
+        shared_ptr<const ClientProfile> clientProfile,
+        shared_ptr<BandwidthLimiter> bandwidthLimiter,
+        shared_ptr<SessionMetrics> sessionMetrics
+    );
     ~ImageCompressor();
 
     void setQuality(int quality);
 
     // The compressor may copy the image contents to be compressed from image
-    // later than this call in CEF UI thread. Image must be nonempty.
-    void updateImage(ImageSlice image);
-
-    // Send the most recent compressed image immediately
+    // later than this call in CEF UI thread. Image must be nonempty. The damage
+    // rectangle (in the coordinates of image) must contain all the pixels that
+    // have changed since the previous call; if the size of the image changes,
+    // the whole image is considered damaged.
+    void updateImage(ImageSlice image, Rect damage);
+
+    // Send the most recent compressed image immediately, after flushing the
+    // pending sendCompressedImageWait requests
     void sendCompressedImageNow(shared_ptr<HTTPRequest> httpRequest);
 
-    // Send the image once a new compressed image is available or the timeout
-    // sendTimeoutMs (given in constructor) is reached
-    void sendCompressedImageWait(shared_ptr<HTTPRequest> httpRequest);
+    // Send the image once a new compressed image is available and the requests
+    // received earlier have been responded to, or the timeout is reached while
+    // the request is the oldest one. If allowUnchanged is true and the most
+    // recent compressed image has already been sent when the request is
+    // responded to, a 1x1 GIF is sent instead to signal that the image has not
+    // changed.
+    void sendCompressedImageWait(
+        shared_ptr<HTTPRequest> httpRequest,
+        bool allowUnchanged = false
+    );
 
-    // Flush possible pending sendCompressedImageWait request with the latest
-    // image available immediately
+    // Flush all pending sendCompressedImageWait requests with the latest image
+    // available immediately
     void flush();
 
+    // Reset the timeout of the waiting requests to minSendTimeoutMs (given in
+    // constructor), e.g. upon user input that may soon change the image
+    void resetSendTimeout();
+
+    // Start sending the compressed images to httpRequest as the parts of a
+    // multipart/x-mixed-replace response, replacing the previous stream. The
+    // most recent compressed image is sent immediately; after that, each new
+    // compressed image is sent as soon as the previous one has been written to
+    // the connection, so that the frame rate is bounded by the bandwidth and
+    // the compression speed instead of the round trip time.
+    void startStream(shared_ptr<HTTPRequest> httpRequest);
+
+    // Like startStream, but upgrades httpRequest to a WebSocket connection and
+    // sends each compressed image as a binary message. The messages received
+    // from the client are passed to messageHandler in the UI thread.
+    void startWebSocketStream(
+        shared_ptr<HTTPRequest> httpRequest,
+        function<void(string)> messageHandler
+    );
+
+    // End the current stream, if any
+    void stopStream();
+
+    // Returns true if there is a stream whose connection has not failed
+    bool hasStream();
+
+    // Returns true if the latest image has been compressed and sent to the
+    // client (and written to the connection if a stream is active), i.e. a new
+    // image would not delay the previous ones
+    bool isIdle();
+
 private:
-    typedef function<void(shared_ptr<HTTPRequest>)> CompressedImage;
+    class Stream;
+
+    // Immutable compressed image data; the writer may be called from any thread
+    struct CompressedImage {
+        string contentType;
+        uint64_t length;
+        function<void(ostream&)> writer;
+
+        // False for the placeholder image shown before the first compression
+        bool countInMetrics;
+    };
 
     static CompressedImage compressPNG_(
         ImageSlice image,
-        shared_ptr<PNGCompressor> pngCompressor
+        shared_ptr<PNGCompressor> pngCompressor,
+        shared_ptr<SessionMetrics> sessionMetrics
     );
-    static CompressedImage compressJPEG_(
+    // Does not record metrics, see compressJPEGWithinBudget_
+    static CompressedImage compressJPEG_(ImageSlice image, int quality);
+
+    // Like compressJPEG_, but if the result is larger than frameByteBudget
+    // (if nonzero), the image is encoded once more with the quality lowered
+    // in proportion to the excess. The metrics are recorded once for the
+    // frame, including the time of both encodes.
+    static CompressedImage compressJPEGWithinBudget_(
         ImageSlice image,
-        int quality
+        int quality,
+        uint64_t frameByteBudget,
+        shared_ptr<SessionMetrics> sessionMetrics
     );
 
+    struct WaitingRequest {
+        shared_ptr<HTTPRequest> httpRequest;
+        steady_clock::time_point waitStartTime;
+        bool allowUnchanged;
+    };
+
+    void sendImage_(shared_ptr<HTTPRequest> httpRequest);
+    void sendFirstWaitingRequest_();
+    void sendTimeoutReached_();
+    void setSendTimeout_();
+    void setSendTimeoutMs_(int64_t sendTimeoutMs);
+
     void pump_();
-    void compressTaskDone_(CompressedImage compressedImage);
+    void compressTaskDone_(
+        CompressedImage compressedImage,
+        steady_clock::time_point imageUpdateTime
+    );
 
-    bool allowPNG_;
+    void startStream_(shared_ptr<Stream> stream);
+    void sendToStream_();
+    void streamPartWritten_(shared_ptr<Stream> stream);
+    void streamClosed_(shared_ptr<Stream> stream);
 
+    int64_t minSendTimeoutMs_;
+    int64_t maxSendTimeoutMs_;
+    int maxWaitingRequests_;
+    bool allowPNG_;
+    uint64_t frameByteBudget_;
+    shared_ptr<BandwidthLimiter> bandwidthLimiter_;
+    shared_ptr<SessionMetrics> sessionMetrics_;
+
+    // The timeout is active for the first waiting request if there is one. As
+    // the delay of a Timeout is fixed, sendTimeout_ is replaced when
+    // sendTimeoutMs_ changes.
+    queue<WaitingRequest> waitingRequests_;
+    int64_t sendTimeoutMs_;
     shared_ptr<Timeout> sendTimeout_;
     CefRefPtr<CefThread> compressorThread_;
 
+    // If the client profile limits the frame rate, the timeout is active for
+    // the minimum frame interval after a compression is started, and no new
+    // compression is started while it is active
+    shared_ptr<Timeout> frameIntervalTimeout_;
+
+    // Active while the compression is postponed due to bandwidth limits; as
+    // the delay varies, the timeout is replaced each time it is set
+    shared_ptr<Timeout> bandwidthTimeout_;
+
     int quality_;
 
     shared_ptr<PNGCompressor> pngCompressor_;
@@ -62,7 +189,25 @@ private:
     ImageSlice image_;
     CompressedImage compressedImage_;
 
+    // The copy of image_ passed to the compressor thread and the bounding box
+    // of the changes to image_ since it was last updated. As at most one image
+    // is compressed at a time, the copy can be updated in place between
+    // compressions, copying only the damaged area.
+    ImageSlice imageCopy_;
+    Rect imageDamage_;
+
+    // The time of the first image update after the previous compression
+    // started, used for latency metrics
+    steady_clock::time_point imageUpdateTime_;
+
     bool imageUpdated_;
     bool compressedImageUpdated_;
     bool compressionInProgress_;
+
+    // If streamReady_ is true, the stream is waiting for the next image.
+    // compressedImageStreamed_ is true if compressedImage_ has already been
+    // pushed to the stream.
+    shared_ptr<Stream> stream_;
+    bool streamReady_;
+    bool compressedImageStreamed_;
 };
@@ -1,5 +1,9 @@
+#include "client_profile.hpp"
 #include "globals.hpp"
+#include "renderer_app.hpp"
 #include "server.hpp"
+#include "synthetic_render.hpp"
+#include "trace.hpp"
 #include "xvfb.hpp"
 
 #include <csignal>
@@ -100,7 +104,7 @@ void handleTermSignalInApp(int signalID) {
 int main(int argc, char* argv[]) {
     CefMainArgs mainArgs(argc, argv);
 
-    int exitCode = CefExecuteProcess(mainArgs, nullptr, nullptr);
+    int exitCode = CefExecuteProcess(mainArgs, createSubprocessApp(), nullptr);
     if(exitCode >= 0) {
         return exitCode;
     }
@@ -113,6 +117,14 @@ int main(int argc, char* argv[]) {
         return 1;
     }
 
+    if(!initSyntheticRender(config->syntheticRender)) {
+        return 1;
+    }
+
+    if(!initClientProfiles(config->clientProfiles)) {
+        return 1;
+    }
+
     shared_ptr<Xvfb> xvfb;
     if(config->useDedicatedXvfb) {
         xvfb = Xvfb::create();
@@ -120,6 +132,7 @@ int main(int argc, char* argv[]) {
     }
 
     globals = Globals::create(config);
+    setTracingEnabled(config->tracing);
 
     if(!termSignalReceived) {
         // Ignore non-fatal X errors
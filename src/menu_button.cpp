@@ -58,6 +58,10 @@ void MenuButton::widgetRender_() {
     }
 }
 
+bool MenuButton::widgetIsOpaque_() {
+    return true;
+}
+
 void MenuButton::widgetMouseDownEvent_(int x, int y, int button) {
     REQUIRE_UI_THREAD();
 
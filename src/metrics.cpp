@@ -0,0 +1,282 @@
+#include "metrics.hpp"
+
+#include <time.h>
+#include <unistd.h>
+
+namespace {
+
+atomic<uint64_t> nextSessionIndex(1);
+
+vector<double> timeBounds() {
+    return {
+        0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1.0, 2.5, 5.0,
+        10.0
+    };
+}
+
+vector<double> sizeBounds() {
+    return {
+        1024.0, 4096.0, 16384.0, 65536.0, 262144.0, 1048576.0, 4194304.0
+    };
+}
+
+void writeHeader(ostream& out, const char* name, const char* type, const char* help) {
+    out << "# HELP " << name << " " << help << "\n";
+    out << "# TYPE " << name << " " << type << "\n";
+}
+
+void writeHistogram(
+    ostream& out,
+    const char* name,
+    const char* help,
+    const MetricHistogram& histogram
+) {
+    writeHeader(out, name, "histogram", help);
+    histogram.write(out, name, "");
+}
+
+}
+
+uint64_t threadCPUTimeNanoseconds() {
+    timespec ts;
+    REQUIRE(clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) == 0);
+    return (uint64_t)ts.tv_sec * (uint64_t)1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+optional<double> readProcessCPUSeconds(int pid) {
+    optional<double> empty;
+
+    ifstream fp("/proc/" + toString(pid) + "/stat");
+    string stat;
+    if(!getline(fp, stat)) {
+        return empty;
+    }
+
+    // The process name in the second field may contain spaces and
+    // parentheses, so we start parsing after the last closing parenthesis.
+    size_t nameEnd = stat.rfind(')');
+    if(nameEnd == string::npos) {
+        return empty;
+    }
+    stringstream ss(stat.substr(nameEnd + 1));
+
+    // Skip fields 3-13 to get utime and stime (fields 14 and 15)
+    string field;
+    for(int i = 3; i <= 13; ++i) {
+        ss >> field;
+    }
+    uint64_t utime, stime;
+    ss >> utime >> stime;
+    if(ss.fail()) {
+        return empty;
+    }
+
+    long ticksPerSecond = sysconf(_SC_CLK_TCK);
+    if(ticksPerSecond <= 0) {
+        return empty;
+    }
+    return (double)(utime + stime) / (double)ticksPerSecond;
+}
+
+MetricHistogram::MetricHistogram(vector<double> bounds)
+    : bounds_(move(bounds)),
+      buckets_(new atomic<uint64_t>[bounds_.size() + 1]),
+      sum_(0.0)
+{
+    for(size_t i = 0; i <= bounds_.size(); ++i) {
+        buckets_[i].store(0, memory_order_relaxed);
+    }
+}
+
+void MetricHistogram::observe(double value) {
+    size_t bucket =
+        std::lower_bound(bounds_.begin(), bounds_.end(), value) - bounds_.begin();
+    buckets_[bucket].fetch_add(1, memory_order_relaxed);
+
+    double sum = sum_.load(memory_order_relaxed);
+    while(!sum_.compare_exchange_weak(sum, sum + value, memory_order_relaxed)) {}
+}
+
+void MetricHistogram::observeDuration(steady_clock::duration duration) {
+    observe(std::chrono::duration<double>(duration).count());
+}
+
+void MetricHistogram::observeSince(steady_clock::time_point startTime) {
+    observeDuration(steady_clock::now() - startTime);
+}
+
+void MetricHistogram::write(
+    ostream& out,
+    const string& name,
+    const string& labels
+) const {
+    string prefix = labels.empty() ? "" : labels + ",";
+
+    uint64_t cumulative = 0;
+    for(size_t i = 0; i <= bounds_.size(); ++i) {
+        cumulative += buckets_[i].load(memory_order_relaxed);
+        out << name << "_bucket{" << prefix << "le=\"";
+        if(i < bounds_.size()) {
+            out << bounds_[i];
+        } else {
+            out << "+Inf";
+        }
+        out << "\"} " << cumulative << "\n";
+    }
+
+    string labelStr = labels.empty() ? "" : "{" + labels + "}";
+    std::streamsize oldPrecision = out.precision(15);
+    out << name << "_sum" << labelStr << " " << sum_.load(memory_order_relaxed) << "\n";
+    out.precision(oldPrecision);
+    out << name << "_count" << labelStr << " " << cumulative << "\n";
+}
+
+Metrics::Metrics(CKey)
+    : frameLatency(timeBounds()),
+      pngEncodeTime(timeBounds()),
+      jpegEncodeTime(timeBounds()),
+      pngEncodeSize(sizeBounds()),
+      jpegEncodeSize(sizeBounds()),
+      httpRequestTime(timeBounds()),
+      longPollWaitTime(timeBounds()),
+      uiTaskLag(timeBounds()),
+      uiTasksPending(0)
+{}
+
+void Metrics::write(ostream& out) {
+    writeHistogram(
+        out, "browservice_frame_latency_seconds",
+        "Time from a viewport update to the compressed image being ready.",
+        frameLatency
+    );
+
+    writeHeader(
+        out, "browservice_encode_seconds", "histogram",
+        "Time spent compressing a single image, including the second JPEG encode of frames over the byte budget."
+    );
+    pngEncodeTime.write(out, "browservice_encode_seconds", "format=\"png\"");
+    jpegEncodeTime.write(out, "browservice_encode_seconds", "format=\"jpeg\"");
+
+    writeHeader(
+        out, "browservice_encode_bytes", "histogram",
+        "Size of a single compressed image."
+    );
+    pngEncodeSize.write(out, "browservice_encode_bytes", "format=\"png\"");
+    jpegEncodeSize.write(out, "browservice_encode_bytes", "format=\"jpeg\"");
+
+    writeHistogram(
+        out, "browservice_http_request_seconds",
+        "Time from receiving an HTTP request to having written the response.",
+        httpRequestTime
+    );
+    writeHistogram(
+        out, "browservice_long_poll_wait_seconds",
+        "Time an image request waits for a new image.",
+        longPollWaitTime
+    );
+    writeHistogram(
+        out, "browservice_ui_task_lag_seconds",
+        "Time between posting a task to the UI thread and running it.",
+        uiTaskLag
+    );
+
+    writeHeader(
+        out, "browservice_ui_tasks_pending", "gauge",
+        "Number of tasks posted to the UI thread that have not been run yet."
+    );
+    out << "browservice_ui_tasks_pending "
+        << uiTasksPending.load(memory_order_relaxed) << "\n";
+
+    writeHeader(
+        out, "browservice_sessions_opened_total", "counter",
+        "Number of sessions opened since startup."
+    );
+    out << "browservice_sessions_opened_total " << sessionsOpened.value() << "\n";
+}
+
+SessionMetrics::SessionMetrics(CKey, uint64_t sessionID)
+    : sessionID(sessionID),
+      sessionIndex(nextSessionIndex.fetch_add(1, memory_order_relaxed)),
+      lastImageBytes(0),
+      lastEncodeMicroseconds(0),
+      rendererPID(0)
+{}
+
+void SessionMetrics::writeAll(
+    ostream& out,
+    const vector<shared_ptr<SessionMetrics>>& sessions
+) {
+    writeHeader(
+        out, "browservice_sessions", "gauge", "Number of open sessions."
+    );
+    out << "browservice_sessions " << sessions.size() << "\n";
+
+    auto writeCounter = [&](
+        const char* name,
+        const char* help,
+        MetricCounter SessionMetrics::*counter
+    ) {
+        writeHeader(out, name, "counter", help);
+        for(const shared_ptr<SessionMetrics>& session : sessions) {
+            out << name << "{session=\"" << session->sessionIndex << "\"} "
+                << ((*session).*counter).value() << "\n";
+        }
+    };
+
+    writeCounter(
+        "browservice_session_frames_compressed_total",
+        "Number of images compressed for the session.",
+        &SessionMetrics::framesCompressed
+    );
+    writeCounter(
+        "browservice_session_frames_sent_total",
+        "Number of images sent to the session client.",
+        &SessionMetrics::framesSent
+    );
+    writeCounter(
+        "browservice_session_image_bytes_sent_total",
+        "Number of compressed image bytes sent to the session client.",
+        &SessionMetrics::imageBytesSent
+    );
+    writeCounter(
+        "browservice_session_http_requests_total",
+        "Number of HTTP requests handled by the session.",
+        &SessionMetrics::httpRequests
+    );
+    writeCounter(
+        "browservice_session_events_total",
+        "Number of input events processed by the session.",
+        &SessionMetrics::events
+    );
+
+    std::streamsize oldPrecision = out.precision(15);
+
+    writeHeader(
+        out, "browservice_session_compress_cpu_seconds_total", "counter",
+        "CPU time spent in compressing images for the session."
+    );
+    for(const shared_ptr<SessionMetrics>& session : sessions) {
+        out << "browservice_session_compress_cpu_seconds_total{session=\""
+            << session->sessionIndex << "\"} "
+            << (double)session->compressCPUNanoseconds.value() / 1e9 << "\n";
+    }
+
+    writeHeader(
+        out, "browservice_session_renderer_cpu_seconds_total", "counter",
+        "CPU time used by the renderer process of the main frame of the session (may be shared by multiple sessions)."
+    );
+    for(const shared_ptr<SessionMetrics>& session : sessions) {
+        int pid = session->rendererPID.load();
+        if(pid == 0) {
+            continue;
+        }
+        optional<double> cpuSeconds = readProcessCPUSeconds(pid);
+        if(cpuSeconds) {
+            out << "browservice_session_renderer_cpu_seconds_total{session=\""
+                << session->sessionIndex << "\",pid=\"" << pid << "\"} "
+                << *cpuSeconds << "\n";
+        }
+    }
+
+    out.precision(oldPrecision);
+}
@@ -0,0 +1,126 @@
+#pragma once
+
+#include "common.hpp"
+
+// Lock-free monotonic counter that may be updated from any thread
+class MetricCounter {
+public:
+    MetricCounter() : value_(0) {}
+    DISABLE_COPY_MOVE(MetricCounter);
+
+    void add(uint64_t amount = 1) {
+        value_.fetch_add(amount, memory_order_relaxed);
+    }
+
+    uint64_t value() const {
+        return value_.load(memory_order_relaxed);
+    }
+
+private:
+    atomic<uint64_t> value_;
+};
+
+// Lock-free histogram with fixed bucket upper bounds that may be updated from
+// any thread. Written in the Prometheus text exposition format, i.e. with
+// cumulative buckets.
+class MetricHistogram {
+public:
+    // The bucket upper bounds must be given in increasing order
+    MetricHistogram(vector<double> bounds);
+    DISABLE_COPY_MOVE(MetricHistogram);
+
+    void observe(double value);
+
+    // Observe the duration in seconds
+    void observeDuration(steady_clock::duration duration);
+    void observeSince(steady_clock::time_point startTime);
+
+    // Write the samples of this histogram without HELP and TYPE lines; labels
+    // is either empty or a comma separated list of label="value" pairs
+    void write(ostream& out, const string& name, const string& labels) const;
+
+private:
+    vector<double> bounds_;
+
+    // bounds_.size() + 1 non-cumulative buckets, the last one being +Inf
+    unique_ptr<atomic<uint64_t>[]> buckets_;
+    atomic<double> sum_;
+};
+
+// Returns the CPU time used by the calling thread so far in nanoseconds
+uint64_t threadCPUTimeNanoseconds();
+
+// Returns the total user and system CPU time used by given process in seconds
+// read from /proc/PID/stat, or empty if the process does not exist
+optional<double> readProcessCPUSeconds(int pid);
+
+// Global metrics of the whole process, available through globals->metrics.
+class Metrics {
+SHARED_ONLY_CLASS(Metrics);
+public:
+    Metrics(CKey);
+
+    // Time from a viewport update (such as a paint from CEF) to the compressed
+    // image being ready to be sent
+    MetricHistogram frameLatency;
+
+    MetricHistogram pngEncodeTime;
+    MetricHistogram jpegEncodeTime;
+    MetricHistogram pngEncodeSize;
+    MetricHistogram jpegEncodeSize;
+
+    // Time from receiving an HTTP request to having written the response
+    MetricHistogram httpRequestTime;
+
+    // Time an image request is kept waiting for a new image
+    MetricHistogram longPollWaitTime;
+
+    // Time between posting a task to the CEF UI thread and running it
+    MetricHistogram uiTaskLag;
+    atomic<int64_t> uiTasksPending;
+
+    MetricCounter sessionsOpened;
+
+    // Write the global metrics in the Prometheus text exposition format
+    void write(ostream& out);
+};
+
+// Per-session counters, written by Server for all the open sessions.
+class SessionMetrics {
+SHARED_ONLY_CLASS(SessionMetrics);
+public:
+    SessionMetrics(CKey, uint64_t sessionID);
+
+    const uint64_t sessionID;
+
+    // Sequential number of the session starting from 1. As anyone who knows
+    // the session ID can control the session, the session is identified by
+    // this index instead of the ID in the exported metrics.
+    const uint64_t sessionIndex;
+
+    MetricCounter framesCompressed;
+    MetricCounter framesSent;
+    MetricCounter imageBytesSent;
+    MetricCounter httpRequests;
+    MetricCounter events;
+
+    // Size and compression time of the latest compressed image
+    atomic<uint64_t> lastImageBytes;
+    atomic<uint64_t> lastEncodeMicroseconds;
+
+    // CPU time spent in compressing images for the session, including the PNG
+    // compression worker threads
+    MetricCounter compressCPUNanoseconds;
+
+    // Process ID of the Chromium renderer process of the main frame of the
+    // session, or 0 if not known yet. Note that a renderer process may be
+    // shared by multiple sessions.
+    atomic<int> rendererPID;
+
+    // Write the metrics of all the given sessions in the Prometheus text
+    // exposition format
+    static void writeAll(
+        ostream& out,
+        const vector<shared_ptr<SessionMetrics>>& sessions
+    );
+};
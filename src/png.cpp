@@ -117,7 +117,11 @@ private:
     uint32_t crc32_;
 };
 
-struct Result;
+struct Result {
+    size_t uncompressedBytes;
+    uint32_t adler32;
+    std::vector<uint8_t> chunk;
+};
 
 struct JobData {
     const uint8_t* image;
@@ -126,21 +130,18 @@ struct JobData {
     size_t startY;
     size_t endY;
     bool endStream;
+    const PNGCompressor::StripRunner* stripRunner;
 };
 
 struct Job {
     bool shutdown;
     std::promise<Result> resultPromise;
-    std::future<Job> nextJobFuture;
+    // Held through a pointer because Job is incomplete at this point, which
+    // std::future does not allow
+    std::unique_ptr<std::future<Job>> nextJobFuture;
     JobData data;
 };
 
-struct Result {
-    size_t uncompressedBytes;
-    uint32_t adler32;
-    std::vector<uint8_t> chunk;
-};
-
 struct Worker {
     std::thread thread;
     std::promise<Job> jobPromise;
@@ -286,14 +287,26 @@ Result runJob(JobData jobData) {
     return {uncompressedBytes, adler32, std::move(chunk)};
 }
 
+Result runJobWithStripRunner(JobData jobData) {
+    if(jobData.stripRunner != nullptr && *jobData.stripRunner) {
+        Result result;
+        (*jobData.stripRunner)([&]() {
+            result = runJob(jobData);
+        });
+        return result;
+    } else {
+        return runJob(jobData);
+    }
+}
+
 void workerThread(std::future<Job> jobFuture) {
     while(true) {
         Job job = jobFuture.get();
         if(job.shutdown) {
             break;
         }
-        jobFuture = std::move(job.nextJobFuture);
-        job.resultPromise.set_value(runJob(std::move(job.data)));
+        jobFuture = std::move(*job.nextJobFuture);
+        job.resultPromise.set_value(runJobWithStripRunner(std::move(job.data)));
     }
 }
 
@@ -311,8 +324,11 @@ public:
         size_t pitch
     );
 
+    void setStripRunner(StripRunner stripRunner);
+
 private:
     std::vector<Worker> workers_;
+    StripRunner stripRunner_;
 };
 
 PNGCompressor::Impl::Impl(size_t threadCount) {
@@ -354,6 +370,7 @@ std::vector<std::vector<uint8_t>> PNGCompressor::Impl::compress(
         jobData.startY = height * i / threadCount;
         jobData.endY = height * (i + 1) / threadCount;
         jobData.endStream = i + 1 == threadCount;
+        jobData.stripRunner = &stripRunner_;
     }
 
     std::vector<std::future<Result>> resultFutures(threadCount - 1);
@@ -362,7 +379,8 @@ std::vector<std::vector<uint8_t>> PNGCompressor::Impl::compress(
         Job job;
         job.shutdown = false;
         resultFutures[i - 1] = job.resultPromise.get_future();
-        job.nextJobFuture = nextJobPromise.get_future();
+        job.nextJobFuture =
+            std::make_unique<std::future<Job>>(nextJobPromise.get_future());
         job.data = std::move(jobDatas[i]);
 
         workers_[i - 1].jobPromise.set_value(std::move(job));
@@ -370,7 +388,7 @@ std::vector<std::vector<uint8_t>> PNGCompressor::Impl::compress(
     }
 
     std::vector<Result> results(threadCount);
-    results[0] = runJob(std::move(jobDatas[0]));
+    results[0] = runJobWithStripRunner(std::move(jobDatas[0]));
     for(size_t i = 1; i < threadCount; ++i) {
         results[i] = resultFutures[i - 1].get();
     }
@@ -436,6 +454,10 @@ std::vector<std::vector<uint8_t>> PNGCompressor::Impl::compress(
     return chunks;
 }
 
+void PNGCompressor::Impl::setStripRunner(StripRunner stripRunner) {
+    stripRunner_ = std::move(stripRunner);
+}
+
 PNGCompressor::PNGCompressor(size_t threadCount)
     : impl_(new Impl(threadCount))
 {}
@@ -450,3 +472,7 @@ std::vector<std::vector<uint8_t>> PNGCompressor::compress(
 ) {
     return impl_->compress(image, width, height, pitch);
 }
+
+void PNGCompressor::setStripRunner(StripRunner stripRunner) {
+    impl_->setStripRunner(std::move(stripRunner));
+}
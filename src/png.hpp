@@ -25,6 +25,7 @@ SOFTWARE.
 #pragma once
 
 #include <cstdint>
+#include <functional>
 #include <memory>
 #include <vector>
 
@@ -48,6 +49,14 @@ public:
         size_t pitch
     );
 
+    // Optionally set a function that is used to run the compression of each
+    // horizontal strip of the image, possibly in a worker thread. The function
+    // must call the given function exactly once; this can be used to measure
+    // the time spent compressing each strip. Should not be called concurrently
+    // with compress.
+    typedef std::function<void(const std::function<void()>&)> StripRunner;
+    void setStripRunner(StripRunner stripRunner);
+
 private:
     class Impl;
     std::unique_ptr<Impl> impl_;
@@ -8,9 +8,6 @@
 constexpr int MinQuality = 10;
 constexpr int MaxQuality = 101;
 
-bool hasPNGSupport(string userAgent);
-
-// Adjusted values for globals->config->defaultQuality and MaxQuality taking
-// into account the possibility of disabling PNG
-int getDefaultQuality(bool allowPNG);
+// Adjusted value for MaxQuality taking into account the possibility of
+// disabling PNG (see ClientProfile)
 int getMaxQuality(bool allowPNG);
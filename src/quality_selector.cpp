@@ -8,7 +8,8 @@
 QualitySelector::QualitySelector(CKey,
     weak_ptr<WidgetParent> widgetParent,
     weak_ptr<QualitySelectorEventHandler> eventHandler,
-    bool allowPNG
+    bool allowPNG,
+    int defaultQuality
 )
     : Widget(widgetParent)
 {
@@ -21,7 +22,11 @@ QualitySelector::QualitySelector(CKey,
     longMouseRepeatTimeout_ = Timeout::create(500);
     shortMouseRepeatTimeout_ = Timeout::create(50);
 
-    quality_ = getDefaultQuality(allowPNG);
+    REQUIRE(
+        defaultQuality >= MinQuality &&
+        defaultQuality <= getMaxQuality(allowPNG)
+    );
+    quality_ = defaultQuality;
 
     hasFocus_ = false;
     upKeyPressed_ = false;
@@ -188,6 +193,10 @@ void QualitySelector::widgetRender_() {
     drawButton(11, false, downKeyPressed_ || downButtonPressed_, quality_ > MinQuality);
 }
 
+bool QualitySelector::widgetIsOpaque_() {
+    return true;
+}
+
 vector<shared_ptr<Widget>> QualitySelector::widgetListChildren_() {
     REQUIRE_UI_THREAD();
     return {textField_};
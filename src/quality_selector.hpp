@@ -21,7 +21,8 @@ public:
     QualitySelector(CKey,
         weak_ptr<WidgetParent> widgetParent,
         weak_ptr<QualitySelectorEventHandler> eventHandler,
-        bool allowPNG
+        bool allowPNG,
+        int defaultQuality
     );
 
     // TextFieldEventHandler:
@@ -44,6 +45,7 @@ private:
     // Widget:
     virtual void widgetViewportUpdated_() override;
     virtual void widgetRender_() override;
+    virtual bool widgetIsOpaque_() override;
     virtual vector<shared_ptr<Widget>> widgetListChildren_() override;
     virtual void widgetMouseDownEvent_(int x, int y, int button) override;
     virtual void widgetMouseUpEvent_(int x, int y, int button) override;
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstdint>
+
+// File format of the session recordings written when the --record-dir option
+// is set (see session_recorder.hpp) and read by bench/session_replay.cpp. This
+// header does not depend on the rest of the program so that the replay tool can
+// be built without CEF.
+//
+// The file consists of a FileHeader followed by records until the end of the
+// file. Each record consists of a RecordHeader and payloadSize bytes of
+// payload, padded with zeros to a multiple of 8 bytes. All integers are in the
+// native byte order and all structures are 8-byte aligned within the file, so a
+// memory-mapped recording can be read in place.
+//
+// Frame record payload: FramePayload, followed by rectCount Rects, followed by
+// the pixels of each rect in order (BGRA, 4 * width * height bytes per rect,
+// rows without padding). The rects of a frame cover the changes since the
+// previous frame; the first frame and frames with a changed size cover the
+// whole frame.
+//
+// Event record payload: the event as it appeared in the request path (for
+// example "MDN_10_20_0", or "DA_-5_0" in the compact encoding described in
+// src/event.cpp), without terminator.
+namespace recording {
+
+constexpr char Magic[8] = {'B', 'S', 'R', 'E', 'C', '0', '0', '1'};
+
+enum RecordType : uint32_t {
+    FrameRecord = 1,
+    EventRecord = 2
+};
+
+struct FileHeader {
+    char magic[8];
+    uint64_t sessionID;
+    // Start time of the recording as microseconds since the Unix epoch
+    uint64_t startTime;
+};
+
+struct RecordHeader {
+    uint32_t type;
+    uint32_t payloadSize;
+    // Microseconds since the start of the recording
+    uint64_t time;
+};
+
+struct FramePayload {
+    uint32_t width;
+    uint32_t height;
+    uint32_t rectCount;
+    uint32_t reserved;
+};
+
+struct Rect {
+    int32_t x;
+    int32_t y;
+    int32_t width;
+    int32_t height;
+};
+
+inline uint64_t paddedSize(uint64_t size) {
+    return (size + 7) & ~(uint64_t)7;
+}
+
+}
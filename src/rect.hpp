@@ -51,4 +51,21 @@ struct Rect {
             min(rect1.endY, rect2.endY)
         );
     }
+
+    // The smallest rectangle containing both rectangles; empty rectangles are
+    // ignored
+    static Rect boundingBox(Rect rect1, Rect rect2) {
+        if(rect1.isEmpty()) {
+            return rect2;
+        }
+        if(rect2.isEmpty()) {
+            return rect1;
+        }
+        return Rect(
+            min(rect1.startX, rect2.startX),
+            max(rect1.endX, rect2.endX),
+            min(rect1.startY, rect2.startY),
+            max(rect1.endY, rect2.endY)
+        );
+    }
 };
@@ -0,0 +1,62 @@
+#include "renderer_app.hpp"
+
+#include <unistd.h>
+
+#include "include/cef_app.h"
+
+namespace {
+
+const char* RendererPIDMessageName = "BrowserviceRendererPID";
+
+class SubprocessApp :
+    public CefApp,
+    public CefRenderProcessHandler
+{
+public:
+    // CefApp:
+    virtual CefRefPtr<CefRenderProcessHandler> GetRenderProcessHandler() override {
+        return this;
+    }
+
+    // CefRenderProcessHandler:
+    virtual void OnContextCreated(
+        CefRefPtr<CefBrowser> browser,
+        CefRefPtr<CefFrame> frame,
+        CefRefPtr<CefV8Context> context
+    ) override {
+        if(!frame->IsMain()) {
+            return;
+        }
+
+        CefRefPtr<CefProcessMessage> message =
+            CefProcessMessage::Create(RendererPIDMessageName);
+        message->GetArgumentList()->SetInt(0, (int)getpid());
+        frame->SendProcessMessage(PID_BROWSER, message);
+    }
+
+private:
+    IMPLEMENT_REFCOUNTING(SubprocessApp);
+};
+
+}
+
+CefRefPtr<CefApp> createSubprocessApp() {
+    return new SubprocessApp;
+}
+
+optional<int> readRendererPIDMessage(CefRefPtr<CefProcessMessage> message) {
+    optional<int> empty;
+
+    if(message->GetName().ToString() != RendererPIDMessageName) {
+        return empty;
+    }
+    CefRefPtr<CefListValue> args = message->GetArgumentList();
+    if(args->GetSize() != 1) {
+        return empty;
+    }
+    int pid = args->GetInt(0);
+    if(pid <= 0) {
+        return empty;
+    }
+    return pid;
+}
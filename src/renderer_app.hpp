@@ -0,0 +1,17 @@
+#pragma once
+
+#include "common.hpp"
+
+class CefApp;
+class CefProcessMessage;
+
+// Create the CefApp for the subprocesses started by CEF, passed to
+// CefExecuteProcess. In renderer processes, the app reports the process ID of
+// the renderer to the browser process using a process message every time a
+// JavaScript context is created for a main frame; the message can be read
+// using readRendererPIDMessage.
+CefRefPtr<CefApp> createSubprocessApp();
+
+// If message is a process ID report sent by the app created by
+// createSubprocessApp, return the reported process ID
+optional<int> readRendererPIDMessage(CefRefPtr<CefProcessMessage> message);
@@ -7,13 +7,15 @@ RootWidget::RootWidget(CKey,
     weak_ptr<WidgetParent> widgetParent,
     weak_ptr<ControlBarEventHandler> controlBarEventHandler,
     weak_ptr<BrowserAreaEventHandler> browserAreaEventHandler,
-    bool allowPNG
+    bool allowPNG,
+    int defaultQuality
 )
     : Widget(widgetParent)
 {
     REQUIRE_UI_THREAD();
 
     allowPNG_ = allowPNG;
+    defaultQuality_ = defaultQuality;
 
     controlBarEventHandler_ = controlBarEventHandler;
     browserAreaEventHandler_ = browserAreaEventHandler;
@@ -32,7 +34,9 @@ shared_ptr<BrowserArea> RootWidget::browserArea() {
 }
 
 void RootWidget::afterConstruct_(shared_ptr<RootWidget> self) {
-    controlBar_ = ControlBar::create(self, controlBarEventHandler_, allowPNG_);
+    controlBar_ = ControlBar::create(
+        self, controlBarEventHandler_, allowPNG_, defaultQuality_
+    );
     browserArea_ = BrowserArea::create(self, browserAreaEventHandler_);
 
     controlBarEventHandler_.reset();
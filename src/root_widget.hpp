@@ -14,7 +14,8 @@ public:
         weak_ptr<WidgetParent> widgetParent,
         weak_ptr<ControlBarEventHandler> controlBarEventHandler,
         weak_ptr<BrowserAreaEventHandler> browserAreaEventHandler,
-        bool allowPNG
+        bool allowPNG,
+        int defaultQuality
     );
 
     shared_ptr<ControlBar> controlBar();
@@ -28,6 +29,7 @@ private:
     virtual vector<shared_ptr<Widget>> widgetListChildren_() override;
 
     bool allowPNG_;
+    int defaultQuality_;
 
     weak_ptr<ControlBarEventHandler> controlBarEventHandler_;
     weak_ptr<BrowserAreaEventHandler> browserAreaEventHandler_;
@@ -1,13 +1,18 @@
 #include "server.hpp"
 
+#include "bandwidth_limiter.hpp"
+#include "client_profile.hpp"
 #include "globals.hpp"
 #include "html.hpp"
-#include "quality.hpp"
+#include "metrics.hpp"
+#include "trace.hpp"
+#include "ui_lag_monitor.hpp"
 #include "xwindow.hpp"
 
 namespace {
 
 regex sessionPathRegex("/([0-9]+)/.*");
+regex tracePathRegex("/trace/([0-9]+)");
 
 string htmlEscapeString(string src) {
     string ret;
@@ -29,12 +34,35 @@ string htmlEscapeString(string src) {
     return ret;
 }
 
+string generateAdminToken() {
+    random_device rng;
+    uniform_int_distribution<int> dist(0, 15);
+    string token;
+    for(int i = 0; i < 32; ++i) {
+        token.push_back("0123456789abcdef"[dist(rng)]);
+    }
+    return token;
+}
+
+void sendUnauthorizedResponse(shared_ptr<HTTPRequest> request, string realm) {
+    request->sendTextResponse(
+        401,
+        "Unauthorized",
+        true,
+        {{
+            "WWW-Authenticate",
+            "Basic realm=\"" + realm + "\", charset=\"UTF-8\""
+        }}
+    );
+}
+
 }
 
 Server::Server(CKey, weak_ptr<ServerEventHandler> eventHandler) {
     REQUIRE_UI_THREAD();
     eventHandler_ = eventHandler;
     state_ = Running;
+    adminToken_ = generateAdminToken();
     // Setup is finished in afterConstruct_
 }
 
@@ -57,18 +85,20 @@ void Server::shutdown() {
 void Server::onHTTPServerRequest(shared_ptr<HTTPRequest> request) {
     REQUIRE_UI_THREAD();
 
+    // The admin page has its own credentials that replace --http-auth, and it
+    // does not exist unless they are configured
+    if(
+        !globals->config->adminAuth.empty() &&
+        request->path() == "/admin/sessions/"
+    ) {
+        handleAdminSessionsRequest_(request);
+        return;
+    }
+
     if(!globals->config->httpAuth.empty()) {
         optional<string> credentials = request->getBasicAuthCredentials();
         if(!credentials || *credentials != globals->config->httpAuth) {
-            request->sendTextResponse(
-                401,
-                "Unauthorized",
-                true,
-                {{
-                    "WWW-Authenticate",
-                    "Basic realm=\"Browservice\", charset=\"UTF-8\""
-                }}
-            );
+            sendUnauthorizedResponse(request, "Browservice");
             return;
         }
     }
@@ -83,7 +113,7 @@ void Server::onHTTPServerRequest(shared_ptr<HTTPRequest> request) {
             );
         } else {
             shared_ptr<Session> session = Session::create(
-                shared_from_this(), hasPNGSupport(request->userAgent())
+                shared_from_this(), getClientProfile(request->userAgent())
             );
             sessions_[session->id()] = session;
 
@@ -92,6 +122,23 @@ void Server::onHTTPServerRequest(shared_ptr<HTTPRequest> request) {
         return;
     }
 
+    if(method == "GET" && path == "/metrics") {
+        handleMetricsRequest_(request);
+        return;
+    }
+
+    smatch traceMatch;
+    if(method == "GET" && regex_match(path, traceMatch, tracePathRegex)) {
+        REQUIRE(traceMatch.size() == 2);
+        optional<uint64_t> sessionID = parseString<uint64_t>(traceMatch[1]);
+        if(!sessionID || *sessionID == 0) {
+            request->sendTextResponse(400, "ERROR: Invalid session ID");
+            return;
+        }
+        handleTraceRequest_(request, *sessionID);
+        return;
+    }
+
     if(path == "/clipboard/") {
         handleClipboardRequest_(request);
         return;
@@ -202,6 +249,143 @@ void Server::handleClipboardRequest_(shared_ptr<HTTPRequest> request) {
     }
 }
 
+void Server::handleAdminSessionsRequest_(shared_ptr<HTTPRequest> request) {
+    optional<string> credentials = request->getBasicAuthCredentials();
+    if(!credentials || *credentials != globals->config->adminAuth) {
+        sendUnauthorizedResponse(request, "Browservice admin");
+        return;
+    }
+
+    string method = request->method();
+    if(method == "POST") {
+        // The browser sends the credentials automatically, so we also require
+        // the token embedded in the page to prevent cross-site requests
+        if(request->getFormParam("token") != adminToken_) {
+            request->sendTextResponse(403, "ERROR: Invalid admin token");
+            return;
+        }
+
+        // The sessions are referred to by their indices, as the page should
+        // not reveal the secret session IDs
+        optional<uint64_t> closeIndex =
+            parseString<uint64_t>(request->getFormParam("close"));
+        if(closeIndex) {
+            for(pair<uint64_t, shared_ptr<Session>> p : sessions_) {
+                if(p.second->metrics()->sessionIndex == *closeIndex) {
+                    INFO_LOG("Closing session ", p.first, " by admin request");
+                    p.second->close();
+                    break;
+                }
+            }
+        }
+    } else if(method != "GET") {
+        request->sendTextResponse(400, "ERROR: Invalid request method");
+        return;
+    }
+
+    stringstream rows;
+    rows.setf(std::ios_base::fixed, std::ios_base::floatfield);
+    rows.precision(2);
+    for(pair<uint64_t, shared_ptr<Session>> p : sessions_) {
+        shared_ptr<SessionMetrics> metrics = p.second->metrics();
+        shared_ptr<BandwidthLimiter> bandwidthLimiter = p.second->bandwidthLimiter();
+        int pid = metrics->rendererPID.load();
+        optional<double> rendererCPU;
+        if(pid != 0) {
+            rendererCPU = readProcessCPUSeconds(pid);
+        }
+
+        rows << "<tr><td>" << metrics->sessionIndex << "</td><td>";
+        if(pid != 0) {
+            rows << pid;
+        }
+        rows << "</td><td>";
+        if(rendererCPU) {
+            rows << *rendererCPU;
+        }
+        rows << "</td><td>";
+        rows << (double)metrics->compressCPUNanoseconds.value() / 1e9;
+        rows << "</td><td>" << metrics->framesSent.value();
+        rows << "</td><td>" << metrics->imageBytesSent.value();
+        rows << "</td><td>" << bandwidthLimiter->usage();
+        rows << "</td><td>";
+        if(bandwidthLimiter->limit() != 0) {
+            rows << bandwidthLimiter->limit();
+        }
+        rows << "</td><td>" << metrics->events.value();
+        rows << "</td><td><form method=\"POST\" action=\"/admin/sessions/\">";
+        rows << "<input type=\"hidden\" name=\"token\" value=\"" << adminToken_ << "\">";
+        rows << "<input type=\"hidden\" name=\"close\" value=\"" << metrics->sessionIndex << "\">";
+        rows << "<input type=\"submit\" value=\"Close\"></form></td></tr>\n";
+    }
+
+    stringstream totalBandwidth;
+    totalBandwidth << globals->bandwidthLimiter->usage();
+    if(globals->bandwidthLimiter->limit() != 0) {
+        totalBandwidth << " of " << globals->bandwidthLimiter->limit();
+    }
+
+    request->sendHTMLResponse(
+        200, writeAdminSessionsHTML, {totalBandwidth.str(), rows.str()}
+    );
+}
+
+void Server::handleMetricsRequest_(shared_ptr<HTTPRequest> request) {
+    vector<pair<uint64_t, uint64_t>> sessionIndices;
+    vector<shared_ptr<SessionMetrics>> sessionMetrics;
+    for(pair<uint64_t, shared_ptr<Session>> p : sessions_) {
+        shared_ptr<SessionMetrics> metrics = p.second->metrics();
+        sessionIndices.emplace_back(p.first, metrics->sessionIndex);
+        sessionMetrics.push_back(metrics);
+    }
+
+    stringstream metricsSS;
+    globals->metrics->write(metricsSS);
+    globals->uiLagMonitor->write(metricsSS, sessionIndices);
+    SessionMetrics::writeAll(metricsSS, sessionMetrics);
+
+    string text = metricsSS.str();
+    uint64_t contentLength = text.size();
+    request->sendResponse(
+        200,
+        "text/plain; version=0.0.4; charset=UTF-8",
+        contentLength,
+        [text{move(text)}](ostream& out) {
+            out << text;
+        }
+    );
+}
+
+void Server::handleTraceRequest_(
+    shared_ptr<HTTPRequest> request,
+    uint64_t sessionID
+) {
+    if(!isTracingEnabled()) {
+        request->sendTextResponse(
+            400, "ERROR: Tracing is not enabled (use --tracing=yes)"
+        );
+        return;
+    }
+
+    stringstream traceSS;
+    writeTraceJSON(traceSS, sessionID);
+
+    string filename = "trace_" + toString(sessionID) + ".json";
+
+    string json = traceSS.str();
+    uint64_t contentLength = json.size();
+    request->sendResponse(
+        200,
+        "application/json; charset=UTF-8",
+        contentLength,
+        [json{move(json)}](ostream& out) {
+            out << json;
+        },
+        true,
+        {{"Content-Disposition", "attachment; filename=\"" + filename + "\""}}
+    );
+}
+
 void Server::checkShutdownStatus_() {
     if(
         state_ == ShutdownPending &&
@@ -36,6 +36,9 @@ private:
     void afterConstruct_(shared_ptr<Server> self);
 
     void handleClipboardRequest_(shared_ptr<HTTPRequest> request);
+    void handleAdminSessionsRequest_(shared_ptr<HTTPRequest> request);
+    void handleMetricsRequest_(shared_ptr<HTTPRequest> request);
+    void handleTraceRequest_(shared_ptr<HTTPRequest> request, uint64_t sessionID);
 
     void checkShutdownStatus_();
 
@@ -45,4 +48,8 @@ private:
 
     shared_ptr<HTTPServer> httpServer_;
     map<uint64_t, shared_ptr<Session>> sessions_;
+
+    // Random token required in the forms posted to the admin page to protect
+    // against cross-site request forgery
+    string adminToken_;
 };
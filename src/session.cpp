@@ -1,12 +1,18 @@
 #include "session.hpp"
 
+#include "bandwidth_limiter.hpp"
+#include "client_profile.hpp"
 #include "data_url.hpp"
-#include "event.hpp"
 #include "globals.hpp"
 #include "html.hpp"
 #include "image_compressor.hpp"
 #include "key.hpp"
+#include "metrics.hpp"
+#include "renderer_app.hpp"
+#include "session_recorder.hpp"
+#include "synthetic_render.hpp"
 #include "timeout.hpp"
+#include "trace.hpp"
 #include "root_widget.hpp"
 
 #include "include/cef_client.h"
@@ -20,8 +26,16 @@ regex mainPathRegex("/[0-9]+/");
 regex prevPathRegex("/[0-9]+/prev/");
 regex nextPathRegex("/[0-9]+/next/");
 regex imagePathRegex(
-    "/[0-9]+/image/([0-9]+)/([0-9]+)/([01])/([0-9]+)/([0-9]+)/([0-9]+)/(([A-Z0-9_-]+/)*)"
+    "/[0-9]+/image/([0-9]+)/([0-9]+)/([012])/([0-9]+)/([0-9]+)/([0-9]+)/(([A-Z0-9_-]+/)*)"
 );
+regex streamPathRegex(
+    "/[0-9]+/stream/([0-9]+)/([0-9]+)/([0-9]+)/([0-9]+)/"
+);
+regex eventPathRegex(
+    "/[0-9]+/event/([0-9]+)/([0-9]+)/([0-9]+)/([0-9]+)/([0-9]+)/(([A-Z0-9_-]+/)*)"
+);
+regex webSocketPathRegex("/[0-9]+/ws/([0-9]+)/");
+regex webSocketMessageRegex("([0-9]+)/([0-9]+)/([0-9]+)/(([A-Z0-9_-]+/)*)");
 regex iframePathRegex(
     "/[0-9]+/iframe/([0-9]+)/[0-9]+/"
 );
@@ -32,6 +46,48 @@ regex closePathRegex(
     "/[0-9]+/close/([0-9]+)/"
 );
 
+// Response to the event requests sent by clients in server push mode and by
+// clients that send events separately from image requests: a 1x1 GIF if the
+// frame stream of the session is open, or a 2x1 GIF if a client in server push
+// mode should start a new stream.
+void sendEventResponse(shared_ptr<HTTPRequest> request, bool restartStream) {
+    shared_ptr<vector<uint8_t>> gif;
+    if(restartStream) {
+        gif = make_shared<vector<uint8_t>>(vector<uint8_t>{
+            71, 73, 70, 56, 55, 97, 2, 0, 1, 0, 128, 0, 0, 0, 0, 0, 0, 0, 0,
+            44, 0, 0, 0, 0, 2, 0, 1, 0, 0, 8, 5, 0, 1, 0, 8, 8, 0, 59
+        });
+    } else {
+        gif = make_shared<vector<uint8_t>>(vector<uint8_t>{
+            71, 73, 70, 56, 55, 97, 1, 0, 1, 0, 128, 0, 0, 0, 0, 0, 0, 0, 0,
+            44, 0, 0, 0, 0, 1, 0, 1, 0, 0, 8, 4, 0, 1, 4, 4, 0, 59
+        });
+    }
+    uint64_t contentLength = gif->size();
+    request->sendResponse(
+        200,
+        "image/gif",
+        contentLength,
+        [gif](ostream& out) {
+            out.write((const char*)gif->data(), gif->size());
+        }
+    );
+}
+
+string formatByteCount(uint64_t bytes) {
+    stringstream ss;
+    if(bytes < 1024) {
+        ss << bytes << " B";
+    } else if(bytes < 1024 * 1024) {
+        ss << (bytes + 512) / 1024 << " KB";
+    } else {
+        ss.setf(std::ios_base::fixed, std::ios_base::floatfield);
+        ss.precision(1);
+        ss << (double)bytes / (1024.0 * 1024.0) << " MB";
+    }
+    return ss.str();
+}
+
 }
 
 class Session::Client :
@@ -47,7 +103,7 @@ public:
     Client(shared_ptr<Session> session) {
         session_ = session;
         renderHandler_ =
-            session->rootWidget_->browserArea()->createCefRenderHandler();
+            session->rootWidget_->browserArea()->createCefRenderHandler(session->id_);
         downloadHandler_ =
             session->downloadManager_->createCefDownloadHandler();
         lastFindID_ = -1;
@@ -79,6 +135,29 @@ public:
     virtual CefRefPtr<CefKeyboardHandler> GetKeyboardHandler() override {
         return this;
     }
+    virtual bool OnProcessMessageReceived(
+        CefRefPtr<CefBrowser> browser,
+        CefRefPtr<CefFrame> frame,
+        CefProcessId sourceProcess,
+        CefRefPtr<CefProcessMessage> message
+    ) override {
+        REQUIRE_UI_THREAD();
+
+        optional<int> rendererPID = readRendererPIDMessage(message);
+        if(!rendererPID) {
+            return false;
+        }
+        if(frame->IsMain()) {
+            int oldPID = session_->metrics_->rendererPID.exchange(*rendererPID);
+            if(oldPID != *rendererPID) {
+                INFO_LOG(
+                    "Session ", session_->id_, " main frame renderer process ID ",
+                    *rendererPID
+                );
+            }
+        }
+        return true;
+    }
 
     // CefLifeSpanHandler:
     virtual bool OnBeforePopup(
@@ -114,7 +193,7 @@ public:
         windowInfo.SetAsWindowless(kNullWindowHandle);
 
         shared_ptr<Session> popupSession =
-            Session::create(session_->eventHandler_, session_->allowPNG_, true);
+            Session::create(session_->eventHandler_, session_->clientProfile_, true);
         client = new Client(popupSession);
 
         eventHandler->onPopupSessionOpen(popupSession);
@@ -148,17 +227,7 @@ public:
 
     virtual void OnBeforeClose(CefRefPtr<CefBrowser>) override {
         REQUIRE_UI_THREAD();
-        REQUIRE(session_->state_ == Open || session_->state_ == Closing);
-
-        session_->state_ = Closed;
-        session_->browser_ = nullptr;
-        session_->rootWidget_->browserArea()->setBrowser(nullptr);
-        session_->imageCompressor_->flush();
-
-        INFO_LOG("Session ", session_->id_, " closed");
-
-        postTask(session_->eventHandler_, &SessionEventHandler::onSessionClosed, session_->id_);
-        session_->updateInactivityTimeout_();
+        session_->afterClose_();
     }
 
     // CefLoadHandler:
@@ -338,10 +407,11 @@ private:
 
 Session::Session(CKey,
     weak_ptr<SessionEventHandler> eventHandler,
-    bool allowPNG,
+    shared_ptr<const ClientProfile> clientProfile,
     bool isPopup
 ) {
     REQUIRE_UI_THREAD();
+    REQUIRE(clientProfile);
 
     eventHandler_ = eventHandler;
 
@@ -355,7 +425,14 @@ Session::Session(CKey,
     }
     usedSessionIDs.insert(id_);
 
-    INFO_LOG("Opening session ", id_);
+    INFO_LOG("Opening session ", id_, " with client profile '", clientProfile->name, "'");
+
+    metrics_ = SessionMetrics::create(id_);
+    globals->metrics->sessionsOpened.add();
+
+    bandwidthLimiter_ = BandwidthLimiter::create(
+        (uint64_t)globals->config->sessionBandwidthLimit * 1024
+    );
 
     prePrevVisited_ = false;
     preMainVisited_ = false;
@@ -364,6 +441,7 @@ Session::Session(CKey,
 
     curMainIdx_ = 0;
     curImgIdx_ = 0;
+    curEventReqIdx_ = 0;
     curEventIdx_ = 0;
 
     curDownloadIdx_ = 0;
@@ -375,22 +453,39 @@ Session::Session(CKey,
     inactivityTimeoutLong_ = Timeout::create(30000);
     inactivityTimeoutShort_ = Timeout::create(4000);
 
-    allowPNG_ = allowPNG;
+    clientProfile_ = clientProfile;
 
     lastSecurityStatusUpdateTime_ = steady_clock::now();
     lastNavigateOperationTime_ = steady_clock::now();
 
-    imageCompressor_ = ImageCompressor::create(2000, allowPNG_);
+    // The maximum long poll timeout must stay well below the inactivity
+    // timeout, as the session receives no requests while the client waits
+    imageCompressor_ = ImageCompressor::create(
+        2000,
+        clientProfile_->maxLongPollMs,
+        globals->config->imagePipelineDepth,
+        clientProfile_,
+        bandwidthLimiter_,
+        metrics_
+    );
 
-    paddedRootViewport_ = ImageSlice::createImage(
+    rootViewportBuffer_ = ImageSlice::createImage(
         800 + WidthSignalModulus - 1,
         600 + HeightSignalModulus - 1
     );
+    paddedRootViewport_ = rootViewportBuffer_;
     rootViewport_ = paddedRootViewport_.subRect(0, 800, 0, 600);
 
+    resizeTimeout_ = Timeout::create(150);
+
     widthSignal_ = WidthSignalNoNewIframe;
     heightSignal_ = NormalCursor;
 
+    perfStatsVisible_ = false;
+    perfStatsTimeout_ = Timeout::create(1000);
+    perfStatsSampleFrames_ = 0;
+    perfStatsSampleBytes_ = 0;
+
     // Initialization is finalized in afterConstruct_
 }
 
@@ -411,9 +506,16 @@ void Session::close() {
     if(state_ == Open) {
         INFO_LOG("Closing session ", id_, " requested");
         state_ = Closing;
-        REQUIRE(browser_);
-        browser_->GetHost()->CloseBrowser(true);
+        if(syntheticRenderSource_) {
+            // Finish closing asynchronously, like the browser would
+            syntheticRenderSource_->stop();
+            postTask(shared_from_this(), &Session::afterClose_);
+        } else {
+            REQUIRE(browser_);
+            browser_->GetHost()->CloseBrowser(true);
+        }
         imageCompressor_->flush();
+        imageCompressor_->stopStream();
     } else if(state_ == Pending) {
         INFO_LOG(
             "Closing session ", id_,
@@ -428,11 +530,17 @@ void Session::close() {
 void Session::handleHTTPRequest(shared_ptr<HTTPRequest> request) {
     REQUIRE_UI_THREAD();
 
+    TraceSessionScope traceSessionScope(id_);
+    TRACE_SCOPE("Session::handleHTTPRequest");
+
     if(state_ == Closing || state_ == Closed) {
         request->sendTextResponse(503, "ERROR: Browser session has been closed");
         return;
     }
 
+    metrics_->httpRequests.add();
+    request->addBandwidthLimiter(bandwidthLimiter_);
+
     // Force update security status every once in a while just to make sure we
     // don't miss updates for a long time
     if(duration_cast<milliseconds>(
@@ -449,12 +557,12 @@ void Session::handleHTTPRequest(shared_ptr<HTTPRequest> request) {
         REQUIRE(match.size() >= 8);
         optional<uint64_t> mainIdx = parseString<uint64_t>(match[1]);
         optional<uint64_t> imgIdx = parseString<uint64_t>(match[2]);
-        optional<int> immediate = parseString<int>(match[3]);
+        optional<int> mode = parseString<int>(match[3]);
         optional<int> width = parseString<int>(match[4]);
         optional<int> height = parseString<int>(match[5]);
         optional<uint64_t> startEventIdx = parseString<uint64_t>(match[6]);
 
-        if(mainIdx && imgIdx && immediate && width && height && startEventIdx) {
+        if(mainIdx && imgIdx && mode && width && height && startEventIdx) {
             if(*mainIdx != curMainIdx_ || *imgIdx <= curImgIdx_) {
                 request->sendTextResponse(400, "ERROR: Outdated request");
             } else {
@@ -463,16 +571,103 @@ void Session::handleHTTPRequest(shared_ptr<HTTPRequest> request) {
                 handleEvents_(*startEventIdx, match[7].first, match[7].second);
                 curImgIdx_ = *imgIdx;
                 updateRootViewportSize_(*width, *height);
-                if(*immediate) {
+                // Mode 0 is a long poll, 1 requests an image immediately and
+                // 2 is a long poll that accepts an unchanged image signal
+                if(*mode == 1) {
                     imageCompressor_->sendCompressedImageNow(request);
                 } else {
-                    imageCompressor_->sendCompressedImageWait(request);
+                    imageCompressor_->sendCompressedImageWait(request, *mode == 2);
                 }
             }
             return;
         }
     }
 
+    if(
+        method == "GET" &&
+        globals->config->serverPush &&
+        regex_match(path, match, streamPathRegex)
+    ) {
+        REQUIRE(match.size() == 5);
+        optional<uint64_t> mainIdx = parseString<uint64_t>(match[1]);
+        optional<uint64_t> imgIdx = parseString<uint64_t>(match[2]);
+        optional<int> width = parseString<int>(match[3]);
+        optional<int> height = parseString<int>(match[4]);
+
+        if(mainIdx && imgIdx && width && height) {
+            if(*mainIdx != curMainIdx_ || *imgIdx <= curImgIdx_) {
+                request->sendTextResponse(400, "ERROR: Outdated request");
+            } else {
+                updateInactivityTimeout_();
+
+                curImgIdx_ = *imgIdx;
+                updateRootViewportSize_(*width, *height);
+                imageCompressor_->startStream(request);
+            }
+            return;
+        }
+    }
+
+    if(
+        method == "GET" &&
+        (globals->config->serverPush || globals->config->eventRequests) &&
+        regex_match(path, match, eventPathRegex)
+    ) {
+        REQUIRE(match.size() >= 7);
+        optional<uint64_t> mainIdx = parseString<uint64_t>(match[1]);
+        optional<uint64_t> eventReqIdx = parseString<uint64_t>(match[2]);
+        optional<int> width = parseString<int>(match[3]);
+        optional<int> height = parseString<int>(match[4]);
+        optional<uint64_t> startEventIdx = parseString<uint64_t>(match[5]);
+
+        if(mainIdx && eventReqIdx && width && height && startEventIdx) {
+            if(*mainIdx != curMainIdx_ || *eventReqIdx <= curEventReqIdx_) {
+                request->sendTextResponse(400, "ERROR: Outdated request");
+            } else {
+                updateInactivityTimeout_();
+
+                // The events are handled right away; if they change the view,
+                // the pending long poll image request is answered as soon as
+                // the resulting frame has been compressed
+                handleEvents_(*startEventIdx, match[6].first, match[6].second);
+                curEventReqIdx_ = *eventReqIdx;
+                updateRootViewportSize_(*width, *height);
+                sendEventResponse(request, !imageCompressor_->hasStream());
+            }
+            return;
+        }
+    }
+
+    if(
+        method == "GET" &&
+        globals->config->webSocket &&
+        regex_match(path, match, webSocketPathRegex)
+    ) {
+        REQUIRE(match.size() == 2);
+        optional<uint64_t> mainIdx = parseString<uint64_t>(match[1]);
+        if(mainIdx) {
+            if(*mainIdx != curMainIdx_) {
+                request->sendTextResponse(400, "ERROR: Outdated request");
+            } else if(!request->isWebSocketUpgrade()) {
+                request->sendTextResponse(400, "ERROR: WebSocket upgrade required");
+            } else {
+                updateInactivityTimeout_();
+
+                weak_ptr<Session> self = shared_from_this();
+                uint64_t curMainIdx = curMainIdx_;
+                imageCompressor_->startWebSocketStream(
+                    request,
+                    [self, curMainIdx](string message) {
+                        if(shared_ptr<Session> session = self.lock()) {
+                            session->handleWebSocketMessage_(curMainIdx, message);
+                        }
+                    }
+                );
+            }
+            return;
+        }
+    }
+
     if(method == "GET" && regex_match(path, match, iframePathRegex)) {
         REQUIRE(match.size() == 2);
         optional<uint64_t> mainIdx = parseString<uint64_t>(match[1]);
@@ -523,7 +718,9 @@ void Session::handleHTTPRequest(shared_ptr<HTTPRequest> request) {
                 // may be a reload
                 ++curMainIdx_;
                 curImgIdx_ = 0;
+                curEventReqIdx_ = 0;
                 curEventIdx_ = 0;
+                imageCompressor_->stopStream();
                 updateInactivityTimeout_(true);
 
                 request->sendTextResponse(200, "OK");
@@ -550,11 +747,24 @@ void Session::handleHTTPRequest(shared_ptr<HTTPRequest> request) {
             rootWidget_->sendMouseLeaveEvent(0, 0);
 
             curImgIdx_ = 0;
+            curEventReqIdx_ = 0;
             curEventIdx_ = 0;
+            imageCompressor_->stopStream();
             request->sendHTMLResponse(
                 200,
                 writeMainHTML,
-                {id_, curMainIdx_, validNonCharKeyList}
+                {
+                    id_,
+                    curMainIdx_,
+                    validNonCharKeyList,
+                    globals->config->serverPush,
+                    globals->config->webSocket,
+                    globals->config->eventRequests,
+                    globals->config->compactEvents,
+                    globals->config->imagePipelineDepth,
+                    clientProfile_->specializedPage,
+                    detectClientQuirks(request->userAgent())
+                }
             );
         } else {
             request->sendHTMLResponse(200, writePreMainHTML, {id_});
@@ -600,13 +810,25 @@ uint64_t Session::id() {
     return id_;
 }
 
+shared_ptr<SessionMetrics> Session::metrics() {
+    REQUIRE_UI_THREAD();
+    return metrics_;
+}
+
+shared_ptr<BandwidthLimiter> Session::bandwidthLimiter() {
+    REQUIRE_UI_THREAD();
+    return bandwidthLimiter_;
+}
+
 void Session::onWidgetViewDirty() {
     REQUIRE_UI_THREAD();
 
     shared_ptr<Session> self = shared_from_this();
     postTask([self]() {
-        self->rootWidget_->render();
-        self->sendViewportToCompressor_();
+        Rect damage = self->rootWidget_->render();
+        if(!damage.isEmpty()) {
+            self->sendViewportToCompressor_(damage);
+        }
     });
 }
 
@@ -638,9 +860,17 @@ void Session::onGlobalHotkeyPressed(GlobalHotkey key) {
         if(key == GlobalHotkey::Refresh) {
             self->navigate_(0);
         }
+        if(key == GlobalHotkey::PerfStats) {
+            self->togglePerfStats_();
+        }
     });
 }
 
+bool Session::canRenderAnimationFrame() {
+    REQUIRE_UI_THREAD();
+    return imageCompressor_->isIdle();
+}
+
 void Session::onAddressSubmitted(string url) {
     REQUIRE_UI_THREAD();
 
@@ -687,9 +917,9 @@ void Session::onClipboardButtonPressed() {
     });
 }
 
-void Session::onBrowserAreaViewDirty() {
+void Session::onBrowserAreaViewDirty(Rect damage) {
     REQUIRE_UI_THREAD();
-    sendViewportToCompressor_();
+    sendViewportToCompressor_(damage);
 }
 
 void Session::onPendingDownloadCountChanged(int count) {
@@ -702,7 +932,7 @@ void Session::onDownloadProgressChanged(vector<int> progress) {
     rootWidget_->controlBar()->setDownloadProgress(move(progress));
 }
 
-void Session::onDownloadCompleted(shared_ptr<CompletedDownload> file) {
+void Session::onDownloadReady(shared_ptr<DownloadFile> file) {
     REQUIRE_UI_THREAD();
 
     weak_ptr<Session> selfWeak = shared_from_this();
@@ -733,12 +963,33 @@ void Session::onDownloadCompleted(shared_ptr<CompletedDownload> file) {
 }
 
 void Session::afterConstruct_(shared_ptr<Session> self) {
-    rootWidget_ = RootWidget::create(self, self, self, allowPNG_);
+    rootWidget_ = RootWidget::create(
+        self,
+        self,
+        self,
+        clientProfile_->allowPNG,
+        clientProfile_->defaultQuality
+    );
     rootWidget_->setViewport(rootViewport_);
 
     downloadManager_ = DownloadManager::create(self);
 
-    if(!isPopup_) {
+    if(!globals->config->recordDir.empty()) {
+        recorder_ = SessionRecorder::create(
+            id_, globals->config->recordDir + "/session-" + toString(id_) + ".bsrec"
+        );
+        rootWidget_->browserArea()->setRecorder(recorder_);
+    }
+
+    if(!isPopup_ && !globals->config->syntheticRender.empty()) {
+        syntheticRenderSource_ = SyntheticRenderSource::create(
+            globals->config->syntheticRender,
+            rootWidget_->browserArea()->createCefRenderHandler(id_)
+        );
+        syntheticRenderSource_->start();
+        state_ = Open;
+        INFO_LOG("Synthetic render source for session ", id_, " created");
+    } else if(!isPopup_) {
         CefRefPtr<CefClient> client = new Client(self);
 
         CefWindowInfo windowInfo;
@@ -764,6 +1015,24 @@ void Session::afterConstruct_(shared_ptr<Session> self) {
     updateInactivityTimeout_();
 }
 
+void Session::afterClose_() {
+    REQUIRE_UI_THREAD();
+    REQUIRE(state_ == Open || state_ == Closing);
+
+    state_ = Closed;
+    browser_ = nullptr;
+    rootWidget_->browserArea()->setBrowser(nullptr);
+    rootWidget_->browserArea()->setRecorder(nullptr);
+    recorder_.reset();
+    imageCompressor_->flush();
+    imageCompressor_->stopStream();
+
+    INFO_LOG("Session ", id_, " closed");
+
+    postTask(eventHandler_, &SessionEventHandler::onSessionClosed, id_);
+    updateInactivityTimeout_();
+}
+
 void Session::updateInactivityTimeout_(bool shortened) {
     REQUIRE_UI_THREAD();
 
@@ -829,17 +1098,60 @@ void Session::updateRootViewportSize_(int width, int height) {
     width = max(min(width, 4096), 64);
     height = max(min(height, 4096), 64);
 
+    if(resizeTimeout_->isActive()) {
+        pendingRootViewportSize_ = pair<int, int>(width, height);
+        return;
+    }
+    pendingRootViewportSize_.reset();
+
     if(rootViewport_.width() != width || rootViewport_.height() != height) {
-        paddedRootViewport_ = ImageSlice::createImage(
-            width + WidthSignalModulus - 1,
-            height + HeightSignalModulus - 1
+        applyRootViewportSize_(width, height);
+
+        weak_ptr<Session> self = shared_from_this();
+        resizeTimeout_->set([self]() {
+            if(shared_ptr<Session> session = self.lock()) {
+                if(optional<pair<int, int>> size = session->pendingRootViewportSize_) {
+                    session->updateRootViewportSize_(size->first, size->second);
+                }
+            }
+        });
+    }
+}
+
+void Session::applyRootViewportSize_(int width, int height) {
+    REQUIRE_UI_THREAD();
+
+    int paddedWidth = width + WidthSignalModulus - 1;
+    int paddedHeight = height + HeightSignalModulus - 1;
+
+    if(
+        paddedWidth > rootViewportBuffer_.width() ||
+        paddedHeight > rootViewportBuffer_.height()
+    ) {
+        // Copy the previous frame to the new buffer so that it is shown until
+        // the widgets and the browser have rendered at the new size
+        ImageSlice buffer = ImageSlice::createImage(
+            max(paddedWidth, rootViewportBuffer_.width()),
+            max(paddedHeight, rootViewportBuffer_.height())
         );
-        rootViewport_ = paddedRootViewport_.subRect(0, width, 0, height);
-        rootWidget_->setViewport(rootViewport_);
+        buffer.putImage(rootViewport_, 0, 0);
+        rootViewportBuffer_ = buffer;
     }
+
+    paddedRootViewport_ = rootViewportBuffer_.subRect(0, paddedWidth, 0, paddedHeight);
+    rootViewport_ = paddedRootViewport_.subRect(0, width, 0, height);
+
+    // The padding may contain parts of a previous larger frame
+    paddedRootViewport_.fill(width, paddedWidth, 0, paddedHeight, 255);
+    paddedRootViewport_.fill(0, width, height, paddedHeight, 255);
+
+    rootWidget_->setViewport(rootViewport_);
 }
 
-void Session::sendViewportToCompressor_() {
+void Session::sendViewportToCompressor_(optional<Rect> damage) {
+    TraceSessionScope traceSessionScope(id_);
+    TRACE_SCOPE("Session::sendViewportToCompressor_");
+
     REQUIRE(widthSignal_ >= 0 && widthSignal_ < WidthSignalModulus);
     REQUIRE(heightSignal_ >= 0 && heightSignal_ < HeightSignalModulus);
 
@@ -853,11 +1165,41 @@ void Session::sendViewportToCompressor_() {
         --height;
     }
 
+    // The root viewport is at the origin of the global coordinates
     imageCompressor_->updateImage(
-        paddedRootViewport_.subRect(0, width, 0, height)
+        paddedRootViewport_.subRect(0, width, 0, height),
+        damage.value_or(Rect(0, width, 0, height))
     );
 }
 
+void Session::handleWebSocketMessage_(uint64_t mainIdx, string message) {
+    REQUIRE_UI_THREAD();
+
+    TraceSessionScope traceSessionScope(id_);
+
+    if(state_ == Closing || state_ == Closed || mainIdx != curMainIdx_) {
+        return;
+    }
+
+    smatch match;
+    if(!regex_match(message, match, webSocketMessageRegex)) {
+        WARNING_LOG("Invalid WebSocket message received in session ", id_);
+        return;
+    }
+    REQUIRE(match.size() >= 5);
+    optional<int> width = parseString<int>(match[1]);
+    optional<int> height = parseString<int>(match[2]);
+    optional<uint64_t> startEventIdx = parseString<uint64_t>(match[3]);
+    if(!width || !height || !startEventIdx) {
+        WARNING_LOG("Invalid WebSocket message received in session ", id_);
+        return;
+    }
+
+    updateInactivityTimeout_();
+    handleEvents_(*startEventIdx, match[4].first, match[4].second);
+    updateRootViewportSize_(*width, *height);
+}
+
 void Session::handleEvents_(
     uint64_t startIdx,
     string::const_iterator begin,
@@ -869,6 +1211,10 @@ void Session::handleEvents_(
         curEventIdx_ = eventIdx;
     }
 
+    // The relative mouse coordinates only depend on the earlier events of the
+    // same request, so lost requests cannot break them
+    EventState eventState = {0, 0};
+
     string::const_iterator eventEnd = begin;
     while(true) {
         string::const_iterator eventBegin = eventEnd;
@@ -884,7 +1230,12 @@ void Session::handleEvents_(
         }
 
         if(eventIdx == curEventIdx_) {
-            if(!processEvent(rootWidget_, eventBegin, eventEnd)) {
+            metrics_->events.add();
+            imageCompressor_->resetSendTimeout();
+            if(recorder_) {
+                recorder_->recordEvent(string(eventBegin, eventEnd - 1));
+            }
+            if(!processEvent(rootWidget_, eventState, eventBegin, eventEnd)) {
                 WARNING_LOG(
                     "Could not parse event '", string(eventBegin, eventEnd),
                     "' in session ", id_
@@ -893,6 +1244,7 @@ void Session::handleEvents_(
             ++eventIdx;
             curEventIdx_ = eventIdx;
         } else {
+            skipEvent(eventState, eventBegin, eventEnd);
             ++eventIdx;
         }
     }
@@ -941,3 +1293,62 @@ void Session::navigate_(int direction) {
         }
     }
 }
+
+void Session::togglePerfStats_() {
+    REQUIRE_UI_THREAD();
+
+    perfStatsVisible_ = !perfStatsVisible_;
+    perfStatsTimeout_->clear(false);
+
+    if(perfStatsVisible_) {
+        perfStatsSampleTime_ = steady_clock::now();
+        perfStatsSampleFrames_ = metrics_->framesSent.value();
+        perfStatsSampleBytes_ = metrics_->imageBytesSent.value();
+        updatePerfStats_(false);
+    } else {
+        rootWidget_->controlBar()->setPerfStats({});
+    }
+}
+
+void Session::updatePerfStats_(bool showRates) {
+    REQUIRE_UI_THREAD();
+    REQUIRE(perfStatsVisible_);
+
+    steady_clock::time_point now = steady_clock::now();
+    uint64_t frames = metrics_->framesSent.value();
+    uint64_t bytes = metrics_->imageBytesSent.value();
+
+    int64_t elapsedMs = duration_cast<milliseconds>(now - perfStatsSampleTime_).count();
+    showRates = showRates && elapsedMs > 0;
+    uint64_t encodeMs = (metrics_->lastEncodeMicroseconds.load() + 500) / 1000;
+    stringstream text;
+    if(showRates) {
+        uint64_t fps =
+            ((frames - perfStatsSampleFrames_) * 1000 + (uint64_t)elapsedMs / 2) /
+            (uint64_t)elapsedMs;
+        text << fps << " fps  ";
+    }
+    text << formatByteCount(metrics_->lastImageBytes.load()) << "  ";
+    text << encodeMs << " ms";
+    if(showRates) {
+        uint64_t bytesPerSecond =
+            (bytes - perfStatsSampleBytes_) * 1000 / (uint64_t)elapsedMs;
+        text << "  " << formatByteCount(bytesPerSecond) << "/s";
+        if(bandwidthLimiter_->limit() != 0) {
+            text << " / " << formatByteCount(bandwidthLimiter_->limit()) << "/s";
+        }
+    }
+
+    perfStatsSampleTime_ = now;
+    perfStatsSampleFrames_ = frames;
+    perfStatsSampleBytes_ = bytes;
+
+    rootWidget_->controlBar()->setPerfStats(text.str());
+
+    weak_ptr<Session> self = shared_from_this();
+    perfStatsTimeout_->set([self]() {
+        if(shared_ptr<Session> session = self.lock()) {
+            session->updatePerfStats_(true);
+        }
+    });
+}
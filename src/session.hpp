@@ -3,10 +3,12 @@
 #include "browser_area.hpp"
 #include "control_bar.hpp"
 #include "download_manager.hpp"
+#include "event.hpp"
 #include "http.hpp"
 #include "image_slice.hpp"
 #include "widget.hpp"
 
+struct ClientProfile;
 class Session;
 
 class SessionEventHandler {
@@ -19,9 +21,13 @@ public:
     virtual void onPopupSessionOpen(shared_ptr<Session> session) = 0;
 };
 
+class BandwidthLimiter;
 class DownloadManager;
 class ImageCompressor;
 class RootWidget;
+class SessionMetrics;
+class SessionRecorder;
+class SyntheticRenderSource;
 class Timeout;
 
 class CefBrowser;
@@ -37,11 +43,12 @@ class Session :
 {
 SHARED_ONLY_CLASS(Session);
 public:
-    // Creates new session. The isPopup argument is only used internally to
-    // create popup sessions.
+    // Creates new session with settings from given client profile (see
+    // getClientProfile). The isPopup argument is only used internally to create
+    // popup sessions.
     Session(CKey,
         weak_ptr<SessionEventHandler> eventHandler,
-        bool allowPNG,
+        shared_ptr<const ClientProfile> clientProfile,
         bool isPopup = false
     );
 
@@ -55,10 +62,16 @@ public:
     // Get the unique and constant ID of this session
     uint64_t id();
 
+    shared_ptr<SessionMetrics> metrics();
+
+    // The limiter for the data sent to the client of this session
+    shared_ptr<BandwidthLimiter> bandwidthLimiter();
+
     // WidgetParent:
     virtual void onWidgetViewDirty() override;
     virtual void onWidgetCursorChanged() override;
     virtual void onGlobalHotkeyPressed(GlobalHotkey key) override;
+    virtual bool canRenderAnimationFrame() override;
 
     // ControlBarEventHandler:
     virtual void onAddressSubmitted(string url) override;
@@ -69,12 +82,12 @@ public:
     virtual void onClipboardButtonPressed() override;
 
     // BrowserAreaEventHandler:
-    virtual void onBrowserAreaViewDirty() override;
+    virtual void onBrowserAreaViewDirty(Rect damage) override;
 
     // DownloadManagerEventHandler:
     virtual void onPendingDownloadCountChanged(int count) override;
     virtual void onDownloadProgressChanged(vector<int> progress) override;
-    virtual void onDownloadCompleted(shared_ptr<CompletedDownload> file) override;
+    virtual void onDownloadReady(shared_ptr<DownloadFile> file) override;
 
 private:
     // Class that implements CefClient interfaces for this session
@@ -82,17 +95,30 @@ private:
 
     void afterConstruct_(shared_ptr<Session> self);
 
+    // Called when the browser (or the synthetic render source) has been closed
+    void afterClose_();
+
     void updateInactivityTimeout_(bool shortened = false);
 
     void updateSecurityStatus_();
 
     // Change root viewport size if it is different than currently. Clamps
-    // dimensions to sane interval.
+    // dimensions to sane interval. To avoid relayouting and reallocating for
+    // every intermediate size while the client window is being resized, the
+    // size is changed at most once per resizeTimeout_ interval; the size last
+    // requested during the interval is applied at its end.
     void updateRootViewportSize_(int width, int height);
+    void applyRootViewportSize_(int width, int height);
 
     // Send paddedRootViewport_ to the image compressor correctly clamped such
     // that its dimensions result in signals (widthSignal_, heightSignal_).
-    void sendViewportToCompressor_();
+    // The damage rectangle is given in global coordinates; by default, the
+    // whole viewport is considered damaged
+    void sendViewportToCompressor_(optional<Rect> damage = {});
+
+    // Handle a message received from the client through the WebSocket opened by
+    // main page mainIdx: "WIDTH/HEIGHT/STARTEVENTIDX/EVENT1/EVENT2/.../"
+    void handleWebSocketMessage_(uint64_t mainIdx, string message);
 
     void handleEvents_(
         uint64_t startIdx,
@@ -108,10 +134,18 @@ private:
     // -1 = back, 0 = refresh, 1 = forward
     void navigate_(int direction);
 
+    void togglePerfStats_();
+    // The frame and byte rates are shown only if showRates is true, i.e. when
+    // a full sample interval has passed since the stats were shown
+    void updatePerfStats_(bool showRates);
+
     weak_ptr<SessionEventHandler> eventHandler_;
 
     uint64_t id_;
 
+    shared_ptr<SessionMetrics> metrics_;
+    shared_ptr<BandwidthLimiter> bandwidthLimiter_;
+
     bool isPopup_;
 
     bool prePrevVisited_;
@@ -128,6 +162,11 @@ private:
     // image index to avoid request reordering.
     uint64_t curImgIdx_;
 
+    // Latest event request index, used like curImgIdx_ for the event requests.
+    // The event requests are ordered separately from the image requests so
+    // that they can be sent while an image request is pending.
+    uint64_t curEventReqIdx_;
+
     // How many events we have handled for the current main index. We keep track
     // of this to avoid replaying events; the client may send the same events
     // twice as it cannot know for sure which requests make it through.
@@ -135,7 +174,7 @@ private:
 
     // Downloads whose iframe has been loaded, and the actual file is kept
     // available until a timeout has expired.
-    map<uint64_t, pair<shared_ptr<CompletedDownload>, shared_ptr<Timeout>>> downloads_;
+    map<uint64_t, pair<shared_ptr<DownloadFile>, shared_ptr<Timeout>>> downloads_;
     uint64_t curDownloadIdx_;
 
     enum {Pending, Open, Closing, Closed} state_;
@@ -149,13 +188,19 @@ private:
     steady_clock::time_point lastSecurityStatusUpdateTime_;
     steady_clock::time_point lastNavigateOperationTime_;
 
-    bool allowPNG_;
+    shared_ptr<const ClientProfile> clientProfile_;
     shared_ptr<ImageCompressor> imageCompressor_;
 
+    // paddedRootViewport_ is the top-left corner of rootViewportBuffer_, which
+    // is only reallocated when the viewport grows beyond it
+    ImageSlice rootViewportBuffer_;
     ImageSlice paddedRootViewport_;
     ImageSlice rootViewport_;
     shared_ptr<RootWidget> rootWidget_;
 
+    shared_ptr<Timeout> resizeTimeout_;
+    optional<pair<int, int>> pendingRootViewportSize_;
+
     queue<function<void(shared_ptr<HTTPRequest>)>> iframeQueue_;
 
     // We use width and height modulo WidthSignalModulus and HeightSignalModulus
@@ -174,6 +219,20 @@ private:
 
     shared_ptr<DownloadManager> downloadManager_;
 
+    // Performance statistics shown in the control bar, toggled by a hotkey and
+    // updated once per second using perfStatsTimeout_
+    bool perfStatsVisible_;
+    shared_ptr<Timeout> perfStatsTimeout_;
+    steady_clock::time_point perfStatsSampleTime_;
+    uint64_t perfStatsSampleFrames_;
+    uint64_t perfStatsSampleBytes_;
+
     // Only available in Open state
     CefRefPtr<CefBrowser> browser_;
+
+    // Used instead of browser_ if the --synthetic-render option is set
+    shared_ptr<SyntheticRenderSource> syntheticRenderSource_;
+
+    // Only set if the --record-dir option is set and the session is not closed
+    shared_ptr<SessionRecorder> recorder_;
 };
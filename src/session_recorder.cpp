@@ -0,0 +1,239 @@
+#include "session_recorder.hpp"
+
+#include "recording_format.hpp"
+
+#include "include/cef_thread.h"
+#include "include/wrapper/cef_closure_task.h"
+
+#include <cstdio>
+
+namespace {
+
+// Maximum amount of data queued for the writer thread before frames are
+// dropped
+constexpr uint64_t MaxPendingBytes = 256 * 1024 * 1024;
+
+template <typename T>
+void appendBytes(vector<uint8_t>& data, const T& value) {
+    const uint8_t* ptr = (const uint8_t*)&value;
+    data.insert(data.end(), ptr, ptr + sizeof(T));
+}
+
+shared_ptr<vector<uint8_t>> createRecord(
+    recording::RecordType type,
+    uint64_t time,
+    uint64_t payloadSize
+) {
+    REQUIRE(payloadSize <= UINT32_MAX);
+
+    shared_ptr<vector<uint8_t>> data = make_shared<vector<uint8_t>>();
+    data->reserve(sizeof(recording::RecordHeader) + recording::paddedSize(payloadSize));
+
+    recording::RecordHeader header;
+    header.type = type;
+    header.payloadSize = (uint32_t)payloadSize;
+    header.time = time;
+    appendBytes(*data, header);
+
+    return data;
+}
+
+void padRecord(vector<uint8_t>& data) {
+    data.resize(recording::paddedSize(data.size()), 0);
+}
+
+}
+
+// File state shared with the writer thread
+class SessionRecorder::File {
+public:
+    File(string path)
+        : path(move(path)),
+          fp(nullptr),
+          failed(false),
+          pendingBytes(0)
+    {}
+    ~File() {
+        if(fp != nullptr) {
+            if(fclose(fp)) {
+                WARNING_LOG("Closing session recording file '", path, "' failed");
+            }
+            INFO_LOG("Session recording '", path, "' finished");
+        }
+    }
+
+    const string path;
+    // Only accessed by the writer thread after opening
+    FILE* fp;
+    atomic<bool> failed;
+    atomic<uint64_t> pendingBytes;
+};
+
+SessionRecorder::SessionRecorder(CKey, uint64_t sessionID, string path) {
+    REQUIRE_UI_THREAD();
+
+    startTime_ = steady_clock::now();
+    file_ = make_shared<File>(path);
+    writerThread_ = CefThread::CreateThread("Session recorder");
+
+    lastWidth_ = -1;
+    lastHeight_ = -1;
+    writeFullFrame_ = true;
+
+    file_->fp = fopen(path.c_str(), "wb");
+    if(file_->fp == nullptr) {
+        WARNING_LOG("Could not open session recording file '", path, "', not recording");
+        file_->failed.store(true);
+        return;
+    }
+    INFO_LOG("Recording session ", sessionID, " to '", path, "'");
+
+    recording::FileHeader header;
+    memcpy(header.magic, recording::Magic, sizeof(header.magic));
+    header.sessionID = sessionID;
+    header.startTime = (uint64_t)duration_cast<microseconds>(
+        std::chrono::system_clock::now().time_since_epoch()
+    ).count();
+
+    shared_ptr<vector<uint8_t>> data = make_shared<vector<uint8_t>>();
+    appendBytes(*data, header);
+    write_(data);
+}
+
+SessionRecorder::~SessionRecorder() {}
+
+void SessionRecorder::recordFrame(
+    const uint8_t* buffer,
+    int width,
+    int height,
+    const vector<Rect>& dirtyRects
+) {
+    REQUIRE_UI_THREAD();
+    REQUIRE(width > 0 && height > 0);
+
+    if(!isRecording_()) {
+        return;
+    }
+
+    if(width != lastWidth_ || height != lastHeight_) {
+        lastWidth_ = width;
+        lastHeight_ = height;
+        writeFullFrame_ = true;
+    }
+
+    vector<Rect> rects;
+    if(writeFullFrame_) {
+        rects.push_back(Rect(0, width, 0, height));
+    } else {
+        Rect bounds(0, width, 0, height);
+        for(Rect rect : dirtyRects) {
+            rect = Rect::intersection(rect, bounds);
+            if(!rect.isEmpty()) {
+                rects.push_back(rect);
+            }
+        }
+        if(rects.empty()) {
+            return;
+        }
+    }
+
+    uint64_t payloadSize =
+        sizeof(recording::FramePayload) + rects.size() * sizeof(recording::Rect);
+    for(const Rect& rect : rects) {
+        payloadSize +=
+            4 * (uint64_t)(rect.endX - rect.startX) * (uint64_t)(rect.endY - rect.startY);
+    }
+
+    if(
+        file_->pendingBytes.load() + payloadSize > MaxPendingBytes ||
+        payloadSize > UINT32_MAX
+    ) {
+        // Writer is falling behind; drop the frame and make sure the next frame
+        // is complete
+        writeFullFrame_ = true;
+        return;
+    }
+    writeFullFrame_ = false;
+
+    uint64_t time = (uint64_t)duration_cast<microseconds>(
+        steady_clock::now() - startTime_
+    ).count();
+    shared_ptr<vector<uint8_t>> data =
+        createRecord(recording::FrameRecord, time, payloadSize);
+
+    recording::FramePayload frame;
+    frame.width = (uint32_t)width;
+    frame.height = (uint32_t)height;
+    frame.rectCount = (uint32_t)rects.size();
+    frame.reserved = 0;
+    appendBytes(*data, frame);
+
+    for(const Rect& rect : rects) {
+        recording::Rect outRect;
+        outRect.x = rect.startX;
+        outRect.y = rect.startY;
+        outRect.width = rect.endX - rect.startX;
+        outRect.height = rect.endY - rect.startY;
+        appendBytes(*data, outRect);
+    }
+    for(const Rect& rect : rects) {
+        for(int y = rect.startY; y < rect.endY; ++y) {
+            const uint8_t* row = &buffer[4 * ((size_t)y * (size_t)width + (size_t)rect.startX)];
+            data->insert(data->end(), row, row + 4 * (rect.endX - rect.startX));
+        }
+    }
+    padRecord(*data);
+
+    write_(data);
+}
+
+void SessionRecorder::recordEvent(string event) {
+    REQUIRE_UI_THREAD();
+
+    if(!isRecording_()) {
+        return;
+    }
+
+    uint64_t time = (uint64_t)duration_cast<microseconds>(
+        steady_clock::now() - startTime_
+    ).count();
+    shared_ptr<vector<uint8_t>> data =
+        createRecord(recording::EventRecord, time, event.size());
+    data->insert(data->end(), event.begin(), event.end());
+    padRecord(*data);
+
+    write_(data);
+}
+
+bool SessionRecorder::isRecording_() {
+    return !file_->failed.load();
+}
+
+void SessionRecorder::write_(shared_ptr<vector<uint8_t>> data) {
+    REQUIRE_UI_THREAD();
+
+    shared_ptr<File> file = file_;
+    file->pendingBytes.fetch_add(data->size());
+
+    function<void()> writeTask = [file, data]() {
+        if(file->fp != nullptr) {
+            if(fwrite(data->data(), 1, data->size(), file->fp) != data->size()) {
+                WARNING_LOG(
+                    "Writing session recording file '", file->path,
+                    "' failed, stopping recording"
+                );
+                fclose(file->fp);
+                file->fp = nullptr;
+                file->failed.store(true);
+            }
+        }
+        file->pendingBytes.fetch_sub(data->size());
+    };
+
+    void (*call)(function<void()>) = [](function<void()> func) {
+        func();
+    };
+    writerThread_->GetTaskRunner()->PostTask(
+        CefCreateClosureTask(base::Bind(call, writeTask))
+    );
+}
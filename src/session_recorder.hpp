@@ -0,0 +1,45 @@
+#pragma once
+
+#include "rect.hpp"
+
+class CefThread;
+
+// Writes a recording of the frames painted by the browser and the events sent
+// by the client in a session to a file (format in recording_format.hpp), for
+// replaying the workload offline using bench/session_replay.cpp. Enabled by the
+// --record-dir option. The file is written in a background thread; if the
+// writer falls behind by too much, frames are dropped and the next frame is
+// written in full.
+class SessionRecorder {
+SHARED_ONLY_CLASS(SessionRecorder);
+public:
+    SessionRecorder(CKey, uint64_t sessionID, string path);
+    ~SessionRecorder();
+
+    // Record a frame painted by the browser. The buffer contains the whole
+    // frame (BGRA without row padding) and dirtyRects the areas that have
+    // changed since the previous frame.
+    void recordFrame(
+        const uint8_t* buffer,
+        int width,
+        int height,
+        const vector<Rect>& dirtyRects
+    );
+
+    // Record an event received from the client (without the trailing '/')
+    void recordEvent(string event);
+
+private:
+    class File;
+
+    bool isRecording_();
+    void write_(shared_ptr<vector<uint8_t>> data);
+
+    steady_clock::time_point startTime_;
+    shared_ptr<File> file_;
+    CefRefPtr<CefThread> writerThread_;
+
+    int lastWidth_;
+    int lastHeight_;
+    bool writeFullFrame_;
+};
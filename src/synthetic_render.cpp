@@ -0,0 +1,295 @@
+#include "synthetic_render.hpp"
+
+#include "timeout.hpp"
+
+#include "include/cef_render_handler.h"
+
+#include <zlib.h>
+
+namespace {
+
+// Same as the default windowless frame rate of CEF (30 fps)
+constexpr int64_t FrameIntervalMs = 33;
+
+// Text page geometry in scroll and animate modes
+constexpr int LineHeight = 18;
+constexpr int GlyphWidth = 7;
+constexpr int PageMargin = 16;
+constexpr int ScrollSpeed = 4;
+
+constexpr int BoxSize = 96;
+
+struct CorpusFrame {
+    int width;
+    int height;
+    vector<uint8_t> data;
+};
+
+vector<CorpusFrame> corpusFrames;
+
+uint32_t hashInt(uint32_t x) {
+    x ^= x >> 16;
+    x *= 0x7FEB352Du;
+    x ^= x >> 15;
+    x *= 0x846CA68Bu;
+    x ^= x >> 16;
+    return x;
+}
+
+// Generates a page of pseudo-random text of given size into BGRA buffer
+void generateTextPage(vector<uint8_t>& buf, int width, int height) {
+    buf.assign(4 * (size_t)width * (size_t)height, 255);
+
+    for(int y = 0; y < height; ++y) {
+        int line = y / LineHeight;
+        int glyphRow = y % LineHeight - 4;
+        uint32_t lineHash = hashInt((uint32_t)line);
+
+        // Paragraph breaks and ragged line ends
+        if(glyphRow < 0 || glyphRow >= 10 || lineHash % 7 == 0) {
+            continue;
+        }
+        int lineEnd = width - PageMargin - (int)(lineHash % 200);
+
+        uint8_t* row = &buf[4 * (size_t)width * (size_t)y];
+        for(int x = PageMargin; x < lineEnd; ++x) {
+            int glyph = (x - PageMargin) / GlyphWidth;
+            int glyphCol = (x - PageMargin) % GlyphWidth;
+            uint32_t glyphHash = hashInt(lineHash ^ (uint32_t)glyph * 0x9E3779B9u);
+            if(glyphCol >= 5 || glyphHash % 6 == 0) {
+                continue;
+            }
+            if((glyphHash >> ((glyphRow * 5 + glyphCol) % 30)) & 1) {
+                row[4 * x] = 32;
+                row[4 * x + 1] = 32;
+                row[4 * x + 2] = 32;
+            }
+        }
+    }
+}
+
+// Position of a point moving back and forth between 0 and range
+int bounce(uint64_t t, int range) {
+    if(range <= 0) {
+        return 0;
+    }
+    uint64_t period = 2 * (uint64_t)range;
+    int pos = (int)(t % period);
+    return pos <= range ? pos : (int)period - pos;
+}
+
+vector<uint8_t> readGzipFile(const string& path) {
+    vector<uint8_t> data;
+    gzFile fp = gzopen(path.c_str(), "rb");
+    if(fp == nullptr) {
+        return data;
+    }
+    uint8_t buf[65536];
+    while(true) {
+        int count = gzread(fp, buf, sizeof(buf));
+        if(count <= 0) {
+            break;
+        }
+        data.insert(data.end(), buf, buf + count);
+    }
+    gzclose(fp);
+    return data;
+}
+
+// Reads a corpus in the format used by the compression benchmark (see
+// bench/make_corpus.py)
+bool readCorpus(string dir) {
+    string indexPath = dir + "/index.txt";
+    ifstream index(indexPath);
+    if(!index) {
+        ERROR_LOG("Could not open synthetic render corpus index '", indexPath, "'");
+        return false;
+    }
+
+    string line;
+    while(std::getline(index, line)) {
+        line = line.substr(0, line.find('#'));
+        stringstream ss(line);
+        string name;
+        string filename;
+        CorpusFrame frame;
+        if(!(ss >> name >> filename >> frame.width >> frame.height)) {
+            continue;
+        }
+        if(frame.width <= 0 || frame.height <= 0) {
+            ERROR_LOG("Synthetic render corpus frame '", name, "' has invalid size");
+            return false;
+        }
+        frame.data = readGzipFile(dir + "/" + filename);
+        if(frame.data.size() != 4 * (size_t)frame.width * (size_t)frame.height) {
+            ERROR_LOG("Reading synthetic render corpus frame '", name, "' failed");
+            return false;
+        }
+        corpusFrames.push_back(move(frame));
+    }
+
+    if(corpusFrames.empty()) {
+        ERROR_LOG("Synthetic render corpus '", dir, "' has no frames");
+        return false;
+    }
+
+    INFO_LOG("Loaded ", corpusFrames.size(), " frames for synthetic rendering");
+    return true;
+}
+
+}
+
+bool initSyntheticRender(string mode) {
+    if(mode.substr(0, 7) == "corpus:") {
+        return readCorpus(mode.substr(7));
+    }
+    return true;
+}
+
+SyntheticRenderSource::SyntheticRenderSource(CKey,
+    string mode,
+    CefRefPtr<CefRenderHandler> renderHandler
+) {
+    REQUIRE_UI_THREAD();
+    REQUIRE(mode == "scroll" || mode == "animate" || mode.substr(0, 7) == "corpus:");
+
+    mode_ = mode;
+    renderHandler_ = renderHandler;
+    frameTimeout_ = Timeout::create(FrameIntervalMs);
+    running_ = false;
+
+    frameIdx_ = 0;
+    width_ = 0;
+    height_ = 0;
+    documentHeight_ = 0;
+    boxX_ = 0;
+    boxY_ = 0;
+}
+
+SyntheticRenderSource::~SyntheticRenderSource() {
+    frameTimeout_->clear(false);
+}
+
+void SyntheticRenderSource::start() {
+    REQUIRE_UI_THREAD();
+
+    if(!running_) {
+        running_ = true;
+        scheduleFrame_();
+    }
+}
+
+void SyntheticRenderSource::stop() {
+    REQUIRE_UI_THREAD();
+
+    running_ = false;
+    frameTimeout_->clear(false);
+}
+
+void SyntheticRenderSource::scheduleFrame_() {
+    REQUIRE_UI_THREAD();
+
+    weak_ptr<SyntheticRenderSource> self = shared_from_this();
+    frameTimeout_->set([self]() {
+        REQUIRE_UI_THREAD();
+        if(shared_ptr<SyntheticRenderSource> source = self.lock()) {
+            if(source->running_) {
+                source->paintFrame_();
+                source->scheduleFrame_();
+            }
+        }
+    });
+}
+
+void SyntheticRenderSource::paintFrame_() {
+    REQUIRE_UI_THREAD();
+
+    CefRect viewRect;
+    renderHandler_->GetViewRect(nullptr, viewRect);
+
+    RectList dirtyRects;
+    if(viewRect.width != width_ || viewRect.height != height_) {
+        resize_(viewRect.width, viewRect.height);
+        dirtyRects.push_back(CefRect(0, 0, width_, height_));
+    }
+
+    size_t rowBytes = 4 * (size_t)width_;
+
+    if(mode_ == "scroll") {
+        int scrollY = (int)((frameIdx_ * ScrollSpeed) % (uint64_t)documentHeight_);
+        for(int y = 0; y < height_; ++y) {
+            int docY = (y + scrollY) % documentHeight_;
+            memcpy(&buffer_[rowBytes * y], &document_[rowBytes * docY], rowBytes);
+        }
+        dirtyRects.assign(1, CefRect(0, 0, width_, height_));
+    } else if(mode_ == "animate") {
+        // Restore the background under the old box and draw the box in its
+        // new position; only these two areas are dirty
+        int boxWidth = min(BoxSize, width_);
+        int boxHeight = min(BoxSize, height_);
+        for(int y = boxY_; y < boxY_ + boxHeight; ++y) {
+            memcpy(
+                &buffer_[rowBytes * y + 4 * boxX_],
+                &document_[rowBytes * y + 4 * boxX_],
+                4 * boxWidth
+            );
+        }
+        dirtyRects.push_back(CefRect(boxX_, boxY_, boxWidth, boxHeight));
+
+        boxX_ = bounce(frameIdx_ * 5, width_ - boxWidth);
+        boxY_ = bounce(frameIdx_ * 3, height_ - boxHeight);
+        uint8_t b = (uint8_t)(frameIdx_ * 3);
+        uint8_t g = (uint8_t)(frameIdx_ * 5);
+        uint8_t r = (uint8_t)(255 - frameIdx_ * 7);
+        for(int y = boxY_; y < boxY_ + boxHeight; ++y) {
+            uint8_t* pixel = &buffer_[rowBytes * y + 4 * boxX_];
+            for(int x = 0; x < boxWidth; ++x) {
+                pixel[0] = b;
+                pixel[1] = g;
+                pixel[2] = r;
+                pixel[3] = 255;
+                pixel += 4;
+            }
+        }
+        dirtyRects.push_back(CefRect(boxX_, boxY_, boxWidth, boxHeight));
+    } else {
+        // Tile the corpus frame over the view
+        const CorpusFrame& frame = corpusFrames[frameIdx_ % corpusFrames.size()];
+        for(int y = 0; y < height_; ++y) {
+            const uint8_t* src = &frame.data[4 * (size_t)frame.width * (y % frame.height)];
+            uint8_t* dest = &buffer_[rowBytes * y];
+            int x = 0;
+            while(x < width_) {
+                int count = min(frame.width, width_ - x);
+                memcpy(&dest[4 * x], src, 4 * count);
+                x += count;
+            }
+        }
+        dirtyRects.assign(1, CefRect(0, 0, width_, height_));
+    }
+
+    renderHandler_->OnPaint(
+        nullptr, PET_VIEW, dirtyRects, buffer_.data(), width_, height_
+    );
+    ++frameIdx_;
+}
+
+void SyntheticRenderSource::resize_(int width, int height) {
+    REQUIRE_UI_THREAD();
+    REQUIRE(width > 0 && height > 0);
+
+    width_ = width;
+    height_ = height;
+    buffer_.resize(4 * (size_t)width_ * (size_t)height_);
+
+    if(mode_ == "scroll" || mode_ == "animate") {
+        // The scrolled document repeats itself after documentHeight_ rows
+        documentHeight_ = max(2048, 2 * height_);
+        generateTextPage(document_, width_, documentHeight_);
+    }
+    if(mode_ == "animate") {
+        memcpy(buffer_.data(), document_.data(), buffer_.size());
+        boxX_ = 0;
+        boxY_ = 0;
+    }
+}
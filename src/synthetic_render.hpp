@@ -0,0 +1,60 @@
+#pragma once
+
+#include "common.hpp"
+
+class CefRenderHandler;
+class Timeout;
+
+// Loads the data needed by given synthetic render mode (the value of the
+// --synthetic-render option), i.e. the frames of the corpus in 'corpus:DIR'
+// mode. Must be called before creating SyntheticRenderSources; returns false
+// and logs an error on failure.
+bool initSyntheticRender(string mode);
+
+// Replacement for the browser used for benchmarking the server pipeline without
+// loading actual pages (enabled by the --synthetic-render option). Paints
+// generated frames at a fixed rate into a CefRenderHandler, typically obtained
+// from BrowserArea::createCefRenderHandler, so that the frames pass through the
+// same paint path as the frames rendered by the browser. The frame content only
+// depends on the frame index and the view size, making runs repeatable.
+class SyntheticRenderSource : public enable_shared_from_this<SyntheticRenderSource> {
+SHARED_ONLY_CLASS(SyntheticRenderSource);
+public:
+    SyntheticRenderSource(CKey,
+        string mode,
+        CefRefPtr<CefRenderHandler> renderHandler
+    );
+    ~SyntheticRenderSource();
+
+    // Start or stop painting frames
+    void start();
+    void stop();
+
+private:
+    void scheduleFrame_();
+    void paintFrame_();
+
+    // Regenerate document_ (and buffer_ in animate mode) for the new view size
+    void resize_(int width, int height);
+
+    string mode_;
+    CefRefPtr<CefRenderHandler> renderHandler_;
+    shared_ptr<Timeout> frameTimeout_;
+    bool running_;
+
+    uint64_t frameIdx_;
+    int width_;
+    int height_;
+
+    // Frame passed to the render handler
+    vector<uint8_t> buffer_;
+
+    // Generated text page (width_ wide) that is scrolled in scroll mode and
+    // used as the background in animate mode
+    vector<uint8_t> document_;
+    int documentHeight_;
+
+    // Position of the box painted to buffer_ in animate mode
+    int boxX_;
+    int boxY_;
+};
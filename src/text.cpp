@@ -6,6 +6,8 @@
 #include <freetype/fttypes.h>
 #include <pango/pangoft2.h>
 
+#include <list>
+
 namespace {
 
 int jumpUTF8Chars(const string& str, int idx, int count) {
@@ -69,6 +71,84 @@ private:
     string oldValue_;
 };
 
+struct Graymap {
+    int width;
+    int height;
+    vector<uint8_t> buffer;
+    FT_Bitmap ftBitmap;
+
+    Graymap(int pWidth, int pHeight) {
+        width = pWidth;
+        height = pHeight;
+
+        REQUIRE(width >= 1);
+        REQUIRE(height >= 1);
+
+        const int Limit = INT_MAX / 9;
+        REQUIRE(width < Limit / height);
+
+        buffer.resize(width * height);
+        ftBitmap.rows = height;
+        ftBitmap.width = width;
+        ftBitmap.pitch = width;
+        ftBitmap.buffer = buffer.data();
+        ftBitmap.pixel_mode = FT_PIXEL_MODE_GRAY;
+    }
+
+    Graymap(const Graymap&) = delete;
+    Graymap& operator=(const Graymap&) = delete;
+
+    Graymap(Graymap&&) = default;
+    Graymap& operator=(Graymap&&) = default;
+};
+
+// Text laid out by Pango, shared through the cache in TextRenderContext. The
+// layout is never modified after construction; the rendered coverage mask is
+// computed when first needed.
+struct LaidOutText {
+    PangoLayout* layout;
+    string text;
+    PangoRectangle extents;
+    optional<Graymap> graymap;
+
+    LaidOutText(
+        PangoContext* pangoCtx,
+        PangoFontDescription* fontDesc,
+        string pText
+    ) {
+        text = move(pText);
+
+        layout = pango_layout_new(pangoCtx);
+        REQUIRE(layout != nullptr);
+
+        pango_layout_set_font_description(layout, fontDesc);
+        pango_layout_set_auto_dir(layout, FALSE);
+        pango_layout_set_single_paragraph_mode(layout, TRUE);
+        pango_layout_set_text(layout, text.data(), text.size());
+
+        // Check that Pango agrees that the text is valid UTF-8
+        REQUIRE(!strcmp(pango_layout_get_text(layout), text.c_str()));
+
+        pango_layout_get_pixel_extents(layout, nullptr, &extents);
+        extents.width = max(extents.width, 1);
+        extents.height = max(extents.height, 1);
+    }
+
+    ~LaidOutText() {
+        g_object_unref(layout);
+    }
+
+    DISABLE_COPY_MOVE(LaidOutText);
+
+    const Graymap& getGraymap() {
+        if(!graymap) {
+            graymap = Graymap(extents.width, extents.height);
+            pango_ft2_render_layout(&graymap->ftBitmap, layout, -extents.x, -extents.y);
+        }
+        return *graymap;
+    }
+};
+
 }
 
 struct TextRenderContext::Impl {
@@ -76,6 +156,11 @@ struct TextRenderContext::Impl {
     PangoContext* pangoCtx;
     PangoFontDescription* fontDesc;
 
+    // LRU cache of laid out texts, most recently used first
+    static constexpr size_t LayoutCacheSize = 512;
+    std::list<shared_ptr<LaidOutText>> layoutCache;
+    map<string, std::list<shared_ptr<LaidOutText>>::iterator> layoutCacheIndex;
+
     Impl() {
         // Set interpreter version environment variable
         FreeType2SetEnv setEnv;
@@ -112,109 +197,90 @@ struct TextRenderContext::Impl {
     }
 
     ~Impl() {
+        // The cached layouts must be freed before the Pango context
+        layoutCacheIndex.clear();
+        layoutCache.clear();
+
         pango_font_description_free(fontDesc);
         g_object_unref(pangoCtx);
         g_object_unref(fontMap);
     }
 
     DISABLE_COPY_MOVE(Impl);
-};
-
-namespace {
 
-struct Graymap {
-    int width;
-    int height;
-    vector<uint8_t> buffer;
-    FT_Bitmap ftBitmap;
-
-    Graymap(int pWidth, int pHeight) {
-        width = pWidth;
-        height = pHeight;
+    // Returns the laid out text from the cache, laying it out using Pango only
+    // if it is not found. As the context has a single font, the text alone is
+    // used as the key. All the sessions share the same context, so the same
+    // labels and recently typed texts are laid out and rendered only once.
+    shared_ptr<LaidOutText> getLaidOutText(string text) {
+        auto it = layoutCacheIndex.find(text);
+        if(it != layoutCacheIndex.end()) {
+            // Move the entry to the front of the LRU list
+            layoutCache.splice(layoutCache.begin(), layoutCache, it->second);
+            return *it->second;
+        }
 
-        REQUIRE(width >= 1);
-        REQUIRE(height >= 1);
+        shared_ptr<LaidOutText> laidOutText =
+            make_shared<LaidOutText>(pangoCtx, fontDesc, move(text));
+        layoutCache.push_front(laidOutText);
+        layoutCacheIndex.emplace(laidOutText->text, layoutCache.begin());
 
-        const int Limit = INT_MAX / 9;
-        REQUIRE(width < Limit / height);
+        if(layoutCache.size() > LayoutCacheSize) {
+            // The TextLayout objects using the evicted entry retain it
+            layoutCacheIndex.erase(layoutCache.back()->text);
+            layoutCache.pop_back();
+        }
 
-        buffer.resize(width * height);
-        ftBitmap.rows = height;
-        ftBitmap.width = width;
-        ftBitmap.pitch = width;
-        ftBitmap.buffer = buffer.data();
-        ftBitmap.pixel_mode = FT_PIXEL_MODE_GRAY;
+        return laidOutText;
     }
-
-    Graymap(const Graymap&) = delete;
-    Graymap& operator=(const Graymap&) = delete;
-
-    Graymap(Graymap&&) = default;
-    Graymap& operator=(Graymap&&) = default;
 };
 
-}
-
 struct TextLayout::Impl {
     shared_ptr<TextRenderContext> ctx;
-    PangoLayout* layout;
-
-    string text;
-
-    optional<Graymap> graymap;
+    shared_ptr<LaidOutText> laidOutText;
 
     Impl(shared_ptr<TextRenderContext> ctx) : ctx(ctx) {
-        layout = pango_layout_new(ctx->impl_->pangoCtx);
-        REQUIRE(layout != nullptr);
-
-        pango_layout_set_font_description(layout, ctx->impl_->fontDesc);
-        pango_layout_set_auto_dir(layout, FALSE);
-        pango_layout_set_single_paragraph_mode(layout, TRUE);
-    }
-
-    ~Impl() {
-        g_object_unref(layout);
+        laidOutText = ctx->impl_->getLaidOutText("");
     }
 
     DISABLE_COPY_MOVE(Impl);
 
-    void setText(string newText) {
-        graymap.reset();
-
-        pango_layout_set_text(layout, newText.data(), newText.size());
-
-        // Check that Pango agrees that the text is valid UTF-8
-        REQUIRE(!strcmp(pango_layout_get_text(layout), newText.c_str()));
+    const string& text() {
+        return laidOutText->text;
+    }
 
-        text = move(newText);
+    void setText(string newText) {
+        if(newText == laidOutText->text) return;
+        laidOutText = ctx->impl_->getLaidOutText(move(newText));
     }
 
     int xCoordToIndex(int x) {
-        PangoLayoutLine* line = pango_layout_get_line_readonly(layout, 0);
+        PangoLayoutLine* line =
+            pango_layout_get_line_readonly(laidOutText->layout, 0);
         REQUIRE(line != nullptr);
 
         int idx, trailing;
         pango_layout_line_x_to_index(line, x * PANGO_SCALE, &idx, &trailing);
-        idx = jumpUTF8Chars(text, idx, trailing);
-        REQUIRE(idx >= 0 && idx <= (int)text.size());
+        idx = jumpUTF8Chars(text(), idx, trailing);
+        REQUIRE(idx >= 0 && idx <= (int)text().size());
 
         return idx;
     }
 
     int indexToXCoord(int idx) {
-        REQUIRE(idx >= 0 && idx <= (int)text.size());
+        REQUIRE(idx >= 0 && idx <= (int)text().size());
 
         PangoRectangle rect;
-        pango_layout_get_cursor_pos(layout, idx, &rect, nullptr);
+        pango_layout_get_cursor_pos(laidOutText->layout, idx, &rect, nullptr);
         return rect.x / PANGO_SCALE;
     }
 
     int visualMoveIdx(int idx, bool forward) {
-        REQUIRE(idx >= 0 && idx <= (int)text.size());
+        REQUIRE(idx >= 0 && idx <= (int)text().size());
 
         int trailing;
         pango_layout_move_cursor_visually(
-            layout,
+            laidOutText->layout,
             true,
             idx,
             false,
@@ -226,10 +292,10 @@ struct TextLayout::Impl {
         if(idx == -1) {
             idx = 0;
         } else if(idx == G_MAXINT) {
-            idx = (int)text.size();
+            idx = (int)text().size();
         } else {
-            REQUIRE(idx >= 0 && idx <= (int)text.size());
-            idx = jumpUTF8Chars(text, idx, trailing);
+            REQUIRE(idx >= 0 && idx <= (int)text().size());
+            idx = jumpUTF8Chars(text(), idx, trailing);
         }
 
         return idx;
@@ -240,12 +306,12 @@ struct TextLayout::Impl {
         int offsetX, int offsetY,
         uint8_t r, uint8_t g, uint8_t b
     ) {
-        ensureGraymapRendered();
+        const Graymap& graymap = laidOutText->getGraymap();
 
-        offsetY += dest.height() - graymap->height;
+        offsetY += dest.height() - graymap.height;
 
         Rect rect = Rect::intersection(
-            Rect(0, graymap->width, 0, graymap->height),
+            Rect(0, graymap.width, 0, graymap.height),
             Rect::translate(
                 Rect(0, dest.width(), 0, dest.height()),
                 -offsetX, -offsetY
@@ -254,8 +320,8 @@ struct TextLayout::Impl {
 
         if(!rect.isEmpty()) {
             for(int y = rect.startY; y < rect.endY; ++y) {
-                uint8_t* graymapPos =
-                    &graymap->buffer[y * graymap->width + rect.startX];
+                const uint8_t* graymapPos =
+                    &graymap.buffer[y * graymap.width + rect.startX];
                 uint8_t* destPos =
                     dest.getPixelPtr(rect.startX + offsetX, y + offsetY);
 
@@ -271,22 +337,6 @@ struct TextLayout::Impl {
             }
         }
     }
-
-    PangoRectangle getExtents() {
-        PangoRectangle extents;
-        pango_layout_get_pixel_extents(layout, nullptr, &extents);
-        extents.width = max(extents.width, 1);
-        extents.height = max(extents.height, 1);
-        return extents;
-    }
-
-    void ensureGraymapRendered() {
-        if(graymap) return;
-
-        PangoRectangle extents = getExtents();
-        graymap = Graymap(extents.width, extents.height);
-        pango_ft2_render_layout(&graymap->ftBitmap, layout, -extents.x, -extents.y);
-    }
 };
 
 TextRenderContext::TextRenderContext(CKey) {
@@ -317,17 +367,17 @@ void TextLayout::setText(string text) {
 
 string TextLayout::text() {
     REQUIRE_UI_THREAD();
-    return impl_->text;
+    return impl_->text();
 }
 
 int TextLayout::width() {
     REQUIRE_UI_THREAD();
-    return impl_->getExtents().width;
+    return impl_->laidOutText->extents.width;
 }
 
 int TextLayout::height() {
     REQUIRE_UI_THREAD();
-    return impl_->getExtents().height;
+    return impl_->laidOutText->extents.height;
 }
 
 int TextLayout::xCoordToIndex(int x) {
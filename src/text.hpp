@@ -4,7 +4,8 @@
 
 // Common text rendering library context for multiple TextLayout objects.
 // You typically need only one; you should use the one in
-// globals->textRenderContext.
+// globals->textRenderContext. The context caches the laid out and rendered
+// texts, so TextLayout objects showing the same text share them.
 class TextRenderContext {
 SHARED_ONLY_CLASS(TextRenderContext);
 public:
@@ -40,6 +40,9 @@ public:
     void setRemoveCaretOnSubmit(bool value);
     void setAllowEmptySubmit(bool value);
 
+    // Set the background color of the field (white by default)
+    void setBackgroundColor(uint8_t r, uint8_t g, uint8_t b);
+
 private:
     void unsetCaret_();
     void setCaret_(int start, int end);
@@ -55,6 +58,7 @@ private:
     // Widget:
     virtual void widgetViewportUpdated_() override;
     virtual void widgetRender_() override;
+    virtual bool widgetIsOpaque_() override;
     virtual void widgetMouseDownEvent_(int x, int y, int button) override;
     virtual void widgetMouseUpEvent_(int x, int y, int button) override;
     virtual void widgetMouseDoubleClickEvent_(int x, int y) override;
@@ -72,6 +76,10 @@ private:
     bool removeCaretOnSubmit_;
     bool allowEmptySubmit_;
 
+    uint8_t backgroundR_;
+    uint8_t backgroundG_;
+    uint8_t backgroundB_;
+
     bool hasFocus_;
     bool leftMouseButtonDown_;
     bool shiftKeyDown_;
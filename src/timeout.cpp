@@ -1,5 +1,9 @@
 #include "timeout.hpp"
 
+#include "globals.hpp"
+#include "trace.hpp"
+#include "ui_lag_monitor.hpp"
+
 #include "include/wrapper/cef_closure_task.h"
 
 Timeout::Timeout(CKey, int64_t delayMs) {
@@ -10,12 +14,15 @@ Timeout::Timeout(CKey, int64_t delayMs) {
     delayedTaskScheduled_ = false;
 }
 
-void Timeout::set(Func func) {
+void Timeout::set(Func func, const char* file, int line) {
     REQUIRE_UI_THREAD();
     REQUIRE(!active_);
 
     active_ = true;
     func_ = func;
+    traceSessionID_ = currentTraceSession();
+    funcFile_ = file;
+    funcLine_ = line;
     funcTime_ = steady_clock::now() + milliseconds(delayMs_);
 
     if(!delayedTaskScheduled_) {
@@ -70,7 +77,14 @@ void Timeout::delayedTask_() {
         active_ = false;
         Func func;
         swap(func_, func);
-        func();
+        TraceSessionScope traceSessionScope(traceSessionID_);
+        if(globals) {
+            globals->uiLagMonitor->runTask(
+                funcFile_, funcLine_, funcTime_, func
+            );
+        } else {
+            func();
+        }
     } else {
         int64_t addDelayMs = (int64_t)(duration_cast<milliseconds>(
             funcTime_ - delayedTaskTime_
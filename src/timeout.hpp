@@ -12,8 +12,15 @@ public:
     Timeout(CKey, int64_t delayMs);
 
     // Set func to be run in delayMs milliseconds or when cleared with
-    // runFunc set to true. Calling when the timeout is active is an error.
-    void set(Func func);
+    // runFunc set to true. Calling when the timeout is active is an error. The
+    // trace session of the caller (see trace.hpp) is carried over to func, and
+    // func is attributed to the source location of the caller in the UI lag
+    // monitor (see ui_lag_monitor.hpp).
+    void set(
+        Func func,
+        const char* file = __builtin_FILE(),
+        int line = __builtin_LINE()
+    );
 
     // If the timeout is active, stop it. If runFunc is true, the associated
     // function is called immediately.
@@ -30,6 +37,9 @@ private:
 
     bool active_;
     Func func_;
+    uint64_t traceSessionID_;
+    const char* funcFile_;
+    int funcLine_;
     steady_clock::time_point funcTime_;
 
     bool delayedTaskScheduled_;
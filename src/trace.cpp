@@ -0,0 +1,185 @@
+#include "trace.hpp"
+
+#include <pthread.h>
+#include <unistd.h>
+
+atomic<bool> tracingEnabled_(false);
+
+namespace {
+
+// Number of events stored per thread; older events are overwritten
+constexpr size_t RingBufferSize = 16384;
+
+struct TraceEvent {
+    const char* name;
+    uint64_t sessionID;
+    steady_clock::time_point begin;
+    steady_clock::time_point end;
+};
+
+struct ThreadTraceBuffer {
+    ThreadTraceBuffer(int tid, string threadName)
+        : tid(tid),
+          threadName(move(threadName)),
+          nextPos(0)
+    {}
+
+    const int tid;
+    const string threadName;
+
+    mutex bufferMutex;
+    vector<TraceEvent> events;
+    size_t nextPos;
+};
+
+mutex registryMutex;
+vector<shared_ptr<ThreadTraceBuffer>> registry;
+int nextTID = 1;
+
+const steady_clock::time_point traceEpoch = steady_clock::now();
+
+// Unregisters the buffer of the thread at thread exit, discarding its events
+struct ThreadTraceBufferHolder {
+    ~ThreadTraceBufferHolder() {
+        if(buffer) {
+            lock_guard<mutex> lock(registryMutex);
+            registry.erase(
+                std::remove(registry.begin(), registry.end(), buffer),
+                registry.end()
+            );
+        }
+    }
+
+    shared_ptr<ThreadTraceBuffer> buffer;
+};
+
+thread_local uint64_t threadSessionID = 0;
+thread_local ThreadTraceBufferHolder threadBufferHolder;
+
+ThreadTraceBuffer& getThreadBuffer() {
+    if(!threadBufferHolder.buffer) {
+        char threadName[32] = "";
+        pthread_getname_np(pthread_self(), threadName, sizeof(threadName));
+
+        lock_guard<mutex> lock(registryMutex);
+        threadBufferHolder.buffer =
+            make_shared<ThreadTraceBuffer>(nextTID++, threadName);
+        registry.push_back(threadBufferHolder.buffer);
+    }
+    return *threadBufferHolder.buffer;
+}
+
+double toTraceMicroseconds(steady_clock::duration duration) {
+    return std::chrono::duration<double, std::micro>(duration).count();
+}
+
+string jsonEscape(const string& str) {
+    string ret;
+    for(char c : str) {
+        if(c == '"' || c == '\\') {
+            ret.push_back('\\');
+            ret.push_back(c);
+        } else if((unsigned char)c >= 0x20) {
+            ret.push_back(c);
+        }
+    }
+    return ret;
+}
+
+}
+
+void setTracingEnabled(bool value) {
+    tracingEnabled_.store(value);
+}
+
+uint64_t currentTraceSession() {
+    return threadSessionID;
+}
+
+TraceSessionScope::TraceSessionScope(uint64_t sessionID) {
+    prevSessionID_ = threadSessionID;
+    threadSessionID = sessionID;
+}
+
+TraceSessionScope::~TraceSessionScope() {
+    threadSessionID = prevSessionID_;
+}
+
+void recordTraceEvent(
+    const char* name,
+    uint64_t sessionID,
+    steady_clock::time_point begin,
+    steady_clock::time_point end
+) {
+    if(!isTracingEnabled()) {
+        return;
+    }
+
+    ThreadTraceBuffer& buffer = getThreadBuffer();
+    lock_guard<mutex> lock(buffer.bufferMutex);
+
+    TraceEvent event = {name, sessionID, begin, end};
+    if(buffer.events.size() < RingBufferSize) {
+        buffer.events.push_back(event);
+    } else {
+        buffer.events[buffer.nextPos] = event;
+    }
+    buffer.nextPos = (buffer.nextPos + 1) % RingBufferSize;
+}
+
+void writeTraceJSON(ostream& out, uint64_t sessionID) {
+    REQUIRE(sessionID != 0);
+
+    vector<shared_ptr<ThreadTraceBuffer>> buffers;
+    {
+        lock_guard<mutex> lock(registryMutex);
+        buffers = registry;
+    }
+
+    int pid = (int)getpid();
+
+    std::ios_base::fmtflags oldFlags = out.flags();
+    std::streamsize oldPrecision = out.precision(3);
+    out.setf(std::ios_base::fixed, std::ios_base::floatfield);
+
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    bool first = true;
+    auto separator = [&]() {
+        if(!first) {
+            out << ",";
+        }
+        first = false;
+        out << "\n";
+    };
+
+    for(const shared_ptr<ThreadTraceBuffer>& buffer : buffers) {
+        vector<TraceEvent> events;
+        {
+            lock_guard<mutex> lock(buffer->bufferMutex);
+            events = buffer->events;
+        }
+
+        separator();
+        out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << pid;
+        out << ",\"tid\":" << buffer->tid;
+        out << ",\"args\":{\"name\":\"" << jsonEscape(buffer->threadName) << "\"}}";
+
+        for(const TraceEvent& event : events) {
+            if(event.sessionID != sessionID) {
+                continue;
+            }
+
+            separator();
+            out << "{\"name\":\"" << event.name << "\",\"cat\":\"browservice\"";
+            out << ",\"ph\":\"X\",\"pid\":" << pid << ",\"tid\":" << buffer->tid;
+            out << ",\"ts\":" << toTraceMicroseconds(event.begin - traceEpoch);
+            out << ",\"dur\":" << toTraceMicroseconds(event.end - event.begin);
+            out << "}";
+        }
+    }
+
+    out << "\n]}\n";
+
+    out.flags(oldFlags);
+    out.precision(oldPrecision);
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include "common.hpp"
+
+// Lightweight tracing of the image pipeline for diagnosing latency. When
+// tracing is enabled (using the --tracing option), the TRACE_SCOPE trace points
+// record their durations into per-thread ring buffers, from which the events of
+// a single session can be dumped in the Chrome trace event format (viewable in
+// chrome://tracing or Perfetto). When tracing is disabled, a trace point only
+// costs a relaxed atomic load.
+//
+// The events are attributed to the session set for the current thread using
+// TraceSessionScope; postTask carries the session over to the posted task. The
+// session is also used for attributing UI thread tasks in ui_lag_monitor.hpp.
+
+extern atomic<bool> tracingEnabled_;
+
+inline bool isTracingEnabled() {
+    return tracingEnabled_.load(memory_order_relaxed);
+}
+
+void setTracingEnabled(bool value);
+
+// Returns the session ID set for the current thread, or 0 if not set
+uint64_t currentTraceSession();
+
+// Sets the trace session of the current thread for the lifetime of the object
+class TraceSessionScope {
+public:
+    TraceSessionScope(uint64_t sessionID);
+    ~TraceSessionScope();
+    DISABLE_COPY_MOVE(TraceSessionScope);
+
+private:
+    uint64_t prevSessionID_;
+};
+
+// Record a single complete event. The name must be a string literal (or
+// otherwise outlive the program).
+void recordTraceEvent(
+    const char* name,
+    uint64_t sessionID,
+    steady_clock::time_point begin,
+    steady_clock::time_point end
+);
+
+class TraceScope {
+public:
+    TraceScope(const char* name)
+        : name_(name),
+          active_(isTracingEnabled())
+    {
+        if(active_) {
+            begin_ = steady_clock::now();
+        }
+    }
+    ~TraceScope() {
+        if(active_) {
+            recordTraceEvent(
+                name_, currentTraceSession(), begin_, steady_clock::now()
+            );
+        }
+    }
+    DISABLE_COPY_MOVE(TraceScope);
+
+private:
+    const char* name_;
+    bool active_;
+    steady_clock::time_point begin_;
+};
+
+#define TRACE_SCOPE_CONCAT_(a, b) a ## b
+#define TRACE_SCOPE_VAR_(line) TRACE_SCOPE_CONCAT_(traceScope_, line)
+#define TRACE_SCOPE(name) TraceScope TRACE_SCOPE_VAR_(__LINE__)(name)
+
+// Write the events of given session currently stored in the ring buffers as
+// Chrome trace event format JSON. The events of other sessions are never
+// included, as the session ID is a secret that allows controlling the
+// session.
+void writeTraceJSON(ostream& out, uint64_t sessionID);
@@ -0,0 +1,284 @@
+#include "ui_lag_monitor.hpp"
+
+#include "trace.hpp"
+
+namespace {
+
+// Completed tasks that ran for longer than this are logged
+constexpr double SlowTaskSeconds = 0.1;
+
+// Tasks that have been running for longer than this are logged by the watchdog
+// while they are still running
+constexpr steady_clock::duration StallDuration = milliseconds(1000);
+
+constexpr steady_clock::duration WatchdogInterval = milliseconds(100);
+
+// Number of origins with the largest total running time written to metrics
+constexpr size_t WorstOriginCount = 20;
+
+double toSeconds(steady_clock::duration duration) {
+    return std::chrono::duration<double>(duration).count();
+}
+
+int64_t toMilliseconds(steady_clock::duration duration) {
+    return (int64_t)duration_cast<milliseconds>(duration).count();
+}
+
+void writeHeader(ostream& out, const char* name, const char* type, const char* help) {
+    out << "# HELP " << name << " " << help << "\n";
+    out << "# TYPE " << name << " " << type << "\n";
+}
+
+}
+
+UILagMonitor::UILagMonitor(CKey)
+    : taskDepth_(0),
+      currentTaskRunning_(false),
+      currentTaskFile_(nullptr),
+      currentTaskLine_(0),
+      currentTaskSessionID_(0),
+      currentTaskStallReported_(false),
+      stallCount_(0),
+      shutdown_(false)
+{
+    watchdogThread_ = thread([this]() {
+        runWatchdogThread_();
+    });
+}
+
+UILagMonitor::~UILagMonitor() {
+    shutdown_.store(true);
+    watchdogThread_.join();
+}
+
+void UILagMonitor::runTask(
+    const char* file,
+    int line,
+    steady_clock::time_point readyTime,
+    const function<void()>& func
+) {
+    REQUIRE_UI_THREAD();
+
+    // Tasks run within other tasks (in nested message loops) are accounted to
+    // the outermost task
+    if(taskDepth_ > 0) {
+        func();
+        return;
+    }
+
+    uint64_t sessionID = currentTraceSession();
+    steady_clock::time_point startTime = steady_clock::now();
+    {
+        lock_guard<mutex> lock(currentTaskMutex_);
+        currentTaskRunning_ = true;
+        currentTaskFile_ = file;
+        currentTaskLine_ = line;
+        currentTaskSessionID_ = sessionID;
+        currentTaskStartTime_ = startTime;
+        currentTaskStallReported_ = false;
+    }
+
+    ++taskDepth_;
+    func();
+    --taskDepth_;
+
+    steady_clock::time_point endTime = steady_clock::now();
+    {
+        lock_guard<mutex> lock(currentTaskMutex_);
+        currentTaskRunning_ = false;
+    }
+
+    double queueTime = max(toSeconds(startTime - readyTime), 0.0);
+    double runTime = toSeconds(endTime - startTime);
+    bool slow = runTime >= SlowTaskSeconds;
+
+    OriginStats& stats = originStats_[pair<const char*, int>(file, line)];
+    ++stats.count;
+    stats.queueTimeSum += queueTime;
+    stats.queueTimeMax = max(stats.queueTimeMax, queueTime);
+    stats.runTimeSum += runTime;
+    if(runTime > stats.runTimeMax) {
+        stats.runTimeMax = runTime;
+        stats.runTimeMaxSessionID = sessionID;
+    }
+
+    if(sessionID != 0) {
+        SessionStats& sessionStats = sessionStats_[sessionID];
+        ++sessionStats.count;
+        sessionStats.runTimeSum += runTime;
+        if(slow) {
+            ++sessionStats.slowCount;
+        }
+    }
+
+    if(slow) {
+        ++stats.slowCount;
+        WARNING_LOG(
+            "Slow UI thread task posted from ", file, ":", line,
+            " (session ", sessionID, ") ran for ",
+            toMilliseconds(endTime - startTime), " ms after waiting for ",
+            toMilliseconds(startTime - readyTime), " ms in the queue"
+        );
+    }
+}
+
+void UILagMonitor::write(
+    ostream& out,
+    const vector<pair<uint64_t, uint64_t>>& sessions
+) {
+    REQUIRE_UI_THREAD();
+
+    map<uint64_t, uint64_t> sessionIndices(sessions.begin(), sessions.end());
+
+    // Merge the stats of the same source location that may have different
+    // file pointers in different translation units
+    map<string, OriginStats> merged;
+    for(const pair<const pair<const char*, int>, OriginStats>& p : originStats_) {
+        string origin = string(p.first.first) + ":" + toString(p.first.second);
+        OriginStats& dest = merged[origin];
+        const OriginStats& src = p.second;
+        dest.count += src.count;
+        dest.slowCount += src.slowCount;
+        dest.queueTimeSum += src.queueTimeSum;
+        dest.queueTimeMax = max(dest.queueTimeMax, src.queueTimeMax);
+        dest.runTimeSum += src.runTimeSum;
+        if(src.runTimeMax > dest.runTimeMax) {
+            dest.runTimeMax = src.runTimeMax;
+            dest.runTimeMaxSessionID = src.runTimeMaxSessionID;
+        }
+    }
+
+    vector<pair<string, OriginStats>> worst(merged.begin(), merged.end());
+    sort(
+        worst.begin(), worst.end(),
+        [](const pair<string, OriginStats>& a, const pair<string, OriginStats>& b) {
+            return a.second.runTimeSum > b.second.runTimeSum;
+        }
+    );
+    if(worst.size() > WorstOriginCount) {
+        worst.resize(WorstOriginCount);
+    }
+
+    auto writeOrigins = [&](
+        const char* name,
+        const char* type,
+        const char* help,
+        function<void(const OriginStats&)> writeValue
+    ) {
+        writeHeader(out, name, type, help);
+        for(const pair<string, OriginStats>& p : worst) {
+            out << name << "{origin=\"" << p.first << "\"} ";
+            writeValue(p.second);
+            out << "\n";
+        }
+    };
+
+    std::streamsize oldPrecision = out.precision(15);
+
+    writeOrigins(
+        "browservice_ui_origin_tasks_total", "counter",
+        "Number of UI thread tasks run by the call site that posted them.",
+        [&](const OriginStats& stats) { out << stats.count; }
+    );
+    writeOrigins(
+        "browservice_ui_origin_slow_tasks_total", "counter",
+        "Number of UI thread tasks that ran for at least 100 ms by the call site that posted them.",
+        [&](const OriginStats& stats) { out << stats.slowCount; }
+    );
+    writeOrigins(
+        "browservice_ui_origin_run_seconds_total", "counter",
+        "Total time spent running UI thread tasks by the call site that posted them.",
+        [&](const OriginStats& stats) { out << stats.runTimeSum; }
+    );
+    writeOrigins(
+        "browservice_ui_origin_run_seconds_max", "gauge",
+        "Longest running time of a single UI thread task by the call site that posted it.",
+        [&](const OriginStats& stats) { out << stats.runTimeMax; }
+    );
+    writeOrigins(
+        "browservice_ui_origin_queue_seconds_total", "counter",
+        "Total time UI thread tasks waited in the queue by the call site that posted them.",
+        [&](const OriginStats& stats) { out << stats.queueTimeSum; }
+    );
+    writeOrigins(
+        "browservice_ui_origin_queue_seconds_max", "gauge",
+        "Longest time a single UI thread task waited in the queue by the call site that posted it.",
+        [&](const OriginStats& stats) { out << stats.queueTimeMax; }
+    );
+
+    writeHeader(
+        out, "browservice_ui_origin_worst_session", "gauge",
+        "Index of the session of the longest running UI thread task by the call site that posted it (0 if none or if the session has been closed)."
+    );
+    for(const pair<string, OriginStats>& p : worst) {
+        auto it = sessionIndices.find(p.second.runTimeMaxSessionID);
+        uint64_t sessionIndex = it != sessionIndices.end() ? it->second : 0;
+        out << "browservice_ui_origin_worst_session{origin=\"" << p.first << "\"} "
+            << sessionIndex << "\n";
+    }
+
+    // Discard the stats of closed sessions
+    map<uint64_t, SessionStats> sessionStats;
+    for(const pair<uint64_t, uint64_t>& session : sessions) {
+        auto it = sessionStats_.find(session.first);
+        sessionStats[session.first] =
+            it != sessionStats_.end() ? it->second : SessionStats();
+    }
+    swap(sessionStats_, sessionStats);
+
+    writeHeader(
+        out, "browservice_session_ui_tasks_total", "counter",
+        "Number of UI thread tasks run for the session."
+    );
+    for(const pair<const uint64_t, SessionStats>& p : sessionStats_) {
+        out << "browservice_session_ui_tasks_total{session=\"" << sessionIndices[p.first] << "\"} "
+            << p.second.count << "\n";
+    }
+    writeHeader(
+        out, "browservice_session_ui_slow_tasks_total", "counter",
+        "Number of UI thread tasks that ran for at least 100 ms for the session."
+    );
+    for(const pair<const uint64_t, SessionStats>& p : sessionStats_) {
+        out << "browservice_session_ui_slow_tasks_total{session=\"" << sessionIndices[p.first] << "\"} "
+            << p.second.slowCount << "\n";
+    }
+    writeHeader(
+        out, "browservice_session_ui_run_seconds_total", "counter",
+        "Total time spent running UI thread tasks for the session."
+    );
+    for(const pair<const uint64_t, SessionStats>& p : sessionStats_) {
+        out << "browservice_session_ui_run_seconds_total{session=\"" << sessionIndices[p.first] << "\"} "
+            << p.second.runTimeSum << "\n";
+    }
+
+    out.precision(oldPrecision);
+
+    writeHeader(
+        out, "browservice_ui_stalls_total", "counter",
+        "Number of times a UI thread task has been running for over a second."
+    );
+    out << "browservice_ui_stalls_total " << stallCount_.load() << "\n";
+}
+
+void UILagMonitor::runWatchdogThread_() {
+    while(!shutdown_.load()) {
+        sleep_for(WatchdogInterval);
+
+        steady_clock::time_point now = steady_clock::now();
+        lock_guard<mutex> lock(currentTaskMutex_);
+        if(
+            currentTaskRunning_ &&
+            !currentTaskStallReported_ &&
+            now - currentTaskStartTime_ >= StallDuration
+        ) {
+            currentTaskStallReported_ = true;
+            stallCount_.fetch_add(1);
+            WARNING_LOG(
+                "UI thread stalled: task posted from ",
+                currentTaskFile_, ":", currentTaskLine_,
+                " (session ", currentTaskSessionID_, ") has been running for ",
+                toMilliseconds(now - currentTaskStartTime_), " ms"
+            );
+        }
+    }
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include "common.hpp"
+
+// Monitor for the CEF UI thread that runs almost all of the server logic. All
+// tasks posted using postTask and Timeout are run through runTask, which
+// measures how long the task waited in the queue and how long it ran, and
+// attributes the times to the call site that posted the task and the session
+// (as set by TraceSessionScope in trace.hpp). Tasks that run for long are
+// logged, and a watchdog thread logs tasks that stall the UI thread while they
+// are still running. The per-origin statistics of the worst offenders are
+// written along with the other metrics to /metrics.
+class UILagMonitor {
+SHARED_ONLY_CLASS(UILagMonitor);
+public:
+    UILagMonitor(CKey);
+    ~UILagMonitor();
+
+    // Run func in the UI thread as a task posted from given source location.
+    // The queueing delay is measured from readyTime, i.e. the time when the
+    // task could have been run at the earliest.
+    void runTask(
+        const char* file,
+        int line,
+        steady_clock::time_point readyTime,
+        const function<void()>& func
+    );
+
+    // Write the statistics in the Prometheus text exposition format. The
+    // sessions are given as (session ID, session index) pairs; the sessions
+    // are labelled with the non-secret index (see SessionMetrics). The
+    // statistics of the sessions not given are discarded, as the sessions have
+    // been closed. Must be called from the UI thread.
+    void write(
+        ostream& out,
+        const vector<pair<uint64_t, uint64_t>>& sessions
+    );
+
+private:
+    void runWatchdogThread_();
+
+    struct OriginStats {
+        uint64_t count = 0;
+        uint64_t slowCount = 0;
+        double queueTimeSum = 0.0;
+        double queueTimeMax = 0.0;
+        double runTimeSum = 0.0;
+        double runTimeMax = 0.0;
+        uint64_t runTimeMaxSessionID = 0;
+    };
+
+    struct SessionStats {
+        uint64_t count = 0;
+        uint64_t slowCount = 0;
+        double runTimeSum = 0.0;
+    };
+
+    // Only accessed from the UI thread
+    map<pair<const char*, int>, OriginStats> originStats_;
+    map<uint64_t, SessionStats> sessionStats_;
+    int taskDepth_;
+
+    // The task currently running in the UI thread, shared with the watchdog
+    mutex currentTaskMutex_;
+    bool currentTaskRunning_;
+    const char* currentTaskFile_;
+    int currentTaskLine_;
+    uint64_t currentTaskSessionID_;
+    steady_clock::time_point currentTaskStartTime_;
+    bool currentTaskStallReported_;
+
+    atomic<uint64_t> stallCount_;
+    atomic<bool> shutdown_;
+    thread watchdogThread_;
+};
@@ -7,6 +7,7 @@ Widget::Widget(weak_ptr<WidgetParent> parent) {
 
     parent_ = parent;
     viewDirty_ = false;
+    childViewDirty_ = false;
 
     mouseOver_ = false;
     focused_ = false;
@@ -31,16 +32,11 @@ ImageSlice Widget::getViewport() {
     return viewport_;
 }
 
-void Widget::render() {
+Rect Widget::render() {
     REQUIRE_UI_THREAD();
 
-    viewDirty_ = false;
-    widgetRender_();
-
-    for(shared_ptr<Widget> child : widgetListChildren_()) {
-        REQUIRE(child);
-        child->render();
-    }
+    resolveDirty_();
+    return renderDirty_();
 }
 
 int Widget::cursor() {
@@ -172,6 +168,8 @@ void Widget::sendKeyDownEvent(int key) {
         onGlobalHotkeyPressed(GlobalHotkey::FindNext);
     } else if(key == keys::F5) {
         onGlobalHotkeyPressed(GlobalHotkey::Refresh);
+    } else if(key == keys::F9) {
+        onGlobalHotkeyPressed(GlobalHotkey::PerfStats);
     } else if(
         keysDown_.count(keys::Control) &&
         (key == (int)'r' || key == (int)'R')
@@ -216,7 +214,15 @@ void Widget::sendLoseFocusEvent() {
 
 void Widget::onWidgetViewDirty() {
     REQUIRE_UI_THREAD();
-    signalViewDirty_();
+
+    // Propagate the information that a descendant is dirty up to the root
+    bool wasDirty = viewDirty_ || childViewDirty_;
+    childViewDirty_ = true;
+    if(!wasDirty) {
+        if(shared_ptr<WidgetParent> parent = parent_.lock()) {
+            parent->onWidgetViewDirty();
+        }
+    }
 }
 
 void Widget::onWidgetCursorChanged() {
@@ -257,11 +263,21 @@ void Widget::onGlobalHotkeyPressed(GlobalHotkey key) {
     }
 }
 
+bool Widget::canRenderAnimationFrame() {
+    REQUIRE_UI_THREAD();
+
+    if(shared_ptr<WidgetParent> parent = parent_.lock()) {
+        return parent->canRenderAnimationFrame();
+    }
+    return true;
+}
+
 void Widget::signalViewDirty_() {
     REQUIRE_UI_THREAD();
 
-    if(!viewDirty_) {
-        viewDirty_ = true;
+    bool wasDirty = viewDirty_ || childViewDirty_;
+    viewDirty_ = true;
+    if(!wasDirty) {
         if(shared_ptr<WidgetParent> parent = parent_.lock()) {
             parent->onWidgetViewDirty();
         }
@@ -363,6 +379,58 @@ void Widget::updateCursor_() {
     }
 }
 
+// Marks the widget itself dirty if one of its dirty descendants cannot be
+// rendered without rendering it first; returns true if the widget itself needs
+// to be rendered
+bool Widget::resolveDirty_() {
+    if(childViewDirty_ && !viewDirty_) {
+        for(shared_ptr<Widget> child : widgetListChildren_()) {
+            REQUIRE(child);
+            if(child->resolveDirty_() && !child->widgetIsOpaque_()) {
+                viewDirty_ = true;
+            }
+        }
+    }
+    return viewDirty_;
+}
+
+Rect Widget::renderDirty_() {
+    if(viewDirty_) {
+        renderAll_();
+        return viewportRect_();
+    }
+
+    Rect damage;
+    if(childViewDirty_) {
+        childViewDirty_ = false;
+        for(shared_ptr<Widget> child : widgetListChildren_()) {
+            REQUIRE(child);
+            damage = Rect::boundingBox(damage, child->renderDirty_());
+        }
+    }
+    return damage;
+}
+
+void Widget::renderAll_() {
+    viewDirty_ = false;
+    childViewDirty_ = false;
+    widgetRender_();
+
+    for(shared_ptr<Widget> child : widgetListChildren_()) {
+        REQUIRE(child);
+        child->renderAll_();
+    }
+}
+
+Rect Widget::viewportRect_() {
+    return Rect(
+        viewport_.globalX(),
+        viewport_.globalX() + viewport_.width(),
+        viewport_.globalY(),
+        viewport_.globalY() + viewport_.height()
+    );
+}
+
 #define DEFINE_EVENT_FORWARD(name, widgetPtr, args, call) \
     void Widget::forward ## name ## Event_ args { \
         if(widgetPtr) { \
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "image_slice.hpp"
+#include "rect.hpp"
 
 static constexpr int HandCursor = 0;
 static constexpr int NormalCursor = 1;
@@ -11,7 +12,8 @@ enum class GlobalHotkey {
     Address,
     Find,
     FindNext,
-    Refresh
+    Refresh,
+    PerfStats
 };
 
 class Widget;
@@ -25,6 +27,15 @@ public:
     virtual void onWidgetCursorChanged() = 0;
     virtual void onWidgetTakeFocus(Widget* child) {}
     virtual void onGlobalHotkeyPressed(GlobalHotkey key) = 0;
+
+    // Widgets should call this before rendering a frame of a purely cosmetic
+    // animation (such as a loading indicator or a blinking caret) and skip the
+    // frame if it returns false. Returns false while the previous frames have
+    // not yet reached the client, so that the animations run at most at the
+    // rate frames are delivered and do not delay the actual content.
+    virtual bool canRenderAnimationFrame() {
+        return true;
+    }
 };
 
 class Widget : public WidgetParent {
@@ -34,7 +45,10 @@ public:
     void setViewport(ImageSlice viewport);
     ImageSlice getViewport();
 
-    void render();
+    // Render the parts of the widget tree that have changed since the last
+    // call and return the bounding box of the rendered area in global
+    // coordinates (empty if nothing was rendered)
+    Rect render();
 
     int cursor();
 
@@ -62,10 +76,13 @@ public:
     virtual void onWidgetCursorChanged() override;
     virtual void onWidgetTakeFocus(Widget* child) override;
     virtual void onGlobalHotkeyPressed(GlobalHotkey key) override;
+    virtual bool canRenderAnimationFrame() override;
 
 protected:
     // The widget should call this when its view has updated and the changes
-    // should be rendered
+    // should be rendered. If the widget is opaque (see widgetIsOpaque_), only
+    // it and its children are rendered again; otherwise, its parent is
+    // rendered too.
     void signalViewDirty_();
 
     // The widget should call this to update its own cursor; the effects might
@@ -102,6 +119,14 @@ protected:
         return {};
     }
 
+    // Should return true if widgetRender_ sets every pixel it draws without
+    // depending on the previous contents of the viewport (for example, by
+    // filling the background first). Then the widget can be rendered without
+    // rendering its parent first when only it has changed.
+    virtual bool widgetIsOpaque_() {
+        return false;
+    }
+
     // Input event handlers for events targeted at this widget. Mouse
     // coordinates are local to the widget viewport.
     virtual void widgetMouseDownEvent_(int x, int y, int button) {}
@@ -126,6 +151,11 @@ private:
 
     void updateCursor_();
 
+    bool resolveDirty_();
+    Rect renderDirty_();
+    void renderAll_();
+    Rect viewportRect_();
+
     void forwardMouseDownEvent_(int x, int y, int button);
     void forwardMouseUpEvent_(int x, int y, int button);
     void forwardMouseDoubleClickEvent_(int x, int y);
@@ -140,7 +170,11 @@ private:
 
     weak_ptr<WidgetParent> parent_;
     ImageSlice viewport_;
+
+    // viewDirty_ is set if the widget itself needs to be rendered, and
+    // childViewDirty_ if some of its descendants need to be rendered
     bool viewDirty_;
+    bool childViewDirty_;
 
     shared_ptr<Widget> focusChild_;
     shared_ptr<Widget> mouseOverChild_;